@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+constexpr size_t SIMD_ALIGNMENT = 64;
+
+template <typename T>
+class AlignedBuffer
+{
+	static_assert(std::is_trivially_copyable<T>::value, "AlignedBuffer only holds trivially copyable types");
+
+public:
+	AlignedBuffer() = default;
+
+	explicit AlignedBuffer(const size_t count)
+	{
+		resize(count);
+	}
+
+	AlignedBuffer(const AlignedBuffer &other)
+	{
+		resize(other.m_size);
+		if (m_size > 0)
+		{
+			std::memcpy(m_data, other.m_data, m_size * sizeof(T));
+		}
+	}
+
+	AlignedBuffer(AlignedBuffer &&other) noexcept
+		: m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0)), m_owner(std::move(other.m_owner))
+	{
+	}
+
+	AlignedBuffer &operator=(AlignedBuffer other) noexcept
+	{
+		std::swap(m_data, other.m_data);
+		std::swap(m_size, other.m_size);
+		std::swap(m_owner, other.m_owner);
+		return *this;
+	}
+
+	// Uses count elements at data without copying, e.g. a section of a mapped
+	// file; owner keeps that memory alive. data must be SIMD_ALIGNMENT aligned.
+	// Resizing moves the contents into owned memory.
+	static AlignedBuffer view(T *data, const size_t count, std::shared_ptr<void> owner)
+	{
+		AlignedBuffer buffer;
+		buffer.m_data = data;
+		buffer.m_size = count;
+		buffer.m_owner = std::move(owner);
+		return buffer;
+	}
+
+	~AlignedBuffer()
+	{
+		release();
+	}
+
+	// Keeps the existing prefix and zero-fills any new elements
+	void resize(const size_t count)
+	{
+		if (count == m_size)
+		{
+			return;
+		}
+
+		T *data = nullptr;
+		if (count > 0)
+		{
+			data = static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(SIMD_ALIGNMENT)));
+			auto kept = std::min(count, m_size);
+			if (kept > 0)
+			{
+				std::memcpy(data, m_data, kept * sizeof(T));
+			}
+			std::memset(data + kept, 0, (count - kept) * sizeof(T));
+		}
+
+		release();
+		m_data = data;
+		m_size = count;
+	}
+
+	T *data() { return m_data; }
+	const T *data() const { return m_data; }
+
+	size_t size() const { return m_size; }
+
+	T &operator[](const size_t i) { return m_data[i]; }
+	const T &operator[](const size_t i) const { return m_data[i]; }
+
+	T *begin() { return m_data; }
+	T *end() { return m_data + m_size; }
+	const T *begin() const { return m_data; }
+	const T *end() const { return m_data + m_size; }
+
+private:
+	void release()
+	{
+		if (m_owner)
+		{
+			m_owner.reset();
+		}
+		else if (m_data)
+		{
+			::operator delete(m_data, std::align_val_t(SIMD_ALIGNMENT));
+		}
+		m_data = nullptr;
+	}
+
+	T *m_data = nullptr;
+	size_t m_size = 0;
+	std::shared_ptr<void> m_owner;	// set for views of external memory
+};
@@ -0,0 +1,127 @@
+#include "barnes_hut.h"
+
+#include <cmath>
+
+#include "particle_store.h"
+#include "thread_pool.h"
+
+BarnesHutSolver::BarnesHutSolver(const GravityParams &params, const float openingAngle, const uint32_t leafCapacity, const float maxOverlap)
+	: ForceSolver(params), m_openingAngle(openingAngle), m_maxOverlap(maxOverlap), m_tree(leafCapacity)
+{
+}
+
+void BarnesHutSolver::computeAccelerations(ParticleStore &particles, ThreadPool &pool)
+{
+	// Walk cost varies a lot between bodies, so chunks stay small enough to steal
+	constexpr size_t WALK_GRAIN = 256;
+
+	m_tree.update(particles, pool, m_maxOverlap);
+
+	const auto &order = m_tree.order();
+	const auto G = m_params.gravitationalConstant;
+
+	// Walking targets in tree order keeps consecutive walks on the same nodes
+	pool.parallelFor(0, m_tree.bodyCount(), WALK_GRAIN, [&](const size_t first, const size_t last)
+	{
+		for (auto slot = first; slot < last; ++slot)
+		{
+			float ax, ay, az;
+			accelerationAt(m_tree.x()[slot], m_tree.y()[slot], m_tree.z()[slot], ax, ay, az);
+
+			auto index = order[slot];
+			particles.ax[index] = G * ax;
+			particles.ay[index] = G * ay;
+			particles.az[index] = G * az;
+		}
+	});
+}
+
+size_t BarnesHutSolver::computeActiveAccelerations(ParticleStore &particles, const std::vector<uint32_t> &active, ThreadPool &pool)
+{
+	constexpr size_t WALK_GRAIN = 256;
+
+	// The tree still covers every body, at its predicted position
+	m_tree.update(particles, pool, m_maxOverlap);
+
+	const auto G = m_params.gravitationalConstant;
+	pool.parallelFor(0, active.size(), WALK_GRAIN, [&](const size_t first, const size_t last)
+	{
+		for (auto k = first; k < last; ++k)
+		{
+			const auto index = active[k];
+			float ax, ay, az;
+			accelerationAt(particles.x[index], particles.y[index], particles.z[index], ax, ay, az);
+
+			particles.ax[index] = G * ax;
+			particles.ay[index] = G * ay;
+			particles.az[index] = G * az;
+		}
+	});
+
+	return active.size();
+}
+
+void BarnesHutSolver::accelerationAt(const float px, const float py, const float pz, float &ax, float &ay, float &az) const
+{
+	constexpr size_t STACK_SIZE = 8 * Octree::MAX_DEPTH + 1;
+
+	const auto &nodes = m_tree.nodes();
+	const float *x = m_tree.x().data();
+	const float *y = m_tree.y().data();
+	const float *z = m_tree.z().data();
+	const float *m = m_tree.mass().data();
+	const auto eps2 = m_params.softening * m_params.softening;
+	const auto theta2 = m_openingAngle * m_openingAngle;
+
+	ax = ay = az = 0.0f;
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	uint32_t stack[STACK_SIZE];
+	size_t top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const auto &node = nodes[stack[--top]];
+
+		auto dx = node.comX - px;
+		auto dy = node.comY - py;
+		auto dz = node.comZ - pz;
+		auto d2 = dx * dx + dy * dy + dz * dz;
+
+		if (node.size * node.size < theta2 * d2 && !node.contains(px, py, pz))
+		{
+			auto r2 = d2 + eps2;
+			auto invR = 1.0f / std::sqrt(r2);
+			auto s = node.mass * invR * invR * invR;
+			ax += dx * s;
+			ay += dy * s;
+			az += dz * s;
+		}
+		else if (node.isLeaf())
+		{
+			for (auto j = node.firstBody; j < node.firstBody + node.bodyCount; ++j)
+			{
+				auto bx = x[j] - px;
+				auto by = y[j] - py;
+				auto bz = z[j] - pz;
+				auto r2 = bx * bx + by * by + bz * bz + eps2;
+				auto invR = 1.0f / std::sqrt(r2);
+				auto s = m[j] * invR * invR * invR;
+				ax += bx * s;
+				ay += by * s;
+				az += bz * s;
+			}
+		}
+		else
+		{
+			for (auto c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+			{
+				stack[top++] = c;
+			}
+		}
+	}
+}
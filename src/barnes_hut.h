@@ -0,0 +1,42 @@
+#pragma once
+
+#include "force_solver.h"
+#include "octree.h"
+
+class BarnesHutSolver : public ForceSolver
+{
+public:
+	// maxOverlap > 0 refits the tree between full builds until sibling boxes
+	// overlap by that fraction (see Octree::update); 0 rebuilds every evaluation
+	BarnesHutSolver(const GravityParams &params, float openingAngle, uint32_t leafCapacity = 16, float maxOverlap = 0.0f);
+
+	const char *name() const override
+	{
+		return "barnes-hut";
+	}
+
+	void computeAccelerations(ParticleStore &particles, ThreadPool &pool) override;
+	size_t computeActiveAccelerations(ParticleStore &particles, const std::vector<uint32_t> &active, ThreadPool &pool) override;
+
+	float openingAngle() const
+	{
+		return m_openingAngle;
+	}
+
+	float maxOverlap() const
+	{
+		return m_maxOverlap;
+	}
+
+	const Octree &tree() const
+	{
+		return m_tree;
+	}
+
+private:
+	void accelerationAt(float px, float py, float pz, float &ax, float &ay, float &az) const;
+
+	float m_openingAngle;
+	float m_maxOverlap;
+	Octree m_tree;
+};
@@ -0,0 +1,402 @@
+// Throughput benchmarks of the CPU side of the simulation: every force backend,
+// the tree build, the integrator and vertex packing, over a range of body counts
+// and with one thread versus the whole pool. Results are written as CSV or JSON
+// so runs can be diffed against a stored baseline.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "barnes_hut.h"
+#include "cpu_features.h"
+#include "direct_sum.h"
+#include "fmm.h"
+#include "initial_conditions.h"
+#include "morton_order.h"
+#include "octree.h"
+#include "particle_mesh.h"
+#include "particle_store.h"
+#include "simulation.h"
+#include "step_pipeline.h"
+#include "thread_pool.h"
+#include "vertex.h"
+
+namespace
+{
+	struct BenchOptions
+	{
+		std::vector<size_t> sizes = { 1000, 10000, 100000, 1000000, 10000000 };
+		// Direct summation is O(N^2); above this it would run for hours
+		size_t directLimit = 100000;
+		double minSeconds = 0.5;
+		uint32_t maxIterations = 1000;
+		size_t threadCount = 0;
+		bool json = false;
+		std::string filter;
+		bool showHelp = false;
+	};
+
+	struct Result
+	{
+		std::string benchmark;
+		size_t bodies;
+		size_t threads;
+		uint32_t iterations;
+		double seconds;		// median over iterations
+		double interactions;	// pairwise interactions per iteration, 0 when meaningless
+	};
+
+	template <typename T>
+	T parseNumber(const std::string &flag, const std::string &text)
+	{
+		std::istringstream stream(text);
+		T value;
+		if (!(stream >> value) || !stream.eof())
+		{
+			throw std::invalid_argument("invalid value for " + flag + ": " + text);
+		}
+		return value;
+	}
+
+	std::vector<size_t> parseSizes(const std::string &flag, const std::string &text)
+	{
+		std::vector<size_t> sizes;
+		std::istringstream stream(text);
+		std::string item;
+		while (std::getline(stream, item, ','))
+		{
+			sizes.push_back(parseNumber<size_t>(flag, item));
+		}
+		if (sizes.empty())
+		{
+			throw std::invalid_argument("empty list for " + flag);
+		}
+		return sizes;
+	}
+
+	BenchOptions parseBenchOptions(const int argc, const char *const *argv)
+	{
+		BenchOptions options;
+
+		for (int i = 1; i < argc; ++i)
+		{
+			const std::string flag = argv[i];
+
+			auto value = [&]() -> std::string
+			{
+				if (i + 1 >= argc)
+				{
+					throw std::invalid_argument("missing value for " + flag);
+				}
+				return argv[++i];
+			};
+
+			if (flag == "--help" || flag == "-h")
+			{
+				options.showHelp = true;
+			}
+			else if (flag == "--sizes")
+			{
+				options.sizes = parseSizes(flag, value());
+			}
+			else if (flag == "--direct-limit")
+			{
+				options.directLimit = parseNumber<size_t>(flag, value());
+			}
+			else if (flag == "--min-time")
+			{
+				options.minSeconds = parseNumber<double>(flag, value());
+			}
+			else if (flag == "--max-iterations")
+			{
+				options.maxIterations = std::max(parseNumber<uint32_t>(flag, value()), 1u);
+			}
+			else if (flag == "--threads")
+			{
+				options.threadCount = parseNumber<size_t>(flag, value());
+			}
+			else if (flag == "--filter")
+			{
+				options.filter = value();
+			}
+			else if (flag == "--json")
+			{
+				options.json = true;
+			}
+			else
+			{
+				throw std::invalid_argument("unknown option: " + flag);
+			}
+		}
+
+		return options;
+	}
+
+	std::string usage(const char *program)
+	{
+		return std::string("usage: ") + program + " [options]\n"
+			"  --sizes N,N,...      body counts (default 1000,10000,100000,1000000,10000000)\n"
+			"  --direct-limit N     largest N for direct summation (default 100000)\n"
+			"  --min-time S         run every case for at least S seconds (default 0.5)\n"
+			"  --max-iterations N   cap on iterations per case (default 1000)\n"
+			"  --threads N          size of the multithreaded pool (default: all cores)\n"
+			"  --filter TEXT        only run benchmarks whose name contains TEXT\n"
+			"  --json               JSON array instead of CSV\n";
+	}
+
+	// Runs body once as a warm-up, then until minSeconds elapsed; returns the median
+	Result measure(const BenchOptions &options, const std::string &name, const size_t bodies, const size_t threads, const double interactions, const std::function<void()> &body)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		body();
+
+		std::vector<double> samples;
+		double total = 0.0;
+		while (samples.size() < options.maxIterations && (samples.empty() || total < options.minSeconds))
+		{
+			const auto start = Clock::now();
+			body();
+			const std::chrono::duration<double> elapsed = Clock::now() - start;
+			samples.push_back(elapsed.count());
+			total += elapsed.count();
+		}
+
+		std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+		return Result{ name, bodies, threads, static_cast<uint32_t>(samples.size()), samples[samples.size() / 2], interactions };
+	}
+
+	// Lets Simulation::step() be timed without any force work
+	class NullSolver : public ForceSolver
+	{
+	public:
+		NullSolver()
+			: ForceSolver(GravityParams())
+		{
+		}
+
+		const char *name() const override
+		{
+			return "none";
+		}
+
+		void computeAccelerations(ParticleStore &, ThreadPool &) override
+		{
+		}
+	};
+
+	class ResultWriter
+	{
+	public:
+		ResultWriter(std::ostream &out, const bool json)
+			: m_out(out), m_json(json)
+		{
+			if (m_json)
+			{
+				m_out << "[\n";
+			}
+			else
+			{
+				m_out << "benchmark,bodies,threads,iterations,seconds,ns_per_body,interactions_per_s\n";
+			}
+		}
+
+		~ResultWriter()
+		{
+			if (m_json)
+			{
+				m_out << "\n]\n";
+			}
+		}
+
+		void write(const Result &result)
+		{
+			const auto nsPerBody = result.seconds * 1e9 / static_cast<double>(result.bodies);
+			const auto rate = result.interactions / result.seconds;
+
+			if (m_json)
+			{
+				m_out << (m_first ? "" : ",\n")
+					<< "{\"benchmark\":\"" << result.benchmark << "\",\"bodies\":" << result.bodies
+					<< ",\"threads\":" << result.threads << ",\"iterations\":" << result.iterations
+					<< ",\"seconds\":" << result.seconds << ",\"ns_per_body\":" << nsPerBody
+					<< ",\"interactions_per_s\":" << rate << '}';
+			}
+			else
+			{
+				m_out << result.benchmark << ',' << result.bodies << ',' << result.threads << ',' << result.iterations << ','
+					<< result.seconds << ',' << nsPerBody << ',' << rate << '\n';
+			}
+			m_out.flush();
+			m_first = false;
+		}
+
+	private:
+		std::ostream &m_out;
+		bool m_json;
+		bool m_first = true;
+	};
+
+	void runSize(const BenchOptions &options, const size_t count, ThreadPool &pool, ResultWriter &writer)
+	{
+		const GravityParams gravity;
+		const auto threads = pool.concurrency();
+		const auto bodies = static_cast<double>(count);
+		// Tree codes report the pairwise interactions direct summation would need
+		// for the same result, which makes every backend comparable on one axis
+		const auto pairs = bodies * (bodies - 1.0);
+
+		auto selected = [&](const std::string &name)
+		{
+			return options.filter.empty() || name.find(options.filter) != std::string::npos;
+		};
+		auto run = [&](const std::string &name, const double interactions, const std::function<void()> &body)
+		{
+			if (selected(name))
+			{
+				writer.write(measure(options, name, count, threads, interactions, body));
+			}
+		};
+
+		auto particles = createGalaxyDisk(count, 0.8f, 1.0f, 1.0f, 1);
+
+		if (count <= options.directLimit)
+		{
+			const auto best = static_cast<int>(detectSimdLevel());
+			for (int level = 0; level <= best; ++level)
+			{
+				DirectSumSolver solver(gravity, static_cast<SimdLevel>(level));
+				if (static_cast<int>(solver.simdLevel()) != level)
+				{
+					continue;
+				}
+				run(std::string("direct-") + simdLevelName(solver.simdLevel()), pairs, [&] { solver.computeAccelerations(particles, pool); });
+			}
+
+			// Compiler-vectorized kernels of the step pipelines
+			for (const uint32_t dimensions : { 2u, 3u })
+			{
+				for (const auto law : { ForceLaw::Plummer, ForceLaw::Spline })
+				{
+					StepConfig config;
+					config.dimensions = dimensions;
+					config.forceLaw = law;
+					const auto name = std::string("direct-") + std::to_string(dimensions) + "d-" + forceLawName(law);
+					run(name, pairs, [&] { computeSpecializedAccelerations(config, particles, gravity, pool); });
+				}
+			}
+		}
+
+		{
+			BarnesHutSolver solver(gravity, 0.5f);
+			run("barnes-hut", pairs, [&] { solver.computeAccelerations(particles, pool); });
+		}
+		{
+			FmmSolver solver(gravity, 4, 0.5f);
+			run("fmm", pairs, [&] { solver.computeAccelerations(particles, pool); });
+		}
+		{
+			ParticleMeshSolver solver(gravity, ParticleMeshParams());
+			run("pm", 0.0, [&] { solver.computeAccelerations(particles, pool); });
+		}
+		{
+			ParticleMeshParams mesh;
+			mesh.splitScale = 1.25f;
+			ParticleMeshSolver solver(gravity, mesh);
+			run("treepm", pairs, [&] { solver.computeAccelerations(particles, pool); });
+		}
+		{
+			Octree tree;
+			run("octree-build", 0.0, [&] { tree.build(particles, pool); });
+		}
+		{
+			// Later iterations sort an already sorted store, like the periodic reorder of a run
+			auto reordered = particles;
+			MortonReorder reorder;
+			run("morton-reorder", 0.0, [&] { reorder.apply(reordered, pool); });
+		}
+
+		{
+			Simulation simulation(particles, std::make_unique<NullSolver>(), 0.001f, pool);
+			run("integrate", 0.0, [&] { simulation.step(); });
+			for (const auto integrator : { IntegratorKind::VelocityVerlet, IntegratorKind::Yoshida4, IntegratorKind::Rk4 })
+			{
+				StepConfig config;
+				config.integrator = integrator;
+				simulation.setStepConfig(config);
+				run(std::string("integrate-") + integratorName(integrator), 0.0, [&] { simulation.step(); });
+			}
+			simulation.setStepConfig(StepConfig());
+
+			std::vector<Vertex> vertices(count);
+			run("pack-vertices", 0.0, [&] { simulation.packVertices(vertices.data()); });
+
+			std::vector<SpriteInstance> sprites(count);
+			run("pack-sprites", 0.0, [&] { simulation.packSprites(sprites.data()); });
+		}
+
+		// A full leapfrog step evaluates forces once; the first one is the warm-up
+		{
+			Simulation simulation(particles, std::make_unique<BarnesHutSolver>(gravity, 0.5f), 0.001f, pool);
+			run("step-barnes-hut", pairs, [&] { simulation.step(); });
+		}
+		{
+			Simulation simulation(particles, std::make_unique<BarnesHutSolver>(gravity, 0.5f, 16, 0.02f), 0.001f, pool);
+			run("step-barnes-hut-refit", pairs, [&] { simulation.step(); });
+		}
+		{
+			// The same step on a store in Morton order instead of generation order
+			auto sorted = particles;
+			MortonReorder().apply(sorted, pool);
+			Simulation simulation(std::move(sorted), std::make_unique<BarnesHutSolver>(gravity, 0.5f), 0.001f, pool);
+			run("step-barnes-hut-sorted", pairs, [&] { simulation.step(); });
+		}
+		if (count <= options.directLimit)
+		{
+			Simulation simulation(particles, std::make_unique<DirectSumSolver>(gravity), 0.001f, pool);
+			run("step-direct", pairs, [&] { simulation.step(); });
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	try
+	{
+		const auto options = parseBenchOptions(argc, argv);
+		if (options.showHelp)
+		{
+			std::cout << usage(argv[0]);
+			return EXIT_SUCCESS;
+		}
+
+		ThreadPool serial(1);
+		ThreadPool parallel(options.threadCount);
+
+		std::cerr << "simd: " << simdLevelName(detectSimdLevel()) << ", threads: " << parallel.concurrency() << '\n';
+
+		ResultWriter writer(std::cout, options.json);
+		for (const auto count : options.sizes)
+		{
+			runSize(options, count, serial, writer);
+			if (parallel.concurrency() > 1)
+			{
+				runSize(options, count, parallel, writer);
+			}
+		}
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
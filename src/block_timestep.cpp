@@ -0,0 +1,263 @@
+#include "block_timestep.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "force_solver.h"
+#include "particle_store.h"
+#include "thread_pool.h"
+
+namespace
+{
+	constexpr size_t INTEGRATION_GRAIN = 16384;
+
+	uint32_t trailingZeros(uint64_t value)
+	{
+		uint32_t count = 0;
+		while (value != 0 && (value & 1) == 0)
+		{
+			value >>= 1;
+			++count;
+		}
+		return count;
+	}
+}
+
+BlockTimestepIntegrator::BlockTimestepIntegrator(const BlockTimestepParams &params)
+	: m_params(params)
+{
+	// Ticks of the finest level must fit the 64-bit timeline and the uint8 levels
+	m_params.maxLevel = std::min<uint32_t>(m_params.maxLevel, 62);
+}
+
+void BlockTimestepIntegrator::step(ParticleStore &particles, ForceSolver &solver, const float dt, ThreadPool &pool)
+{
+	if (!m_initialized || m_levels.size() != particles.size())
+	{
+		initialize(particles, solver, dt, pool);
+	}
+
+	const auto maxLevel = m_params.maxLevel;
+	const auto softening = solver.params().softening;
+	const uint64_t end = uint64_t(1) << maxLevel;
+	const auto tickDt = dt / static_cast<float>(end);
+
+	// Every step begins and ends at a common time, where all bodies are active
+	uint64_t tick = 0;
+	collectActive(0);
+
+	while (tick < end)
+	{
+		// Opening half kicks of the bodies starting a step now
+		kick(particles, dt, pool);
+
+		const auto deepest = m_levels.empty() ? 0u : static_cast<uint32_t>(*std::max_element(m_levels.begin(), m_levels.end()));
+		const auto next = tick + (uint64_t(1) << (maxLevel - deepest));
+		drift(particles, static_cast<float>(next - tick) * tickDt, pool);
+		tick = next;
+
+		// Steps of level L end on multiples of 2^(maxLevel - L) ticks
+		collectActive(maxLevel - std::min(trailingZeros(tick), maxLevel));
+		const auto evaluated = solver.computeActiveAccelerations(particles, m_active, pool);
+
+		// Closing half kicks with the step that just ended
+		kick(particles, dt, pool);
+		assignLevels(particles, tick, dt, softening, true, pool);
+
+		++m_stats.substeps;
+		m_stats.forceEvaluations += evaluated;
+		m_stats.deepestLevel = std::max(m_stats.deepestLevel, deepest);
+	}
+}
+
+void BlockTimestepIntegrator::initialize(ParticleStore &particles, ForceSolver &solver, const float dt, ThreadPool &pool)
+{
+	const auto count = particles.size();
+	m_levels.assign(count, 0);
+	m_lastAx.resize(count);
+	m_lastAy.resize(count);
+	m_lastAz.resize(count);
+
+	solver.computeAccelerations(particles, pool);
+	m_stats.forceEvaluations += count;
+
+	collectActive(0);
+	assignLevels(particles, 0, dt, solver.params().softening, false, pool);
+	m_initialized = true;
+}
+
+void BlockTimestepIntegrator::reorder(const std::vector<uint32_t> &order)
+{
+	if (!m_initialized || order.size() != m_levels.size())
+	{
+		return;
+	}
+
+	const auto levels = m_levels;
+	const auto lastAx = m_lastAx, lastAy = m_lastAy, lastAz = m_lastAz;
+	for (size_t k = 0; k < order.size(); ++k)
+	{
+		m_levels[k] = levels[order[k]];
+		m_lastAx[k] = lastAx[order[k]];
+		m_lastAy[k] = lastAy[order[k]];
+		m_lastAz[k] = lastAz[order[k]];
+	}
+}
+
+void BlockTimestepIntegrator::collectActive(const uint32_t minLevel)
+{
+	m_active.clear();
+	for (size_t i = 0; i < m_levels.size(); ++i)
+	{
+		if (m_levels[i] >= minLevel)
+		{
+			m_active.push_back(static_cast<uint32_t>(i));
+		}
+	}
+}
+
+void BlockTimestepIntegrator::kick(ParticleStore &particles, const float dt, ThreadPool &pool) const
+{
+	const auto *active = m_active.data();
+	const auto *levels = m_levels.data();
+	float *vx = particles.vx.data();
+	float *vy = particles.vy.data();
+	float *vz = particles.vz.data();
+	const float *ax = particles.ax.data();
+	const float *ay = particles.ay.data();
+	const float *az = particles.az.data();
+
+	if (particles.doublePrecision())
+	{
+		double *vxd = particles.vxd.data();
+		double *vyd = particles.vyd.data();
+		double *vzd = particles.vzd.data();
+
+		pool.parallelFor(0, m_active.size(), INTEGRATION_GRAIN, [=](const size_t first, const size_t last)
+		{
+			for (auto k = first; k < last; ++k)
+			{
+				const auto i = active[k];
+				const auto halfStep = std::ldexp(0.5 * dt, -static_cast<int>(levels[i]));
+				vxd[i] += ax[i] * halfStep;
+				vyd[i] += ay[i] * halfStep;
+				vzd[i] += az[i] * halfStep;
+				vx[i] = static_cast<float>(vxd[i]);
+				vy[i] = static_cast<float>(vyd[i]);
+				vz[i] = static_cast<float>(vzd[i]);
+			}
+		});
+		return;
+	}
+
+	pool.parallelFor(0, m_active.size(), INTEGRATION_GRAIN, [=](const size_t first, const size_t last)
+	{
+		for (auto k = first; k < last; ++k)
+		{
+			const auto i = active[k];
+			const auto halfStep = std::ldexp(0.5f * dt, -static_cast<int>(levels[i]));
+			vx[i] += ax[i] * halfStep;
+			vy[i] += ay[i] * halfStep;
+			vz[i] += az[i] * halfStep;
+		}
+	});
+}
+
+void BlockTimestepIntegrator::drift(ParticleStore &particles, const float dt, ThreadPool &pool) const
+{
+	float *x = particles.x.data();
+	float *y = particles.y.data();
+	float *z = particles.z.data();
+	const float *vx = particles.vx.data();
+	const float *vy = particles.vy.data();
+	const float *vz = particles.vz.data();
+
+	if (particles.doublePrecision())
+	{
+		double *xd = particles.xd.data();
+		double *yd = particles.yd.data();
+		double *zd = particles.zd.data();
+		const double *vxd = particles.vxd.data();
+		const double *vyd = particles.vyd.data();
+		const double *vzd = particles.vzd.data();
+		const double step = dt;
+		const auto origin = particles.origin();
+
+		pool.parallelFor(0, particles.size(), INTEGRATION_GRAIN, [=](const size_t first, const size_t last)
+		{
+			for (auto i = first; i < last; ++i)
+			{
+				xd[i] += vxd[i] * step;
+				yd[i] += vyd[i] * step;
+				zd[i] += vzd[i] * step;
+				x[i] = static_cast<float>(xd[i] - origin[0]);
+				y[i] = static_cast<float>(yd[i] - origin[1]);
+				z[i] = static_cast<float>(zd[i] - origin[2]);
+			}
+		});
+		return;
+	}
+
+	pool.parallelFor(0, particles.paddedSize(), INTEGRATION_GRAIN, [=](const size_t first, const size_t last)
+	{
+		for (auto i = first; i < last; ++i)
+		{
+			x[i] += vx[i] * dt;
+			y[i] += vy[i] * dt;
+			z[i] += vz[i] * dt;
+		}
+	});
+}
+
+void BlockTimestepIntegrator::assignLevels(const ParticleStore &particles, const uint64_t tick, const float dt, const float softening, const bool haveJerk, ThreadPool &pool)
+{
+	const auto maxLevel = m_params.maxLevel;
+	const auto eta = m_params.eta;
+	const auto *active = m_active.data();
+	auto *levels = m_levels.data();
+	float *lastAx = m_lastAx.data();
+	float *lastAy = m_lastAy.data();
+	float *lastAz = m_lastAz.data();
+	const float *ax = particles.ax.data();
+	const float *ay = particles.ay.data();
+	const float *az = particles.az.data();
+
+	pool.parallelFor(0, m_active.size(), INTEGRATION_GRAIN, [=](const size_t first, const size_t last)
+	{
+		for (auto k = first; k < last; ++k)
+		{
+			const auto i = active[k];
+			const auto a = std::sqrt(ax[i] * ax[i] + ay[i] * ay[i] + az[i] * az[i]);
+
+			auto desired = dt;
+			if (a > 0.0f && softening > 0.0f)
+			{
+				desired = std::min(desired, eta * std::sqrt(softening / a));
+			}
+			if (haveJerk)
+			{
+				const auto dx = ax[i] - lastAx[i], dy = ay[i] - lastAy[i], dz = az[i] - lastAz[i];
+				const auto jerk = std::sqrt(dx * dx + dy * dy + dz * dz) / std::ldexp(dt, -static_cast<int>(levels[i]));
+				if (jerk > 0.0f)
+				{
+					desired = std::min(desired, eta * a / jerk);
+				}
+			}
+			lastAx[i] = ax[i];
+			lastAy[i] = ay[i];
+			lastAz[i] = az[i];
+
+			// Clamping first keeps the logarithm finite for zero or NaN steps
+			const auto finest = std::ldexp(dt, -static_cast<int>(maxLevel));
+			desired = desired >= finest ? desired : finest;
+			auto level = desired < dt ? static_cast<uint32_t>(std::ceil(std::log2(dt / desired))) : 0u;
+			level = std::min(level, maxLevel);
+			// The new step has to start on one of its own boundaries
+			while (level < maxLevel && (tick & ((uint64_t(1) << (maxLevel - level)) - 1)) != 0)
+			{
+				++level;
+			}
+			levels[i] = static_cast<uint8_t>(level);
+		}
+	});
+}
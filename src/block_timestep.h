@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "aligned_buffer.h"
+
+class ForceSolver;
+class ParticleStore;
+class ThreadPool;
+
+struct BlockTimestepParams
+{
+	// Bodies step with dt / 2^level, level in [0, maxLevel]
+	uint32_t maxLevel = 8;
+	// Accuracy parameter of the timestep criterion
+	float eta = 0.2f;
+};
+
+struct BlockTimestepStats
+{
+	uint64_t substeps = 0;
+	uint64_t forceEvaluations = 0;	// bodies whose force the solver evaluated, active or not, summed over substeps
+	uint32_t deepestLevel = 0;
+};
+
+// Kick-drift-kick leapfrog with hierarchical power-of-two timesteps. Every body
+// gets the largest step dt / 2^level not above
+//
+//   eta * min(sqrt(softening / |a|), |a| / |da/dt|)
+//
+// (the softening-length criterion plus Aarseth's acceleration/jerk ratio, with
+// the jerk estimated from the body's last two force evaluations). A substep
+// drifts every body, which predicts the positions of the inactive ones, and
+// evaluates forces only for the bodies whose step ends there. A step can only
+// grow where the time is a multiple of the larger step, so levels stay nested.
+class BlockTimestepIntegrator
+{
+public:
+	explicit BlockTimestepIntegrator(const BlockTimestepParams &params);
+
+	// Advances every body by dt; on return positions and velocities are synchronized
+	void step(ParticleStore &particles, ForceSolver &solver, float dt, ThreadPool &pool);
+
+	// Moves the per-body state along with bodies the store moved; order maps new slots to old ones
+	void reorder(const std::vector<uint32_t> &order);
+
+	const BlockTimestepStats &stats() const
+	{
+		return m_stats;
+	}
+
+	const BlockTimestepParams &params() const
+	{
+		return m_params;
+	}
+
+private:
+	void initialize(ParticleStore &particles, ForceSolver &solver, float dt, ThreadPool &pool);
+	void collectActive(uint32_t minLevel);
+	void kick(ParticleStore &particles, float dt, ThreadPool &pool) const;
+	void drift(ParticleStore &particles, float dt, ThreadPool &pool) const;
+	// Closes the active bodies' steps at tick and picks their next level
+	void assignLevels(const ParticleStore &particles, uint64_t tick, float dt, float softening, bool haveJerk, ThreadPool &pool);
+
+	BlockTimestepParams m_params;
+	BlockTimestepStats m_stats;
+	bool m_initialized = false;
+	std::vector<uint8_t> m_levels;
+	std::vector<uint32_t> m_active;
+	// Accelerations at the previous evaluation of every body, for the jerk estimate
+	AlignedBuffer<float> m_lastAx, m_lastAy, m_lastAz;
+};
@@ -0,0 +1,115 @@
+#include "cpu_features.h"
+
+#include <cstdint>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#define NBODY_CPUID_AVAILABLE
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#define NBODY_CPUID_AVAILABLE
+#endif
+
+#ifdef NBODY_CPUID_AVAILABLE
+namespace
+{
+	struct CpuidRegisters
+	{
+		uint32_t eax, ebx, ecx, edx;
+	};
+
+	CpuidRegisters cpuid(const uint32_t leaf, const uint32_t subleaf)
+	{
+		CpuidRegisters regs{};
+#ifdef _MSC_VER
+		int info[4];
+		__cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+		regs = {static_cast<uint32_t>(info[0]), static_cast<uint32_t>(info[1]), static_cast<uint32_t>(info[2]), static_cast<uint32_t>(info[3])};
+#else
+		__cpuid_count(leaf, subleaf, regs.eax, regs.ebx, regs.ecx, regs.edx);
+#endif
+		return regs;
+	}
+
+	uint64_t readXcr0()
+	{
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		uint32_t lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		return (static_cast<uint64_t>(hi) << 32) | lo;
+#endif
+	}
+}
+#endif
+
+SimdLevel detectSimdLevel()
+{
+#ifdef NBODY_CPUID_AVAILABLE
+	constexpr uint32_t SSE42_BIT = 1u << 20;
+	constexpr uint32_t FMA_BIT = 1u << 12;
+	constexpr uint32_t OSXSAVE_BIT = 1u << 27;
+	constexpr uint32_t AVX_BIT = 1u << 28;
+	constexpr uint32_t AVX2_BIT = 1u << 5;
+	constexpr uint32_t AVX512F_BIT = 1u << 16;
+	constexpr uint64_t XCR0_AVX_STATE = 0x6;
+	constexpr uint64_t XCR0_AVX512_STATE = 0xe6;
+
+	auto maxLeaf = cpuid(0, 0).eax;
+	if (maxLeaf < 1)
+	{
+		return SimdLevel::Scalar;
+	}
+
+	auto leaf1 = cpuid(1, 0);
+	if (!(leaf1.ecx & SSE42_BIT))
+	{
+		return SimdLevel::Scalar;
+	}
+
+	if (!(leaf1.ecx & OSXSAVE_BIT) || !(leaf1.ecx & AVX_BIT) || maxLeaf < 7)
+	{
+		return SimdLevel::Sse42;
+	}
+
+	auto xcr0 = readXcr0();
+	if ((xcr0 & XCR0_AVX_STATE) != XCR0_AVX_STATE)
+	{
+		return SimdLevel::Sse42;
+	}
+
+	auto leaf7 = cpuid(7, 0);
+	if (!(leaf7.ebx & AVX2_BIT) || !(leaf1.ecx & FMA_BIT))
+	{
+		return SimdLevel::Sse42;
+	}
+
+	if ((leaf7.ebx & AVX512F_BIT) && (xcr0 & XCR0_AVX512_STATE) == XCR0_AVX512_STATE)
+	{
+		return SimdLevel::Avx512;
+	}
+
+	return SimdLevel::Avx2;
+#else
+	return SimdLevel::Scalar;
+#endif
+}
+
+const char *simdLevelName(const SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::Scalar:
+		return "scalar";
+	case SimdLevel::Sse42:
+		return "sse4.2";
+	case SimdLevel::Avx2:
+		return "avx2";
+	case SimdLevel::Avx512:
+		return "avx512";
+	}
+
+	return "unknown";
+}
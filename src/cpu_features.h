@@ -0,0 +1,14 @@
+#pragma once
+
+enum class SimdLevel
+{
+	Scalar,
+	Sse42,
+	Avx2,
+	Avx512
+};
+
+// Highest instruction set that both the CPU and the OS (saved register state) support.
+SimdLevel detectSimdLevel();
+
+const char *simdLevelName(SimdLevel level);
@@ -0,0 +1,127 @@
+#include "direct_sum.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "particle_store.h"
+#include "thread_pool.h"
+
+void directSumScalar(const DirectSumArgs &args, const size_t begin, const size_t end)
+{
+	for (size_t i = begin; i < end; ++i)
+	{
+		const auto xi = args.x[i], yi = args.y[i], zi = args.z[i];
+		float ax = 0.0f, ay = 0.0f, az = 0.0f;
+		for (size_t j = 0; j < args.sourceCount; ++j)
+		{
+			auto dx = args.x[j] - xi;
+			auto dy = args.y[j] - yi;
+			auto dz = args.z[j] - zi;
+			auto r2 = dx * dx + dy * dy + dz * dz + args.softening2;
+			auto invR = 1.0f / std::sqrt(r2);
+			auto s = args.mass[j] * invR * invR * invR;
+			ax += dx * s;
+			ay += dy * s;
+			az += dz * s;
+		}
+
+		args.ax[i] = args.gravitationalConstant * ax;
+		args.ay[i] = args.gravitationalConstant * ay;
+		args.az[i] = args.gravitationalConstant * az;
+	}
+}
+
+DirectSumKernel selectDirectSumKernel(const SimdLevel level, SimdLevel *chosen)
+{
+	auto use = [chosen](const SimdLevel used, const DirectSumKernel kernel)
+	{
+		if (chosen)
+		{
+			*chosen = used;
+		}
+		return kernel;
+	};
+
+#ifdef NBODY_X86_SIMD
+	switch (level)
+	{
+	case SimdLevel::Avx512:
+		return use(SimdLevel::Avx512, &directSumAvx512);
+	case SimdLevel::Avx2:
+		return use(SimdLevel::Avx2, &directSumAvx2);
+	case SimdLevel::Sse42:
+		return use(SimdLevel::Sse42, &directSumSse42);
+	case SimdLevel::Scalar:
+		break;
+	}
+#endif
+
+	return use(SimdLevel::Scalar, &directSumScalar);
+}
+
+namespace
+{
+	DirectSumArgs argsFor(ParticleStore &particles, const GravityParams &params)
+	{
+		return DirectSumArgs{
+			particles.x.data(), particles.y.data(), particles.z.data(), particles.mass.data(),
+			particles.paddedSize(),
+			params.softening * params.softening,
+			params.gravitationalConstant,
+			particles.ax.data(), particles.ay.data(), particles.az.data()
+		};
+	}
+}
+
+DirectSumSolver::DirectSumSolver(const GravityParams &params, const SimdLevel maxLevel)
+	: ForceSolver(params)
+{
+	m_kernel = selectDirectSumKernel(maxLevel, &m_simdLevel);
+}
+
+void DirectSumSolver::computeAccelerations(ParticleStore &particles, ThreadPool &pool)
+{
+	// Blocks are whole multiples of the widest vector so only the last one needs a scalar tail
+	constexpr size_t BLOCK = 64;
+
+	const auto args = argsFor(particles, m_params);
+	const auto count = particles.size();
+	const auto kernel = m_kernel;
+	pool.parallelFor(0, (count + BLOCK - 1) / BLOCK, 1, [&args, kernel, count](const size_t first, const size_t last)
+	{
+		kernel(args, first * BLOCK, std::min(last * BLOCK, count));
+	});
+}
+
+size_t DirectSumSolver::computeActiveAccelerations(ParticleStore &particles, const std::vector<uint32_t> &active, ThreadPool &pool)
+{
+	// Kernels vectorize over targets, so whole padded lane blocks holding an
+	// active body are evaluated; the extra bodies cost nothing on top
+	constexpr size_t BLOCK = ParticleStore::LANE_PADDING;
+
+	std::vector<uint32_t> blocks;
+	for (const auto index : active)
+	{
+		const auto block = static_cast<uint32_t>(index / BLOCK);
+		if (blocks.empty() || blocks.back() != block)
+		{
+			blocks.push_back(block);
+		}
+	}
+
+	const auto args = argsFor(particles, m_params);
+	const auto kernel = m_kernel;
+	const auto count = particles.size();
+	pool.parallelFor(0, blocks.size(), 1, [&](const size_t first, const size_t last)
+	{
+		for (auto k = first; k < last; ++k)
+		{
+			const auto begin = blocks[k] * BLOCK;
+			kernel(args, begin, std::min(begin + BLOCK, count));
+		}
+	});
+
+	// Every body of the evaluated blocks; only the last block of the store is partial
+	const auto evaluated = blocks.size() * BLOCK;
+	return blocks.empty() || (blocks.back() + 1) * BLOCK <= count ? evaluated : evaluated - ((blocks.back() + 1) * BLOCK - count);
+}
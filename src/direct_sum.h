@@ -0,0 +1,28 @@
+#pragma once
+
+#include "cpu_features.h"
+#include "direct_sum_kernels.h"
+#include "force_solver.h"
+
+class DirectSumSolver : public ForceSolver
+{
+public:
+	explicit DirectSumSolver(const GravityParams &params, SimdLevel maxLevel = detectSimdLevel());
+
+	const char *name() const override
+	{
+		return "direct";
+	}
+
+	void computeAccelerations(ParticleStore &particles, ThreadPool &pool) override;
+	size_t computeActiveAccelerations(ParticleStore &particles, const std::vector<uint32_t> &active, ThreadPool &pool) override;
+
+	SimdLevel simdLevel() const
+	{
+		return m_simdLevel;
+	}
+
+private:
+	DirectSumKernel m_kernel;
+	SimdLevel m_simdLevel;
+};
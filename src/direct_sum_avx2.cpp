@@ -0,0 +1,46 @@
+#include "direct_sum_kernels.h"
+
+#include <immintrin.h>
+
+void directSumAvx2(const DirectSumArgs &args, const size_t begin, const size_t end)
+{
+	constexpr size_t LANES = 8;
+
+	const auto eps2 = _mm256_set1_ps(args.softening2);
+	const auto half = _mm256_set1_ps(0.5f);
+	const auto threeHalves = _mm256_set1_ps(1.5f);
+	const auto G = _mm256_set1_ps(args.gravitationalConstant);
+
+	auto i = begin;
+	for (; i + LANES <= end; i += LANES)
+	{
+		const auto xi = _mm256_loadu_ps(args.x + i);
+		const auto yi = _mm256_loadu_ps(args.y + i);
+		const auto zi = _mm256_loadu_ps(args.z + i);
+		auto ax = _mm256_setzero_ps();
+		auto ay = _mm256_setzero_ps();
+		auto az = _mm256_setzero_ps();
+
+		for (size_t j = 0; j < args.sourceCount; ++j)
+		{
+			auto dx = _mm256_sub_ps(_mm256_broadcast_ss(args.x + j), xi);
+			auto dy = _mm256_sub_ps(_mm256_broadcast_ss(args.y + j), yi);
+			auto dz = _mm256_sub_ps(_mm256_broadcast_ss(args.z + j), zi);
+			auto r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_fmadd_ps(dz, dz, eps2)));
+
+			auto invR = _mm256_rsqrt_ps(r2);
+			invR = _mm256_mul_ps(invR, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(invR, invR), threeHalves));
+
+			auto s = _mm256_mul_ps(_mm256_broadcast_ss(args.mass + j), _mm256_mul_ps(invR, _mm256_mul_ps(invR, invR)));
+			ax = _mm256_fmadd_ps(dx, s, ax);
+			ay = _mm256_fmadd_ps(dy, s, ay);
+			az = _mm256_fmadd_ps(dz, s, az);
+		}
+
+		_mm256_storeu_ps(args.ax + i, _mm256_mul_ps(G, ax));
+		_mm256_storeu_ps(args.ay + i, _mm256_mul_ps(G, ay));
+		_mm256_storeu_ps(args.az + i, _mm256_mul_ps(G, az));
+	}
+
+	directSumScalar(args, i, end);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+
+#include "cpu_features.h"
+
+struct DirectSumArgs
+{
+	const float *x;
+	const float *y;
+	const float *z;
+	const float *mass;
+	size_t sourceCount;
+	float softening2;
+	float gravitationalConstant;
+	float *ax;
+	float *ay;
+	float *az;
+};
+
+// Accumulates the softened pull of every source on targets [begin, end).
+// sourceCount must be a multiple of ParticleStore::LANE_PADDING.
+using DirectSumKernel = void (*)(const DirectSumArgs &args, size_t begin, size_t end);
+
+void directSumScalar(const DirectSumArgs &args, size_t begin, size_t end);
+
+#ifdef NBODY_X86_SIMD
+void directSumSse42(const DirectSumArgs &args, size_t begin, size_t end);
+void directSumAvx2(const DirectSumArgs &args, size_t begin, size_t end);
+void directSumAvx512(const DirectSumArgs &args, size_t begin, size_t end);
+#endif
+
+// Picks the widest kernel not above the requested level; returns the level actually used through chosen.
+DirectSumKernel selectDirectSumKernel(SimdLevel level, SimdLevel *chosen = nullptr);
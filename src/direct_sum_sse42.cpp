@@ -0,0 +1,47 @@
+#include "direct_sum_kernels.h"
+
+#include <nmmintrin.h>
+
+void directSumSse42(const DirectSumArgs &args, const size_t begin, const size_t end)
+{
+	constexpr size_t LANES = 4;
+
+	const auto eps2 = _mm_set1_ps(args.softening2);
+	const auto half = _mm_set1_ps(0.5f);
+	const auto threeHalves = _mm_set1_ps(1.5f);
+	const auto G = _mm_set1_ps(args.gravitationalConstant);
+
+	auto i = begin;
+	for (; i + LANES <= end; i += LANES)
+	{
+		const auto xi = _mm_loadu_ps(args.x + i);
+		const auto yi = _mm_loadu_ps(args.y + i);
+		const auto zi = _mm_loadu_ps(args.z + i);
+		auto ax = _mm_setzero_ps();
+		auto ay = _mm_setzero_ps();
+		auto az = _mm_setzero_ps();
+
+		for (size_t j = 0; j < args.sourceCount; ++j)
+		{
+			auto dx = _mm_sub_ps(_mm_set1_ps(args.x[j]), xi);
+			auto dy = _mm_sub_ps(_mm_set1_ps(args.y[j]), yi);
+			auto dz = _mm_sub_ps(_mm_set1_ps(args.z[j]), zi);
+			auto r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_add_ps(_mm_mul_ps(dz, dz), eps2));
+
+			// rsqrt estimate refined with one Newton-Raphson step
+			auto invR = _mm_rsqrt_ps(r2);
+			invR = _mm_mul_ps(invR, _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(half, r2), _mm_mul_ps(invR, invR))));
+
+			auto s = _mm_mul_ps(_mm_set1_ps(args.mass[j]), _mm_mul_ps(invR, _mm_mul_ps(invR, invR)));
+			ax = _mm_add_ps(ax, _mm_mul_ps(dx, s));
+			ay = _mm_add_ps(ay, _mm_mul_ps(dy, s));
+			az = _mm_add_ps(az, _mm_mul_ps(dz, s));
+		}
+
+		_mm_storeu_ps(args.ax + i, _mm_mul_ps(G, ax));
+		_mm_storeu_ps(args.ay + i, _mm_mul_ps(G, ay));
+		_mm_storeu_ps(args.az + i, _mm_mul_ps(G, az));
+	}
+
+	directSumScalar(args, i, end);
+}
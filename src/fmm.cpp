@@ -0,0 +1,516 @@
+#include "fmm.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "particle_store.h"
+#include "thread_pool.h"
+
+namespace
+{
+	double binomial(const uint32_t n, const uint32_t k)
+	{
+		double result = 1.0;
+		for (uint32_t i = 1; i <= k; ++i)
+		{
+			result = result * static_cast<double>(n - k + i) / static_cast<double>(i);
+		}
+		return result;
+	}
+}
+
+FmmSolver::FmmSolver(const GravityParams &params, const uint32_t order, const float openingAngle, const uint32_t leafCapacity)
+	: ForceSolver(params), m_order(order), m_openingAngle(openingAngle), m_tree(leafCapacity)
+{
+	if (order > MAX_ORDER)
+	{
+		throw std::invalid_argument("FMM expansion order must not exceed " + std::to_string(MAX_ORDER));
+	}
+	// A monopole-only local expansion has no gradient, so far cells would exert no force
+	if (order < 1)
+	{
+		throw std::invalid_argument("FMM expansion order must be at least 1");
+	}
+
+	buildTables();
+}
+
+void FmmSolver::buildTables()
+{
+	const auto p = m_order;
+	const auto side = p + 1;
+
+	m_termIndex.assign(side * side * side, 0);
+	m_termExponents.clear();
+	m_termDegree.clear();
+	for (uint32_t degree = 0; degree <= p; ++degree)
+	{
+		for (uint32_t i = degree + 1; i-- > 0;)
+		{
+			for (uint32_t j = degree - i + 1; j-- > 0;)
+			{
+				auto k = degree - i - j;
+				m_termIndex[(i * side + j) * side + k] = static_cast<uint32_t>(m_termDegree.size());
+				m_termExponents.insert(m_termExponents.end(), {i, j, k});
+				m_termDegree.push_back(degree);
+			}
+		}
+	}
+	m_termCount = m_termDegree.size();
+
+	auto exponent = [this](const uint32_t term, const uint32_t axis)
+	{
+		return m_termExponents[3 * term + axis];
+	};
+	auto indexOf = [this, side](const uint32_t i, const uint32_t j, const uint32_t k)
+	{
+		return m_termIndex[(i * side + j) * side + k];
+	};
+
+	m_m2mTerms.clear();
+	m_m2lTerms.clear();
+	m_l2lTerms.clear();
+	m_m2mRanges.resize(m_termCount);
+	m_m2lRanges.resize(m_termCount);
+	m_l2lRanges.resize(m_termCount);
+
+	for (uint32_t a = 0; a < m_termCount; ++a)
+	{
+		// M2M: M_a(parent) += C(a, b) d^(a-b) M_b(child), b <= a
+		m_m2mRanges[a].begin = static_cast<uint32_t>(m_m2mTerms.size());
+		for (uint32_t b = 0; b < m_termCount; ++b)
+		{
+			if (exponent(b, 0) <= exponent(a, 0) && exponent(b, 1) <= exponent(a, 1) && exponent(b, 2) <= exponent(a, 2))
+			{
+				auto shift = indexOf(exponent(a, 0) - exponent(b, 0), exponent(a, 1) - exponent(b, 1), exponent(a, 2) - exponent(b, 2));
+				auto c = binomial(exponent(a, 0), exponent(b, 0)) * binomial(exponent(a, 1), exponent(b, 1)) * binomial(exponent(a, 2), exponent(b, 2));
+				m_m2mTerms.push_back(Term{b, shift, c});
+			}
+		}
+		m_m2mRanges[a].end = static_cast<uint32_t>(m_m2mTerms.size());
+
+		// M2L: L_a += (-1)^|b| C(a+b, a) D_(a+b) M_b, |a| + |b| <= p
+		m_m2lRanges[a].begin = static_cast<uint32_t>(m_m2lTerms.size());
+		for (uint32_t b = 0; b < m_termCount && m_termDegree[a] + m_termDegree[b] <= p; ++b)
+		{
+			auto sum = indexOf(exponent(a, 0) + exponent(b, 0), exponent(a, 1) + exponent(b, 1), exponent(a, 2) + exponent(b, 2));
+			auto sign = (m_termDegree[b] % 2) ? -1.0 : 1.0;
+			auto c = binomial(exponent(a, 0) + exponent(b, 0), exponent(a, 0))
+				* binomial(exponent(a, 1) + exponent(b, 1), exponent(a, 1))
+				* binomial(exponent(a, 2) + exponent(b, 2), exponent(a, 2));
+			m_m2lTerms.push_back(Term{b, sum, sign * c});
+		}
+		m_m2lRanges[a].end = static_cast<uint32_t>(m_m2lTerms.size());
+
+		// L2L: L_a(child) += C(b, a) d^(b-a) L_b(parent), b >= a
+		m_l2lRanges[a].begin = static_cast<uint32_t>(m_l2lTerms.size());
+		for (uint32_t b = 0; b < m_termCount; ++b)
+		{
+			if (exponent(b, 0) >= exponent(a, 0) && exponent(b, 1) >= exponent(a, 1) && exponent(b, 2) >= exponent(a, 2))
+			{
+				auto shift = indexOf(exponent(b, 0) - exponent(a, 0), exponent(b, 1) - exponent(a, 1), exponent(b, 2) - exponent(a, 2));
+				auto c = binomial(exponent(b, 0), exponent(a, 0)) * binomial(exponent(b, 1), exponent(a, 1)) * binomial(exponent(b, 2), exponent(a, 2));
+				m_l2lTerms.push_back(Term{b, shift, c});
+			}
+		}
+		m_l2lRanges[a].end = static_cast<uint32_t>(m_l2lTerms.size());
+	}
+}
+
+void FmmSolver::monomials(const double dx, const double dy, const double dz, double *out) const
+{
+	double px[32], py[32], pz[32];
+	px[0] = py[0] = pz[0] = 1.0;
+	for (uint32_t i = 1; i <= m_order; ++i)
+	{
+		px[i] = px[i - 1] * dx;
+		py[i] = py[i - 1] * dy;
+		pz[i] = pz[i - 1] * dz;
+	}
+
+	for (size_t t = 0; t < m_termCount; ++t)
+	{
+		out[t] = px[m_termExponents[3 * t]] * py[m_termExponents[3 * t + 1]] * pz[m_termExponents[3 * t + 2]];
+	}
+}
+
+void FmmSolver::derivatives(const double rx, const double ry, const double rz, double *out) const
+{
+	// Taylor coefficients D_k = (1/k!) d^k/dr^k of 1/sqrt(r^2 + eps^2), through the recurrence
+	// |k| R^2 D_k + (2|k| - 1) sum_i r_i D_(k-e_i) + (|k| - 1) sum_i D_(k-2e_i) = 0
+	const auto side = m_order + 1;
+	const double r[3] = {rx, ry, rz};
+	const double eps = m_params.softening;
+	const auto R2 = rx * rx + ry * ry + rz * rz + eps * eps;
+	const auto invR2 = 1.0 / R2;
+
+	out[0] = std::sqrt(invR2);
+	for (size_t t = 1; t < m_termCount; ++t)
+	{
+		const uint32_t e[3] = {m_termExponents[3 * t], m_termExponents[3 * t + 1], m_termExponents[3 * t + 2]};
+		const double n = m_termDegree[t];
+
+		double first = 0.0, second = 0.0;
+		for (uint32_t axis = 0; axis < 3; ++axis)
+		{
+			uint32_t lower[3] = {e[0], e[1], e[2]};
+			if (e[axis] >= 1)
+			{
+				--lower[axis];
+				first += r[axis] * out[m_termIndex[(lower[0] * side + lower[1]) * side + lower[2]]];
+				if (e[axis] >= 2)
+				{
+					--lower[axis];
+					second += out[m_termIndex[(lower[0] * side + lower[1]) * side + lower[2]]];
+				}
+			}
+		}
+
+		out[t] = -((2.0 * n - 1.0) * first + (n - 1.0) * second) * invR2 / n;
+	}
+}
+
+void FmmSolver::computeAccelerations(ParticleStore &particles, ThreadPool &pool)
+{
+	constexpr size_t NODE_GRAIN = 1024;
+	constexpr size_t BODY_GRAIN = 4096;
+
+	m_tree.build(particles, pool);
+
+	const auto &nodes = m_tree.nodes();
+	const auto nodeCount = nodes.size();
+	const auto bodyCount = m_tree.bodyCount();
+
+	m_centers.resize(3 * nodeCount);
+	m_radii.resize(nodeCount);
+	m_multipoles.assign(nodeCount * m_termCount, 0.0);
+	m_locals.assign(nodeCount * m_termCount, 0.0);
+	m_ax.assign(bodyCount, 0.0);
+	m_ay.assign(bodyCount, 0.0);
+	m_az.assign(bodyCount, 0.0);
+
+	if (nodeCount == 0)
+	{
+		return;
+	}
+
+	pool.parallelFor(0, nodeCount, NODE_GRAIN, [this, &nodes](const size_t first, const size_t last)
+	{
+		for (auto n = first; n < last; ++n)
+		{
+			const auto &node = nodes[n];
+			m_centers[3 * n] = node.comX;
+			m_centers[3 * n + 1] = node.comY;
+			m_centers[3 * n + 2] = node.comZ;
+
+			auto rx = std::max(node.comX - node.minX, node.maxX - node.comX);
+			auto ry = std::max(node.comY - node.minY, node.maxY - node.comY);
+			auto rz = std::max(node.comZ - node.minZ, node.maxZ - node.comZ);
+			m_radii[n] = std::sqrt(static_cast<double>(rx) * rx + static_cast<double>(ry) * ry + static_cast<double>(rz) * rz);
+		}
+	});
+
+	m_frontier.clear();
+	m_isFrontier.assign(nodeCount, 0);
+	collectFrontier(0, static_cast<uint32_t>(std::max<size_t>(bodyCount / (8 * pool.concurrency()), m_tree.leafCapacity())));
+
+	pool.parallelFor(0, m_frontier.size(), 1, [this](const size_t first, const size_t last)
+	{
+		for (auto f = first; f < last; ++f)
+		{
+			upward(m_frontier[f], false);
+		}
+	});
+	upward(0, true);
+
+	pool.parallelFor(0, m_frontier.size(), 1, [this](const size_t first, const size_t last)
+	{
+		std::vector<std::pair<uint32_t, uint32_t>> stack;
+		for (auto f = first; f < last; ++f)
+		{
+			dualTreeWalk(m_frontier[f], stack);
+			downward(m_frontier[f]);
+		}
+	});
+
+	const auto &order = m_tree.order();
+	const auto G = static_cast<double>(m_params.gravitationalConstant);
+	pool.parallelFor(0, bodyCount, BODY_GRAIN, [&](const size_t first, const size_t last)
+	{
+		for (auto slot = first; slot < last; ++slot)
+		{
+			auto index = order[slot];
+			particles.ax[index] = static_cast<float>(G * m_ax[slot]);
+			particles.ay[index] = static_cast<float>(G * m_ay[slot]);
+			particles.az[index] = static_cast<float>(G * m_az[slot]);
+		}
+	});
+}
+
+void FmmSolver::collectFrontier(const uint32_t node, const uint32_t cutoff)
+{
+	const auto &n = m_tree.nodes()[node];
+	if (n.isLeaf() || n.bodyCount <= cutoff)
+	{
+		m_frontier.push_back(node);
+		m_isFrontier[node] = 1;
+		return;
+	}
+
+	for (auto c = n.firstChild; c < n.firstChild + n.childCount; ++c)
+	{
+		collectFrontier(c, cutoff);
+	}
+}
+
+void FmmSolver::upward(const uint32_t node, const bool stopAtFrontier)
+{
+	const auto &n = m_tree.nodes()[node];
+	if (stopAtFrontier && m_isFrontier[node])
+	{
+		return;
+	}
+
+	if (n.isLeaf())
+	{
+		particleToMultipole(node);
+		return;
+	}
+
+	for (auto c = n.firstChild; c < n.firstChild + n.childCount; ++c)
+	{
+		upward(c, stopAtFrontier);
+		multipoleToMultipole(c, node);
+	}
+}
+
+void FmmSolver::dualTreeWalk(const uint32_t root, std::vector<std::pair<uint32_t, uint32_t>> &stack)
+{
+	const auto &nodes = m_tree.nodes();
+	const double theta = m_openingAngle;
+
+	// Targets never leave the subtree of `root`, sources start from the whole tree
+	stack.clear();
+	stack.emplace_back(root, 0);
+
+	while (!stack.empty())
+	{
+		auto [target, source] = stack.back();
+		stack.pop_back();
+
+		const auto &t = nodes[target];
+		const auto &s = nodes[source];
+
+		auto dx = m_centers[3 * target] - m_centers[3 * source];
+		auto dy = m_centers[3 * target + 1] - m_centers[3 * source + 1];
+		auto dz = m_centers[3 * target + 2] - m_centers[3 * source + 2];
+		auto distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+		auto reach = m_radii[target] + m_radii[source];
+
+		if (target != source && reach < theta * distance)
+		{
+			multipoleToLocal(source, target);
+		}
+		else if (t.isLeaf() && s.isLeaf())
+		{
+			particleToParticle(source, target);
+		}
+		else if (s.isLeaf() || (!t.isLeaf() && m_radii[target] >= m_radii[source]))
+		{
+			for (auto c = t.firstChild; c < t.firstChild + t.childCount; ++c)
+			{
+				stack.emplace_back(c, source);
+			}
+		}
+		else
+		{
+			for (auto c = s.firstChild; c < s.firstChild + s.childCount; ++c)
+			{
+				stack.emplace_back(target, c);
+			}
+		}
+	}
+}
+
+void FmmSolver::downward(const uint32_t node)
+{
+	const auto &n = m_tree.nodes()[node];
+	if (n.isLeaf())
+	{
+		localToParticle(node);
+		return;
+	}
+
+	for (auto c = n.firstChild; c < n.firstChild + n.childCount; ++c)
+	{
+		localToLocal(node, c);
+		downward(c);
+	}
+}
+
+void FmmSolver::particleToMultipole(const uint32_t node)
+{
+	const auto &n = m_tree.nodes()[node];
+	double powers[256];
+	double *multipole = &m_multipoles[node * m_termCount];
+
+	for (auto i = n.firstBody; i < n.firstBody + n.bodyCount; ++i)
+	{
+		monomials(
+			m_tree.x()[i] - m_centers[3 * node],
+			m_tree.y()[i] - m_centers[3 * node + 1],
+			m_tree.z()[i] - m_centers[3 * node + 2],
+			powers
+		);
+
+		const double mass = m_tree.mass()[i];
+		for (size_t t = 0; t < m_termCount; ++t)
+		{
+			multipole[t] += mass * powers[t];
+		}
+	}
+}
+
+void FmmSolver::multipoleToMultipole(const uint32_t child, const uint32_t parent)
+{
+	double powers[256];
+	monomials(
+		m_centers[3 * child] - m_centers[3 * parent],
+		m_centers[3 * child + 1] - m_centers[3 * parent + 1],
+		m_centers[3 * child + 2] - m_centers[3 * parent + 2],
+		powers
+	);
+
+	const double *from = &m_multipoles[child * m_termCount];
+	double *to = &m_multipoles[parent * m_termCount];
+	for (size_t a = 0; a < m_termCount; ++a)
+	{
+		double sum = 0.0;
+		for (auto t = m_m2mRanges[a].begin; t < m_m2mRanges[a].end; ++t)
+		{
+			sum += m_m2mTerms[t].coefficient * powers[m_m2mTerms[t].rhs] * from[m_m2mTerms[t].lhs];
+		}
+		to[a] += sum;
+	}
+}
+
+void FmmSolver::multipoleToLocal(const uint32_t source, const uint32_t target)
+{
+	double derivative[256];
+	derivatives(
+		m_centers[3 * target] - m_centers[3 * source],
+		m_centers[3 * target + 1] - m_centers[3 * source + 1],
+		m_centers[3 * target + 2] - m_centers[3 * source + 2],
+		derivative
+	);
+
+	const double *multipole = &m_multipoles[source * m_termCount];
+	double *local = &m_locals[target * m_termCount];
+	for (size_t a = 0; a < m_termCount; ++a)
+	{
+		double sum = 0.0;
+		for (auto t = m_m2lRanges[a].begin; t < m_m2lRanges[a].end; ++t)
+		{
+			sum += m_m2lTerms[t].coefficient * derivative[m_m2lTerms[t].rhs] * multipole[m_m2lTerms[t].lhs];
+		}
+		local[a] += sum;
+	}
+}
+
+void FmmSolver::localToLocal(const uint32_t parent, const uint32_t child)
+{
+	double powers[256];
+	monomials(
+		m_centers[3 * child] - m_centers[3 * parent],
+		m_centers[3 * child + 1] - m_centers[3 * parent + 1],
+		m_centers[3 * child + 2] - m_centers[3 * parent + 2],
+		powers
+	);
+
+	const double *from = &m_locals[parent * m_termCount];
+	double *to = &m_locals[child * m_termCount];
+	for (size_t a = 0; a < m_termCount; ++a)
+	{
+		double sum = 0.0;
+		for (auto t = m_l2lRanges[a].begin; t < m_l2lRanges[a].end; ++t)
+		{
+			sum += m_l2lTerms[t].coefficient * powers[m_l2lTerms[t].rhs] * from[m_l2lTerms[t].lhs];
+		}
+		to[a] += sum;
+	}
+}
+
+void FmmSolver::localToParticle(const uint32_t node)
+{
+	const auto &n = m_tree.nodes()[node];
+	const auto side = m_order + 1;
+	const double *local = &m_locals[node * m_termCount];
+	double powers[256];
+
+	for (auto i = n.firstBody; i < n.firstBody + n.bodyCount; ++i)
+	{
+		monomials(
+			m_tree.x()[i] - m_centers[3 * node],
+			m_tree.y()[i] - m_centers[3 * node + 1],
+			m_tree.z()[i] - m_centers[3 * node + 2],
+			powers
+		);
+
+		// Gradient of sum_a L_a h^a
+		double gx = 0.0, gy = 0.0, gz = 0.0;
+		for (size_t t = 1; t < m_termCount; ++t)
+		{
+			const auto ex = m_termExponents[3 * t], ey = m_termExponents[3 * t + 1], ez = m_termExponents[3 * t + 2];
+			if (ex > 0)
+			{
+				gx += ex * local[t] * powers[m_termIndex[((ex - 1) * side + ey) * side + ez]];
+			}
+			if (ey > 0)
+			{
+				gy += ey * local[t] * powers[m_termIndex[(ex * side + ey - 1) * side + ez]];
+			}
+			if (ez > 0)
+			{
+				gz += ez * local[t] * powers[m_termIndex[(ex * side + ey) * side + ez - 1]];
+			}
+		}
+
+		m_ax[i] += gx;
+		m_ay[i] += gy;
+		m_az[i] += gz;
+	}
+}
+
+void FmmSolver::particleToParticle(const uint32_t source, const uint32_t target)
+{
+	const auto &s = m_tree.nodes()[source];
+	const auto &t = m_tree.nodes()[target];
+	const float *x = m_tree.x().data();
+	const float *y = m_tree.y().data();
+	const float *z = m_tree.z().data();
+	const float *m = m_tree.mass().data();
+	const auto eps2 = m_params.softening * m_params.softening;
+
+	for (auto i = t.firstBody; i < t.firstBody + t.bodyCount; ++i)
+	{
+		float ax = 0.0f, ay = 0.0f, az = 0.0f;
+		for (auto j = s.firstBody; j < s.firstBody + s.bodyCount; ++j)
+		{
+			auto dx = x[j] - x[i];
+			auto dy = y[j] - y[i];
+			auto dz = z[j] - z[i];
+			auto r2 = dx * dx + dy * dy + dz * dz + eps2;
+			auto invR = 1.0f / std::sqrt(r2);
+			auto k = m[j] * invR * invR * invR;
+			ax += dx * k;
+			ay += dy * k;
+			az += dz * k;
+		}
+
+		m_ax[i] += ax;
+		m_ay[i] += ay;
+		m_az[i] += az;
+	}
+}
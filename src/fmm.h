@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "force_solver.h"
+#include "octree.h"
+
+// Cartesian Taylor-expansion FMM on the Barnes-Hut octree. Expansions are
+// truncated at total degree `order`; cells interact through a dual tree walk
+// whenever (r_target + r_source) < theta * distance. Work is split over
+// disjoint target subtrees, so every task owns the locals and bodies it writes.
+class FmmSolver : public ForceSolver
+{
+public:
+	static constexpr uint32_t MAX_ORDER = 9;
+
+	FmmSolver(const GravityParams &params, uint32_t order, float openingAngle, uint32_t leafCapacity = 32);
+
+	const char *name() const override
+	{
+		return "fmm";
+	}
+
+	void computeAccelerations(ParticleStore &particles, ThreadPool &pool) override;
+
+	uint32_t order() const
+	{
+		return m_order;
+	}
+
+private:
+	struct Term
+	{
+		uint32_t lhs;
+		uint32_t rhs;
+		double coefficient;
+	};
+
+	struct TermRange
+	{
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	void buildTables();
+	void monomials(double dx, double dy, double dz, double *out) const;
+	void derivatives(double rx, double ry, double rz, double *out) const;
+
+	void collectFrontier(uint32_t node, uint32_t cutoff);
+	void upward(uint32_t node, bool stopAtFrontier);
+	void dualTreeWalk(uint32_t root, std::vector<std::pair<uint32_t, uint32_t>> &stack);
+	void downward(uint32_t node);
+
+	void particleToMultipole(uint32_t node);
+	void multipoleToMultipole(uint32_t child, uint32_t parent);
+	void multipoleToLocal(uint32_t source, uint32_t target);
+	void localToLocal(uint32_t parent, uint32_t child);
+	void localToParticle(uint32_t node);
+	void particleToParticle(uint32_t source, uint32_t target);
+
+	uint32_t m_order;
+	float m_openingAngle;
+	Octree m_tree;
+
+	// Multi-index (i, j, k) of every term with i + j + k <= order, ordered by degree
+	std::vector<uint32_t> m_termExponents;
+	std::vector<uint32_t> m_termDegree;
+	std::vector<uint32_t> m_termIndex;
+	size_t m_termCount = 0;
+
+	std::vector<Term> m_m2mTerms, m_m2lTerms, m_l2lTerms;
+	std::vector<TermRange> m_m2mRanges, m_m2lRanges, m_l2lRanges;
+
+	std::vector<double> m_centers;
+	std::vector<double> m_radii;
+	std::vector<double> m_multipoles;
+	std::vector<double> m_locals;
+	std::vector<double> m_ax, m_ay, m_az;
+	// Disjoint subtrees covering every body; each one is a unit of parallel work
+	std::vector<uint32_t> m_frontier;
+	std::vector<uint8_t> m_isFrontier;
+};
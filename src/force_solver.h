@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "particle_store.h"
+
+class ThreadPool;
+
+struct GravityParams
+{
+	float gravitationalConstant = 1.0f;
+	float softening = 0.01f;
+};
+
+// A force backend fills ax/ay/az of the store from its current positions and masses.
+class ForceSolver
+{
+public:
+	explicit ForceSolver(const GravityParams &params)
+		: m_params(params)
+	{
+	}
+
+	virtual ~ForceSolver() = default;
+
+	virtual const char *name() const = 0;
+
+	virtual void computeAccelerations(ParticleStore &particles, ThreadPool &pool) = 0;
+
+	// Accelerations of the bodies in active (ascending store indices) from every
+	// body's current position. Only those are guaranteed to be updated, others
+	// may change too; the default evaluates everyone. Returns how many bodies
+	// were actually evaluated.
+	virtual size_t computeActiveAccelerations(ParticleStore &particles, const std::vector<uint32_t> &/*active*/, ThreadPool &pool)
+	{
+		computeAccelerations(particles, pool);
+		return particles.size();
+	}
+
+	const GravityParams &params() const
+	{
+		return m_params;
+	}
+
+protected:
+	GravityParams m_params;
+};
@@ -0,0 +1,63 @@
+#include "frame_commands.h"
+
+#include <utility>
+
+FrameCommandPools::FrameCommandPools(vk::Device device, const uint32_t queueFamily, const uint32_t frameCount)
+	: m_device(device), m_queueFamily(queueFamily)
+{
+	for (uint32_t i = 0; i < frameCount; ++i)
+	{
+		auto frame = std::make_unique<Frame>();
+
+		vk::CommandPoolCreateInfo poolInfo(vk::CommandPoolCreateFlagBits::eTransient, m_queueFamily);
+		frame->primaryPool = m_device.createCommandPoolUnique(poolInfo);
+
+		vk::CommandBufferAllocateInfo allocInfo(frame->primaryPool.get(), vk::CommandBufferLevel::ePrimary, 1);
+		frame->primary = std::move(m_device.allocateCommandBuffersUnique(allocInfo)[0]);
+
+		m_frames.push_back(std::move(frame));
+	}
+}
+
+void FrameCommandPools::beginFrame(const uint32_t frame)
+{
+	auto &state = *m_frames[frame];
+
+	// Resetting whole pools recycles every buffer of the frame at once
+	m_device.resetCommandPool(state.primaryPool.get(), vk::CommandPoolResetFlags());
+
+	std::lock_guard<std::mutex> lock(state.threadsMutex);
+	for (auto &thread : state.threads)
+	{
+		m_device.resetCommandPool(thread.second->pool.get(), vk::CommandPoolResetFlags());
+		thread.second->used = 0;
+	}
+}
+
+vk::CommandBuffer FrameCommandPools::acquireSecondary(const uint32_t frame)
+{
+	auto &state = *m_frames[frame];
+
+	ThreadCommands *commands;
+	{
+		std::lock_guard<std::mutex> lock(state.threadsMutex);
+		auto &slot = state.threads[std::this_thread::get_id()];
+		if (!slot)
+		{
+			slot = std::make_unique<ThreadCommands>();
+
+			vk::CommandPoolCreateInfo poolInfo(vk::CommandPoolCreateFlagBits::eTransient, m_queueFamily);
+			slot->pool = m_device.createCommandPoolUnique(poolInfo);
+		}
+		commands = slot.get();
+	}
+
+	// Buffers are kept across frames and only handed out again after the pool reset
+	if (commands->used == commands->secondaries.size())
+	{
+		vk::CommandBufferAllocateInfo allocInfo(commands->pool.get(), vk::CommandBufferLevel::eSecondary, 1);
+		commands->secondaries.push_back(std::move(m_device.allocateCommandBuffersUnique(allocInfo)[0]));
+	}
+
+	return commands->secondaries[commands->used++].get();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// Command buffers for recording every frame from several threads. Each frame
+// in flight has a primary buffer plus one transient pool per recording thread,
+// since a pool and the buffers allocated from it may only be used by one thread
+// at a time. Pools are keyed by OS thread rather than by ThreadPool index, so
+// non-worker threads that help out with recording tasks get their own pool too.
+class FrameCommandPools
+{
+public:
+	FrameCommandPools() = default;
+	FrameCommandPools(vk::Device device, uint32_t queueFamily, uint32_t frameCount);
+
+	FrameCommandPools(FrameCommandPools &&) = default;
+	FrameCommandPools &operator=(FrameCommandPools &&) = default;
+
+	// Resets every pool of frame; only valid once the frame's fence signalled.
+	void beginFrame(uint32_t frame);
+
+	vk::CommandBuffer primary(uint32_t frame) const
+	{
+		return m_frames[frame]->primary.get();
+	}
+
+	// A reset secondary buffer owned by the calling thread for the rest of the frame
+	vk::CommandBuffer acquireSecondary(uint32_t frame);
+
+private:
+	struct ThreadCommands
+	{
+		vk::UniqueCommandPool pool;
+		std::vector<vk::UniqueCommandBuffer> secondaries;
+		size_t used = 0;
+	};
+
+	struct Frame
+	{
+		vk::UniqueCommandPool primaryPool;
+		vk::UniqueCommandBuffer primary;
+		std::mutex threadsMutex;
+		std::unordered_map<std::thread::id, std::unique_ptr<ThreadCommands>> threads;
+	};
+
+	vk::Device m_device;
+	uint32_t m_queueFamily = 0;
+	std::vector<std::unique_ptr<Frame>> m_frames;
+};
@@ -0,0 +1,87 @@
+#include "gpu_timer.h"
+
+#include "profiler.h"
+
+GpuTimer::GpuTimer(vk::Device device, vk::PhysicalDevice physicalDevice, const uint32_t queueFamily, const uint32_t frameCount)
+	: m_device(device), m_frames(frameCount)
+{
+	const auto validBits = physicalDevice.getQueueFamilyProperties()[queueFamily].timestampValidBits;
+	if (validBits == 0)
+	{
+		return;
+	}
+
+	m_nsPerTick = physicalDevice.getProperties().limits.timestampPeriod;
+	m_validMask = validBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << validBits) - 1;
+
+	vk::QueryPoolCreateInfo poolInfo(vk::QueryPoolCreateFlags(), vk::QueryType::eTimestamp, MAX_MARKS * frameCount);
+	m_pool = m_device.createQueryPoolUnique(poolInfo);
+}
+
+void GpuTimer::begin(vk::CommandBuffer commandBuffer, const uint32_t frame)
+{
+	if (!enabled())
+	{
+		return;
+	}
+
+	auto &queries = m_frames[frame];
+	commandBuffer.resetQueryPool(m_pool.get(), frame * MAX_MARKS, MAX_MARKS);
+	commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, m_pool.get(), frame * MAX_MARKS);
+	queries.markCount = 1;
+	queries.pending = false;
+}
+
+void GpuTimer::mark(vk::CommandBuffer commandBuffer, const uint32_t frame, const char *name)
+{
+	auto &queries = m_frames[frame];
+	if (!enabled() || queries.markCount == MAX_MARKS)
+	{
+		return;
+	}
+
+	commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, m_pool.get(), frame * MAX_MARKS + queries.markCount);
+	queries.names[queries.markCount++] = name;
+}
+
+void GpuTimer::submitted(const uint32_t frame, const uint64_t cpuSubmitNs, const uint64_t frameNumber)
+{
+	auto &queries = m_frames[frame];
+	queries.submitNs = cpuSubmitNs;
+	queries.frameNumber = frameNumber;
+	queries.pending = enabled() && queries.markCount > 1;
+}
+
+void GpuTimer::collect(const uint32_t frame, Profiler &profiler)
+{
+	auto &queries = m_frames[frame];
+	if (!queries.pending)
+	{
+		return;
+	}
+	queries.pending = false;
+
+	std::array<uint64_t, MAX_MARKS> ticks;
+	auto status = m_device.getQueryPoolResults(
+		m_pool.get(),
+		frame * MAX_MARKS, queries.markCount,
+		sizeof(uint64_t) * queries.markCount, ticks.data(),
+		sizeof(uint64_t),
+		vk::QueryResultFlagBits::e64
+	);
+	if (status != vk::Result::eSuccess)
+	{
+		return;
+	}
+
+	const auto start = ticks[0] & m_validMask;
+	auto toCpu = [&](const uint64_t tick)
+	{
+		return queries.submitNs + static_cast<uint64_t>(static_cast<double>(((tick & m_validMask) - start) & m_validMask) * m_nsPerTick);
+	};
+
+	for (uint32_t i = 1; i < queries.markCount; ++i)
+	{
+		profiler.record(ProfileEvent{queries.names[i], toCpu(ticks[i - 1]), toCpu(ticks[i]), queries.frameNumber, Profiler::GPU_THREAD});
+	}
+}
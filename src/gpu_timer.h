@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+class Profiler;
+
+// Timestamp queries around the passes of every frame in flight. begin() opens
+// the frame, each mark() closes one pass that started at the previous mark.
+// Once the frame's fence signalled collect() reads the results and records one
+// GPU event per pass. Queue timestamps live in their own time domain, so events
+// are anchored at the CPU time the frame was submitted.
+class GpuTimer
+{
+public:
+	static constexpr uint32_t MAX_MARKS = 8;
+
+	GpuTimer() = default;
+	GpuTimer(vk::Device device, vk::PhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t frameCount);
+
+	// False when the queue family does not support timestamps
+	bool enabled() const
+	{
+		return static_cast<bool>(m_pool);
+	}
+
+	// Must be recorded outside a render pass, before any mark() of the frame
+	void begin(vk::CommandBuffer commandBuffer, uint32_t frame);
+	void mark(vk::CommandBuffer commandBuffer, uint32_t frame, const char *name);
+
+	void submitted(uint32_t frame, uint64_t cpuSubmitNs, uint64_t frameNumber);
+	void collect(uint32_t frame, Profiler &profiler);
+
+private:
+	struct FrameQueries
+	{
+		std::array<const char *, MAX_MARKS> names = {};
+		uint32_t markCount = 0;
+		uint64_t submitNs = 0;
+		uint64_t frameNumber = 0;
+		bool pending = false;
+	};
+
+	vk::Device m_device;
+	vk::UniqueQueryPool m_pool;
+	double m_nsPerTick = 1.0;
+	uint64_t m_validMask = ~uint64_t(0);
+	std::vector<FrameQueries> m_frames;
+};
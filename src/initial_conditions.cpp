@@ -0,0 +1,45 @@
+#include "initial_conditions.h"
+
+#include <cmath>
+#include <random>
+
+ParticleStore createGalaxyDisk(const size_t count, const float radius, const float centralMass, const float diskMass, const uint32_t seed)
+{
+	constexpr float TWO_PI = 6.28318530718f;
+	constexpr float THICKNESS = 0.02f;
+
+	ParticleStore particles(count);
+	if (count == 0)
+	{
+		return particles;
+	}
+
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::normal_distribution<float> normal(0.0f, 1.0f);
+
+	particles.mass[0] = centralMass;
+	particles.color[0] = ParticleStore::packColor(1.0f, 1.0f, 1.0f);
+
+	const auto bodyMass = count > 1 ? diskMass / static_cast<float>(count - 1) : 0.0f;
+	for (size_t i = 1; i < count; ++i)
+	{
+		// Uniform surface density, so the enclosed disk mass grows with r^2
+		auto u = unit(rng);
+		auto r = radius * std::sqrt(u);
+		auto angle = TWO_PI * unit(rng);
+		auto enclosed = centralMass + diskMass * u;
+		auto speed = std::sqrt(enclosed / std::max(r, 1e-3f));
+
+		particles.x[i] = r * std::cos(angle);
+		particles.y[i] = r * std::sin(angle);
+		particles.z[i] = THICKNESS * radius * normal(rng);
+		particles.vx[i] = -speed * std::sin(angle);
+		particles.vy[i] = speed * std::cos(angle);
+		particles.vz[i] = 0.0f;
+		particles.mass[i] = bodyMass;
+		particles.color[i] = ParticleStore::packColor(1.0f - 0.6f * u, 0.5f + 0.3f * u, 0.3f + 0.7f * u);
+	}
+
+	return particles;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "particle_store.h"
+
+// A thin rotating disk around a heavy central body, in units where G = 1.
+ParticleStore createGalaxyDisk(size_t count, float radius, float centralMass, float diskMass, uint32_t seed);
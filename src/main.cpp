@@ -1,14 +1,18 @@
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
-#include <fstream>
 #include <functional>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <optional>
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <vulkan/vulkan.hpp>
@@ -16,6 +20,23 @@
 
 #include <glm/glm.hpp>
 
+#include "barnes_hut.h"
+#include "frame_commands.h"
+#include "gpu_timer.h"
+#include "initial_conditions.h"
+#include "options.h"
+#include "pipeline_cache.h"
+#include "profiler.h"
+#include "simulation.h"
+#include "snapshot.h"
+#include "staging_uploader.h"
+#include "streaming_buffer.h"
+#include "thread_pool.h"
+#include "trajectory.h"
+#include "triple_buffer.h"
+#include "vertex.h"
+#include "vulkan_memory.h"
+
 void onKeyPress(GLFWwindow* window, const int key, const int scancode, const int action, const int mods)
 {
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
@@ -84,11 +105,44 @@ struct QueueFamilyIndices
 {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
+	// A family without graphics or compute, usually backed by a DMA engine
+	std::optional<uint32_t> transferFamily;
 
 	bool isReady() const
 	{
 		return graphicsFamily.has_value() && presentFamily.has_value();
 	}
+
+	// Without a surface nothing is presented, so a graphics+compute family is enough
+	bool isReady(vk::SurfaceKHR renderSurface) const
+	{
+		return renderSurface ? isReady() : graphicsFamily.has_value();
+	}
+};
+
+// Resources of a replaced swapchain; frames already submitted may still use
+// them, so they are destroyed once every one of those frames has retired.
+struct RetiredSwapchain
+{
+	vk::UniqueSwapchainKHR swapChain;
+	std::vector<vk::UniqueImageView> imageViews;
+	vk::UniqueRenderPass renderPass;
+	vk::UniquePipeline pipeline;
+	std::vector<vk::UniqueFramebuffer> frameBuffers;
+	uint64_t retiredAtFrame = 0;
+};
+
+// Positions packed by the simulation thread, handed to the renderer through a
+// TripleBuffer. Only the array of the current draw mode is filled. Colors are
+// in the same slot order and only copied again when a reorder changed it.
+struct PublishedPositions
+{
+	std::vector<Vertex> vertices;
+	std::vector<SpriteInstance> sprites;
+	glm::vec4 spriteBounds;
+	std::vector<uint32_t> colors;
+	uint64_t layout = 0;
+	uint64_t version = 0;
 };
 
 struct SwapChainSupportDetails
@@ -103,29 +157,34 @@ struct SwapChainSupportDetails
 	}
 };
 
-struct Vertex
-{
-	glm::vec2 pos;
-	glm::vec3 color;
-
-	static vk::VertexInputBindingDescription getBindingDescription()
-	{
-		return vk::VertexInputBindingDescription(0, sizeof(Vertex));
-	}
-
-	static std::array<vk::VertexInputAttributeDescription, 2> getAttributeDescription()
-	{
-		return {
-			vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32Sfloat, offsetof(Vertex, pos)),
-			vk::VertexInputAttributeDescription(1, 0, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, color))
-		};
-	}
-};
-
 constexpr uint32_t WIDTH = 640;
 constexpr uint32_t HEIGHT = 480;
 constexpr const char* NAME = "triangle";
 constexpr unsigned int MAX_FRAMES_IN_FLIGHT = 2;
+constexpr uint32_t COMPUTE_GROUP_SIZE = 128;
+// Radius of a body in the sprite render mode
+constexpr float SPRITE_RADIUS_PIXELS = 1.5f;
+// Bodies drawn by one secondary command buffer
+constexpr size_t DRAW_CHUNK_BODIES = size_t(1) << 16;
+// Threads recording them, the render thread included. Recording has its own
+// pool: a non-worker thread helping out in a shared pool would pick up the
+// simulation thread's walks and tree builds, and the frame would wait on them.
+constexpr size_t RECORD_THREADS = 4;
+constexpr const char* PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+
+struct ComputeParams
+{
+	float timeStep;
+	float gravitationalConstant;
+	float softening2;
+	uint32_t bodyCount;
+};
+
+struct BodyMotion
+{
+	glm::vec4 velocity;
+	glm::vec4 acceleration;
+};
 
 const std::vector<const char *> VALIDATION_LAYERS =
 {
@@ -137,13 +196,6 @@ const std::vector<const char *> DEVICE_EXTENSIONS =
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
-const std::vector<Vertex> vertecies
-{
-	{ { 0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}},
-    { { 0.5f,  0.5f}, {0.0f, 1.0f, 0.0f}},
-    { {-0.5f,  0.5f}, {0.0f, 0.0f, 1.0f}}	
-};
-
 VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 	VkDebugUtilsMessageSeverityFlagBitsEXT severity,
 	VkDebugUtilsMessageTypeFlagsEXT flags,
@@ -156,23 +208,6 @@ VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 	}
 }
 
-std::vector<char> readFile(const std::string &path)
-{
-	std::ifstream file(path, std::ios::ate | std::ios::binary);
-	if (!file.is_open())
-	{
-		throw std::runtime_error(std::string("could not open shader file: ") + path);
-	}
-
-	auto fileSize = file.tellg();
-	std::vector<char> buffer(fileSize);
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-	file.close();
-
-	return buffer;
-}
-
 QueueFamilyIndices findQueueFamilies(vk::PhysicalDevice device, vk::SurfaceKHR renderSurface)
 {
 	QueueFamilyIndices indices;
@@ -185,25 +220,40 @@ QueueFamilyIndices findQueueFamilies(vk::PhysicalDevice device, vk::SurfaceKHR r
 	{
 		if (family.queueCount > 0)
 		{
-			if (family.queueFlags & vk::QueueFlagBits::eGraphics)
+			// The compute integrator records its dispatches next to the draws
+			if ((family.queueFlags & vk::QueueFlagBits::eGraphics) && (family.queueFlags & vk::QueueFlagBits::eCompute))
 			{
 				indices.graphicsFamily = queueIdx;
 			}
 
-			presentSupport = device.getSurfaceSupportKHR(queueIdx, renderSurface);
-			if (presentSupport)
+			if (renderSurface)
 			{
-				indices.presentFamily = queueIdx;
+				presentSupport = device.getSurfaceSupportKHR(queueIdx, renderSurface);
+				if (presentSupport)
+				{
+					indices.presentFamily = queueIdx;
+				}
 			}
 		}
 
 		queueIdx++;
-		if (indices.isReady())
+		if (indices.isReady(renderSurface))
 		{
 			break;
 		}
 	}
 
+	const auto computeOrGraphics = vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute;
+	for (queueIdx = 0; queueIdx < families.size(); ++queueIdx)
+	{
+		const auto &family = families[queueIdx];
+		if (family.queueCount > 0 && (family.queueFlags & vk::QueueFlagBits::eTransfer) && !(family.queueFlags & computeOrGraphics))
+		{
+			indices.transferFamily = queueIdx;
+			break;
+		}
+	}
+
 	return indices;
 }
 
@@ -243,7 +293,12 @@ SwapChainSupportDetails querySwapChainSupport(vk::PhysicalDevice device, vk::Sur
 
 bool isDeviceSuitable(vk::PhysicalDevice dev, vk::SurfaceKHR renderSurface)
 {
-	auto queuesFound = findQueueFamilies(dev, renderSurface).isReady();
+	auto queuesFound = findQueueFamilies(dev, renderSurface).isReady(renderSurface);
+	if (!renderSurface)
+	{
+		return queuesFound;
+	}
+
 	auto extensionsSupported = checkDeviceExtensionsSupported(dev);
 	auto swapChainAdequate = querySwapChainSupport(dev, renderSurface).isAdequate();
 	return queuesFound && extensionsSupported && swapChainAdequate;
@@ -284,9 +339,35 @@ T clamp(const T &min, const T &value, const T &max)
 class HelloTriangleApp
 {
 public:
+	explicit HelloTriangleApp(const Options &options)
+		: m_options(options), m_threadPool(options.threadCount), m_recordPool(RECORD_THREADS)
+	{
+	}
+
+	~HelloTriangleApp()
+	{
+		stopSimulationThread();
+	}
+
 	void run()
 	{
+		if (m_options.headless)
+		{
+			initSimulation();
+			if (m_options.gpuIntegrator)
+			{
+				initVulkanHeadless();
+			}
+			runHeadless();
+			closeTrajectory();
+			saveCheckpoint();
+			m_pipelineCache.save();
+			flushProfile();
+			return;
+		}
+
 		initWindow();
+		initSimulation();
 		initVulkan();
 		mainLoop();
 		cleanup();
@@ -312,6 +393,105 @@ private:
 		glfwSetFramebufferSizeCallback(m_window, &glfwFramebufferResize);
 	}
 
+	void initSimulation()
+	{
+		SnapshotState restart;
+		auto particles = m_options.loadPath.empty()
+			? createGalaxyDisk(m_options.bodyCount, 0.8f, 1.0f, 1.0f, m_options.seed)
+			: loadSnapshot(m_options.loadPath, &restart, m_options.loadVerify);
+		// Snapshots written in double precision restart in double precision
+		if (m_options.doublePrecision)
+		{
+			particles.enableDoublePrecision();
+		}
+
+		m_simulation = std::make_unique<Simulation>(
+			std::move(particles),
+			createForceSolver(m_options),
+			m_options.timeStep,
+			m_threadPool
+		);
+		m_simulation->setClock(restart.time, restart.stepCount);
+		m_simulation->setStepConfig(m_options.step);
+		m_simulation->setReorderInterval(m_options.reorderInterval);
+		if (m_options.blockLevels > 0)
+		{
+			BlockTimestepParams blockParams;
+			blockParams.maxLevel = m_options.blockLevels;
+			blockParams.eta = m_options.timestepAccuracy;
+			m_simulation->enableBlockTimesteps(blockParams);
+		}
+
+		if (!m_options.trajectoryPath.empty())
+		{
+			m_trajectory = std::make_unique<TrajectoryWriter>(
+				m_options.trajectoryPath,
+				m_simulation->bodyCount(),
+				m_options.trajectoryCompression,
+				m_options.trajectoryInterval
+			);
+			m_trajectory->capture(m_simulation->particles(), m_simulation->stepCount(), m_simulation->time());
+		}
+
+		if (!m_options.profilePath.empty())
+		{
+			m_profiler = std::make_unique<Profiler>();
+			m_profileWriter = std::make_unique<ProfileWriter>(m_options.profilePath, m_options.profileFormat);
+			m_simulation->setProfiler(m_profiler.get());
+		}
+	}
+
+	// Waits for queued trajectory frames
+	void closeTrajectory()
+	{
+		if (!m_trajectory)
+		{
+			return;
+		}
+
+		m_trajectory->close();
+		std::cout
+			<< "trajectory: " << m_trajectory->framesWritten() << " frames, " << (m_trajectory->bytesWritten() >> 10) << " KiB, "
+			<< "simulation stalled " << m_trajectory->stallSeconds() << " s on I/O\n";
+		m_trajectory.reset();
+	}
+
+	void saveCheckpoint()
+	{
+		if (!m_options.savePath.empty())
+		{
+			saveSnapshot(m_options.savePath, m_simulation->particles(), SnapshotState{ m_simulation->time(), m_simulation->stepCount() });
+		}
+	}
+
+	// Trajectory frames and periodic restart points; the final checkpoint is written on exit
+	void writeStepOutputs()
+	{
+		if (m_trajectory)
+		{
+			m_trajectory->capture(m_simulation->particles(), m_simulation->stepCount(), m_simulation->time());
+		}
+
+		const auto interval = m_options.checkpointInterval;
+		if (interval > 0 && m_simulation->stepCount() % interval == 0)
+		{
+			saveCheckpoint();
+		}
+	}
+
+	// Writes every event recorded so far; cheap enough to call every few frames
+	void flushProfile()
+	{
+		if (!m_profiler)
+		{
+			return;
+		}
+
+		m_profileEvents.clear();
+		m_profiler->drain(m_profileEvents);
+		m_profileWriter->write(m_profileEvents);
+	}
+
 	vk::Extent2D chooseSwapExtent(const vk::SurfaceCapabilitiesKHR &capabilities)
 	{
 		if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
@@ -330,6 +510,11 @@ private:
 
 	std::vector<const char *> getRequiredExtensions()
 	{
+		if (m_options.headless)
+		{
+			return { VK_EXT_DEBUG_UTILS_EXTENSION_NAME };
+		}
+
 		uint32_t extCount = 0;
 		const char **glfwExtensions = glfwGetRequiredInstanceExtensions(&extCount);
 
@@ -338,21 +523,6 @@ private:
 		return extensions;
 	}
 
-	uint32_t findMemoryType(const uint32_t typeFilter, vk::MemoryPropertyFlags propertyFlags)
-	{
-		auto memProperties = m_physicalDevice.getMemoryProperties();
-
-		for (auto i = 0u; i < memProperties.memoryTypeCount; ++i)
-		{
-			if ((typeFilter & (1 << i)) && ((memProperties.memoryTypes[i].propertyFlags & propertyFlags) == propertyFlags))
-			{
-				return i;
-			}
-		}
-
-		throw std::runtime_error("could not find compatible memory");
-	}
-
 	void createInstance()
 	{
 		vk::ApplicationInfo appInfo(
@@ -466,7 +636,15 @@ private:
 
 		std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
 
-		std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+		std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value()};
+		if (indices.presentFamily.has_value())
+		{
+			uniqueQueueFamilies.insert(indices.presentFamily.value());
+		}
+		if (indices.transferFamily.has_value())
+		{
+			uniqueQueueFamilies.insert(indices.transferFamily.value());
+		}
 		float queuePriority = 1.0f;
 		vk::DeviceQueueCreateInfo queueCreateInfo(
 			vk::DeviceQueueCreateFlags(),
@@ -488,13 +666,35 @@ private:
 			DEVICE_EXTENSIONS.size(), DEVICE_EXTENSIONS.data(),
 			&deviceFeatures
 		);
+		if (m_options.headless)
+		{
+			createInfo.enabledExtensionCount = 0;
+			createInfo.ppEnabledExtensionNames = nullptr;
+		}
 		m_device = m_physicalDevice.createDeviceUnique(createInfo);
 
 		m_graphicsQueue = m_device->getQueue(indices.graphicsFamily.value(), 0);
-		m_presentQueue = m_device->getQueue(indices.presentFamily.value(), 0);
+		if (indices.presentFamily.has_value())
+		{
+			m_presentQueue = m_device->getQueue(indices.presentFamily.value(), 0);
+		}
+
+		m_allocator = std::make_unique<DeviceAllocator>(m_device.get(), m_physicalDevice);
+		m_pipelineCache = PersistentPipelineCache(m_device.get(), m_physicalDevice, PIPELINE_CACHE_FILE);
+		m_shaderModules = ShaderModuleCache(m_device.get());
+
+		// Without a transfer-only family copies share the graphics queue
+		auto transferFamily = indices.transferFamily.value_or(indices.graphicsFamily.value());
+		m_uploader = StagingUploader(
+			m_device.get(),
+			*m_allocator,
+			m_device->getQueue(transferFamily, 0),
+			transferFamily,
+			indices.graphicsFamily.value()
+		);
 	}
 
-	void createSwapChain()
+	void createSwapChain(vk::SwapchainKHR oldSwapChain = vk::SwapchainKHR())
 	{
 		auto support = querySwapChainSupport(m_physicalDevice, m_renderSurface.get());
 
@@ -538,7 +738,8 @@ private:
 		chainInfo.compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
 		chainInfo.presentMode = presentationMode;
 		chainInfo.clipped = VK_TRUE;
-		chainInfo.oldSwapchain = vk::SwapchainKHR();
+		// Lets the driver hand images over instead of tearing the old chain down first
+		chainInfo.oldSwapchain = oldSwapChain;
 
 		m_swapChain = m_device->createSwapchainKHRUnique(chainInfo);
 		m_swapChainExtent = extent;
@@ -572,17 +773,6 @@ private:
 		}
 	}
 
-	vk::UniqueShaderModule createShaderModule(const std::vector<char> &code)
-	{
-		vk::ShaderModuleCreateInfo shaderInfo(
-			vk::ShaderModuleCreateFlags(),
-			code.size(), 
-			reinterpret_cast<const uint32_t *>(code.data())
-		);
-
-		return m_device->createShaderModuleUnique(shaderInfo);
-	}
-
 	void createRenderPass()
 	{
 		vk::AttachmentDescription color(
@@ -621,58 +811,68 @@ private:
 
 	void createGraphicsPipeline()
 	{
-		auto vertShaderCode = readFile("vert.spv");
-		auto fragShaderCode = readFile("frag.spv");
+		auto fragShader = m_shaderModules.get("frag.spv");
+		auto vertShader = m_shaderModules.get("vert.spv");
 
-		auto fragShader = createShaderModule(fragShaderCode);
-		auto vertShader = createShaderModule(vertShaderCode);
+		const uint32_t sprites = m_options.sprites ? 1 : 0;
+		vk::SpecializationMapEntry spritesEntry(0, 0, sizeof(uint32_t));
+		vk::SpecializationInfo vertSpecialization(1, &spritesEntry, sizeof(uint32_t), &sprites);
 
 		vk::PipelineShaderStageCreateInfo vertInfo(
 			vk::PipelineShaderStageCreateFlags(), 
 			vk::ShaderStageFlagBits::eVertex, 
-			vertShader.get(), 
-			"main"
+			vertShader, 
+			"main",
+			&vertSpecialization
 		);
 
 		vk::PipelineShaderStageCreateInfo fragInfo(
 			vk::PipelineShaderStageCreateFlags(), 
 			vk::ShaderStageFlagBits::eFragment, 
-			fragShader.get(), 
+			fragShader, 
 			"main"
 		);
 
 		vk::PipelineShaderStageCreateInfo shaderStages[] = {vertInfo, fragInfo};
 
-		auto bindingDesc = Vertex::getBindingDescription();
-		auto attributeDesc = Vertex::getAttributeDescription();
+		auto bindingDesc = m_options.sprites ? SpriteInstance::getBindingDescription() : Vertex::getBindingDescription();
+		auto attributeDesc = m_options.sprites ? SpriteInstance::getAttributeDescription() : Vertex::getAttributeDescription();
+		auto computeBindingDesc = ComputeVertex::getBindingDescription(
+			m_options.sprites ? vk::VertexInputRate::eInstance : vk::VertexInputRate::eVertex
+		);
+		auto computeAttributeDesc = ComputeVertex::getAttributeDescription();
 
 		vk::PipelineVertexInputStateCreateInfo vertexInput(
 			vk::PipelineVertexInputStateCreateFlags(),
-			1, &bindingDesc,
+			bindingDesc.size(), bindingDesc.data(),
 			attributeDesc.size(), attributeDesc.data()
 		);
+		if (m_options.gpuIntegrator)
+		{
+			vertexInput = vk::PipelineVertexInputStateCreateInfo(
+				vk::PipelineVertexInputStateCreateFlags(),
+				computeBindingDesc.size(), computeBindingDesc.data(),
+				computeAttributeDesc.size(), computeAttributeDesc.data()
+			);
+		}
 
 		vk::PipelineInputAssemblyStateCreateInfo inputAssembly(
 			vk::PipelineInputAssemblyStateCreateFlags(),
-			vk::PrimitiveTopology::eTriangleList,
+			m_options.sprites ? vk::PrimitiveTopology::eTriangleStrip : vk::PrimitiveTopology::ePointList,
 			VK_FALSE
 		);
 
-		vk::Viewport viewport(
-			0, 0, 
-			static_cast<float>(m_swapChainExtent.width), static_cast<float>(m_swapChainExtent.height),
-			0.0f, 1.0f
-		);
-
-		vk::Rect2D scissor(
-			vk::Offset2D(0, 0), 
-			m_swapChainExtent
-		);
-
+		// Viewport and scissor are set while recording so the pipeline survives a resize
 		vk::PipelineViewportStateCreateInfo viewportState(
 			vk::PipelineViewportStateCreateFlags(), 
-			1, &viewport, 
-			1, &scissor
+			1, nullptr, 
+			1, nullptr
+		);
+
+		const std::array<vk::DynamicState, 2> dynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+		vk::PipelineDynamicStateCreateInfo dynamicState(
+			vk::PipelineDynamicStateCreateFlags(),
+			dynamicStates.size(), dynamicStates.data()
 		);
 
 		vk::PipelineRasterizationStateCreateInfo rasterizerState(
@@ -701,9 +901,12 @@ private:
 		colorBlending.setAttachmentCount(1);
 		colorBlending.setPAttachments(&colorBlendAttachment);
 
-		vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
-
-		m_pipelineLayout = m_device->createPipelineLayoutUnique(pipelineLayoutInfo);
+		if (!m_pipelineLayout)
+		{
+			vk::PushConstantRange pushConstants(vk::ShaderStageFlagBits::eVertex, 0, sizeof(SpriteParams));
+			vk::PipelineLayoutCreateInfo pipelineLayoutInfo(vk::PipelineLayoutCreateFlags(), 0, nullptr, 1, &pushConstants);
+			m_pipelineLayout = m_device->createPipelineLayoutUnique(pipelineLayoutInfo);
+		}
 
 		vk::GraphicsPipelineCreateInfo graphicsInfo(
 			vk::PipelineCreateFlags(),
@@ -716,12 +919,12 @@ private:
 			&multisamplingState,
 			nullptr,
 			&colorBlending,
-			nullptr,
+			&dynamicState,
 			m_pipelineLayout.get(),
 			m_renderPass.get()
 		);
 
-		m_pipeline = m_device->createGraphicsPipelineUnique(vk::PipelineCache(), graphicsInfo);
+		m_pipeline = m_device->createGraphicsPipelineUnique(m_pipelineCache.get(), graphicsInfo);
 	}
 
 	void createFramebuffers()
@@ -752,44 +955,124 @@ private:
 
 	void createCommandBuffers()
 	{
-		vk::CommandBufferAllocateInfo allocInfo(
-			m_commandPool.get(), 
-			vk::CommandBufferLevel::ePrimary, 
-			static_cast<uint32_t>(m_swapChainImageViews.size())
+		auto indices = findQueueFamilies(m_physicalDevice, m_renderSurface.get());
+		m_frameCommands = FrameCommandPools(m_device.get(), indices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT);
+
+		if (m_profiler)
+		{
+			m_gpuTimer = GpuTimer(m_device.get(), m_physicalDevice, indices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT);
+		}
+	}
+
+	// Records the current frame: each pass and each chunk of bodies goes into its own
+	// secondary buffer, recorded in parallel on the record pool, and the primary
+	// buffer only executes them. Must run after the frame's fence signalled.
+	vk::CommandBuffer recordFrame(const uint32_t imageIndex)
+	{
+		m_frameCommands.beginFrame(m_currentFrame);
+
+		const auto bodyCount = m_simulation->bodyCount();
+		const auto chunkCount = std::max<size_t>((bodyCount + DRAW_CHUNK_BODIES - 1) / DRAW_CHUNK_BODIES, 1);
+		const size_t firstChunkJob = m_options.gpuIntegrator ? 1 : 0;
+		std::vector<vk::CommandBuffer> secondaries(firstChunkJob + chunkCount);
+
+		std::array<vk::Buffer, 2> vertexBuffers = { m_vertexRing.buffer(), m_colorBuffer.get() };
+		std::array<vk::DeviceSize, 2> vertexOffsets = { m_vertexRing.offset(m_currentFrame), 0 };
+		if (m_options.gpuIntegrator)
+		{
+			vertexBuffers[0] = m_bodyBuffer.get();
+			vertexOffsets[0] = 0;
+		}
+
+		const vk::Viewport viewport(
+			0, 0, 
+			static_cast<float>(m_swapChainExtent.width), static_cast<float>(m_swapChainExtent.height),
+			0.0f, 1.0f
 		);
+		const vk::Rect2D scissor(vk::Offset2D(0, 0), m_swapChainExtent);
+
+		// Floats written by the compute integrator are used as they are
+		const auto bounds = m_options.gpuIntegrator ? glm::vec4(0.0f, 0.0f, 1.0f, 1.0f) : m_spriteBounds[m_currentFrame];
+		const SpriteParams spriteParams{
+			glm::vec2(bounds.x, bounds.y),
+			glm::vec2(bounds.z, bounds.w),
+			glm::vec2(2.0f * SPRITE_RADIUS_PIXELS / m_swapChainExtent.width, 2.0f * SPRITE_RADIUS_PIXELS / m_swapChainExtent.height)
+		};
+
+		const vk::CommandBufferInheritanceInfo computeInheritance;
+		const vk::CommandBufferInheritanceInfo drawInheritance(m_renderPass.get(), 0, m_frameBuffers[imageIndex].get());
 
-		m_commandBuffers = m_device->allocateCommandBuffersUnique(allocInfo);
+		m_recordPool.parallelFor(0, secondaries.size(), 1, [&](const size_t first, const size_t last)
+		{
+			for (auto job = first; job < last; ++job)
+			{
+				auto commandBuffer = m_frameCommands.acquireSecondary(m_currentFrame);
 
-		vk::CommandBufferBeginInfo commandBufferBegin{};
+				if (job < firstChunkJob)
+				{
+					commandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit, &computeInheritance));
+					recordComputeStep(commandBuffer, m_options.timeStep);
+					commandBuffer.end();
+					secondaries[job] = commandBuffer;
+					continue;
+				}
 
-		vk::Buffer vertexBuffers[] = { m_vertexBuffer.get() };
-		vk::DeviceSize vertexOffsets[] = { 0 };
+				const auto chunk = job - firstChunkJob;
+				const auto firstBody = chunk * DRAW_CHUNK_BODIES;
+				const auto chunkBodies = std::min(DRAW_CHUNK_BODIES, bodyCount - std::min(firstBody, bodyCount));
+
+				commandBuffer.begin(vk::CommandBufferBeginInfo(
+					vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+					&drawInheritance
+				));
+				commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_pipeline.get());
+				commandBuffer.setViewport(0, 1, &viewport);
+				commandBuffer.setScissor(0, 1, &scissor);
+				commandBuffer.bindVertexBuffers(0, vertexBuffers.size(), vertexBuffers.data(), vertexOffsets.data());
+				// The layout declares the range in both modes, so it is always defined
+				commandBuffer.pushConstants(m_pipelineLayout.get(), vk::ShaderStageFlagBits::eVertex, 0, sizeof(SpriteParams), &spriteParams);
+				if (m_options.sprites)
+				{
+					commandBuffer.draw(4, static_cast<uint32_t>(chunkBodies), 0, static_cast<uint32_t>(firstBody));
+				}
+				else
+				{
+					commandBuffer.draw(static_cast<uint32_t>(chunkBodies), 1, static_cast<uint32_t>(firstBody), 0);
+				}
+				commandBuffer.end();
+				secondaries[job] = commandBuffer;
+			}
+		});
 
 		vk::RenderPassBeginInfo renderPassBegin;
 		renderPassBegin.renderPass = m_renderPass.get();
+		renderPassBegin.framebuffer = m_frameBuffers[imageIndex].get();
 		renderPassBegin.renderArea.offset = vk::Offset2D(0, 0);
 		renderPassBegin.renderArea.extent = m_swapChainExtent;
 		vk::ClearValue clearColor(vk::ClearColorValue(std::array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f}));
 		renderPassBegin.clearValueCount = 1;
 		renderPassBegin.pClearValues = &clearColor;
 
-		for (auto i = 0u; i < m_swapChainImageViews.size(); ++i)
-		{
-			renderPassBegin.framebuffer = m_frameBuffers[i].get();
+		auto primary = m_frameCommands.primary(m_currentFrame);
+		primary.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+			m_gpuTimer.begin(primary, m_currentFrame);
+			if (firstChunkJob > 0)
+			{
+				primary.executeCommands(static_cast<uint32_t>(firstChunkJob), secondaries.data());
+				m_gpuTimer.mark(primary, m_currentFrame, "compute");
+			}
+			primary.beginRenderPass(renderPassBegin, vk::SubpassContents::eSecondaryCommandBuffers);
+			primary.executeCommands(static_cast<uint32_t>(chunkCount), secondaries.data() + firstChunkJob);
+			primary.endRenderPass();
+			m_gpuTimer.mark(primary, m_currentFrame, "render");
+		primary.end();
 
-			m_commandBuffers[i]->begin(commandBufferBegin);
-				m_commandBuffers[i]->beginRenderPass(renderPassBegin, vk::SubpassContents::eInline);
-				m_commandBuffers[i]->bindPipeline(vk::PipelineBindPoint::eGraphics, m_pipeline.get());
-				m_commandBuffers[i]->bindVertexBuffers(0, 1, vertexBuffers, vertexOffsets);
-				m_commandBuffers[i]->draw(static_cast<uint32_t>(vertecies.size()), 1, 0, 0);
-				m_commandBuffers[i]->endRenderPass();
-			m_commandBuffers[i]->end();
-		}
+		return primary;
 	}
 
 	void createSyncObjects()
 	{
-		auto size = m_swapChainImages.size();
+		auto size = MAX_FRAMES_IN_FLIGHT;
 
 		m_imageAvailable.resize(size);
 		m_renderCompleted.resize(size);
@@ -803,55 +1086,416 @@ private:
 			m_imageAvailable[i] = m_device->createSemaphoreUnique(semaphoreInfo);
 			m_renderCompleted[i] = m_device->createSemaphoreUnique(semaphoreInfo);
 			m_inFlightImages[i] = m_device->createFenceUnique(fenceInfo);
+			m_uploadCompleted[i] = m_device->createSemaphoreUnique(semaphoreInfo);
+			m_uploadPending[i] = false;
 		}
 	}
 
 	void recreateSwapchain()
 	{
+		// Only a minimized window blocks; a plain resize goes straight to recreation
 		int w = 0, h = 0;
-		while (w == 0 && h == 0)
+		glfwGetFramebufferSize(m_window, &w, &h);
+		while (w == 0 || h == 0)
 		{
-			glfwGetFramebufferSize(m_window, &w, &h);
 			glfwWaitEvents();
+			glfwGetFramebufferSize(m_window, &w, &h);
 		}
 
-		m_device->waitIdle();
+		// Frames in flight keep using the old resources; they are released in releaseRetiredSwapchains()
+		RetiredSwapchain retired;
+		retired.retiredAtFrame = m_frameCounter;
+		retired.swapChain = std::move(m_swapChain);
+		retired.imageViews = std::move(m_swapChainImageViews);
+		retired.frameBuffers = std::move(m_frameBuffers);
 
-		createSwapChain();
+		const auto oldFormat = m_swapChainImageFormat;
+		createSwapChain(retired.swapChain.get());
 		createImageViews();
-		createRenderPass();
-		createGraphicsPipeline();
+
+		// Render pass and pipeline only depend on the format, which almost never changes on resize
+		if (m_swapChainImageFormat != oldFormat)
+		{
+			retired.renderPass = std::move(m_renderPass);
+			retired.pipeline = std::move(m_pipeline);
+			createRenderPass();
+			createGraphicsPipeline();
+		}
+
 		createFramebuffers();
-		createCommandBuffers();
+
+		m_retiredSwapchains.push_back(std::move(retired));
+	}
+
+	// Called after waiting for the current frame's fence: every frame submitted
+	// MAX_FRAMES_IN_FLIGHT or more frames ago has completed by then.
+	void releaseRetiredSwapchains()
+	{
+		auto released = std::remove_if(m_retiredSwapchains.begin(), m_retiredSwapchains.end(), [this](const RetiredSwapchain &retired)
+		{
+			return m_frameCounter >= retired.retiredAtFrame + MAX_FRAMES_IN_FLIGHT;
+		});
+		m_retiredSwapchains.erase(released, m_retiredSwapchains.end());
+	}
+
+	void createBuffer(
+		const vk::DeviceSize size,
+		const vk::BufferUsageFlags usage,
+		const vk::MemoryPropertyFlags properties,
+		vk::UniqueBuffer &buffer,
+		DeviceAllocation &memory)
+	{
+		vk::BufferCreateInfo bufferInfo(vk::BufferCreateFlags(), size, usage);
+		buffer = m_device->createBufferUnique(bufferInfo);
+		memory = m_allocator->bindBuffer(buffer.get(), properties);
+	}
+
+	// Device-local buffer filled through the staging uploader, shared with the transfer family if it is separate
+	void createDeviceLocalBuffer(
+		const vk::DeviceSize size,
+		const vk::BufferUsageFlags usage,
+		vk::UniqueBuffer &buffer,
+		DeviceAllocation &memory)
+	{
+		auto families = m_uploader.sharingFamilies();
+
+		vk::BufferCreateInfo bufferInfo(vk::BufferCreateFlags(), size, usage | vk::BufferUsageFlagBits::eTransferDst);
+		if (families.size() > 1)
+		{
+			bufferInfo.sharingMode = vk::SharingMode::eConcurrent;
+			bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(families.size());
+			bufferInfo.pQueueFamilyIndices = families.data();
+		}
+		buffer = m_device->createBufferUnique(bufferInfo);
+		memory = m_allocator->bindBuffer(buffer.get(), vk::MemoryPropertyFlagBits::eDeviceLocal);
+	}
+
+	// The next submission of the current frame waits for the copy before vertex input
+	void uploadForCurrentFrame(vk::Buffer dst, const void *data, const vk::DeviceSize size)
+	{
+		if (m_uploadPending[m_currentFrame])
+		{
+			// The frame already waits on an earlier copy and its binary semaphore cannot be signalled twice
+			m_uploader.upload(dst, 0, data, size);
+			m_uploader.waitIdle();
+			return;
+		}
+
+		m_uploader.upload(dst, 0, data, size, m_uploadCompleted[m_currentFrame].get());
+		m_uploadPending[m_currentFrame] = true;
+	}
+
+	void createColorBuffer()
+	{
+		const auto &particles = m_simulation->particles();
+		const auto size = sizeof(uint32_t) * particles.size();
+
+		createDeviceLocalBuffer(size, vk::BufferUsageFlagBits::eVertexBuffer, m_colorBuffer, m_colorMemory);
+		uploadForCurrentFrame(m_colorBuffer.get(), particles.color.data(), size);
+		m_colorLayout = m_simulation->layoutVersion();
+	}
+
+	void submitImmediate(const std::function<void(vk::CommandBuffer)> &record)
+	{
+		vk::CommandBufferAllocateInfo allocInfo(m_commandPool.get(), vk::CommandBufferLevel::ePrimary, 1);
+		auto commandBuffers = m_device->allocateCommandBuffersUnique(allocInfo);
+
+		commandBuffers[0]->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+		record(commandBuffers[0].get());
+		commandBuffers[0]->end();
+
+		vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &commandBuffers[0].get());
+		m_graphicsQueue.submit(vk::ArrayProxy(submitInfo), vk::Fence());
+		m_graphicsQueue.waitIdle();
 	}
 
 	void createVertexBuffer()
 	{
-		vk::BufferCreateInfo bufferInfo(
-			vk::BufferCreateFlags(), 
-			sizeof(vertecies[0]) * vertecies.size(), 
-			vk::BufferUsageFlags(vk::BufferUsageFlagBits::eVertexBuffer)
+		m_vertexRing = StreamingRingBuffer(
+			m_device.get(),
+			*m_allocator,
+			(m_options.sprites ? sizeof(SpriteInstance) : sizeof(Vertex)) * m_simulation->bodyCount(),
+			MAX_FRAMES_IN_FLIGHT,
+			vk::BufferUsageFlagBits::eVertexBuffer
 		);
 
-		m_vertexBuffer = m_device->createBufferUnique(bufferInfo);
-		
-		auto memRequirements = m_device->getBufferMemoryRequirements(m_vertexBuffer.get());
-		
-		vk::MemoryAllocateInfo allocInfo(
-			memRequirements.size, 
-			findMemoryType(
-				memRequirements.memoryTypeBits, 
-				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
-			)
+		publishPositions();
+		for (auto frame = 0u; frame < MAX_FRAMES_IN_FLIGHT; ++frame)
+		{
+			updateVertexBuffer(frame);
+		}
+
+		createColorBuffer();
+	}
+
+	void createComputeBuffers()
+	{
+		const auto &particles = m_simulation->particles();
+		const auto count = particles.size();
+
+		createDeviceLocalBuffer(
+			sizeof(glm::vec4) * count,
+			vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,
+			m_bodyBuffer,
+			m_bodyMemory
+		);
+		createDeviceLocalBuffer(sizeof(BodyMotion) * count, vk::BufferUsageFlagBits::eStorageBuffer, m_motionBuffer, m_motionMemory);
+
+		std::vector<glm::vec4> bodies(count);
+		std::vector<BodyMotion> motions(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			bodies[i] = glm::vec4(particles.x[i], particles.y[i], particles.z[i], particles.mass[i]);
+			motions[i].velocity = glm::vec4(particles.vx[i], particles.vy[i], particles.vz[i], 0.0f);
+			motions[i].acceleration = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+		}
+
+		// The initial force pass runs right after, so these copies are simply waited for
+		m_uploader.upload(m_bodyBuffer.get(), 0, bodies.data(), sizeof(glm::vec4) * count);
+		m_uploader.upload(m_motionBuffer.get(), 0, motions.data(), sizeof(BodyMotion) * count);
+		m_uploader.waitIdle();
+	}
+
+	void createComputeDescriptors()
+	{
+		std::array<vk::DescriptorSetLayoutBinding, 2> bindings = {
+			vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),
+			vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute)
+		};
+		vk::DescriptorSetLayoutCreateInfo layoutInfo(vk::DescriptorSetLayoutCreateFlags(), bindings.size(), bindings.data());
+		m_computeSetLayout = m_device->createDescriptorSetLayoutUnique(layoutInfo);
+
+		vk::DescriptorPoolSize poolSize(vk::DescriptorType::eStorageBuffer, bindings.size());
+		vk::DescriptorPoolCreateInfo poolInfo(vk::DescriptorPoolCreateFlags(), 1, 1, &poolSize);
+		m_descriptorPool = m_device->createDescriptorPoolUnique(poolInfo);
+
+		vk::DescriptorSetAllocateInfo setInfo(m_descriptorPool.get(), 1, &m_computeSetLayout.get());
+		m_computeSet = m_device->allocateDescriptorSets(setInfo)[0];
+
+		vk::DescriptorBufferInfo bodyInfo(m_bodyBuffer.get(), 0, VK_WHOLE_SIZE);
+		vk::DescriptorBufferInfo motionInfo(m_motionBuffer.get(), 0, VK_WHOLE_SIZE);
+		std::array<vk::WriteDescriptorSet, 2> writes = {
+			vk::WriteDescriptorSet(m_computeSet, 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &bodyInfo),
+			vk::WriteDescriptorSet(m_computeSet, 1, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &motionInfo)
+		};
+		m_device->updateDescriptorSets(writes, nullptr);
+	}
+
+	void createComputePipelines()
+	{
+		auto computeShader = m_shaderModules.get("comp.spv");
+
+		vk::PushConstantRange pushConstants(vk::ShaderStageFlagBits::eCompute, 0, sizeof(ComputeParams));
+		vk::PipelineLayoutCreateInfo layoutInfo(vk::PipelineLayoutCreateFlags(), 1, &m_computeSetLayout.get(), 1, &pushConstants);
+		m_computePipelineLayout = m_device->createPipelineLayoutUnique(layoutInfo);
+
+		for (uint32_t phase = 0; phase < m_computePipelines.size(); ++phase)
+		{
+			vk::SpecializationMapEntry phaseEntry(0, 0, sizeof(uint32_t));
+			vk::SpecializationInfo specialization(1, &phaseEntry, sizeof(uint32_t), &phase);
+
+			vk::PipelineShaderStageCreateInfo stageInfo(
+				vk::PipelineShaderStageCreateFlags(),
+				vk::ShaderStageFlagBits::eCompute,
+				computeShader,
+				"main",
+				&specialization
+			);
+
+			vk::ComputePipelineCreateInfo pipelineInfo(vk::PipelineCreateFlags(), stageInfo, m_computePipelineLayout.get());
+			m_computePipelines[phase] = m_device->createComputePipelineUnique(m_pipelineCache.get(), pipelineInfo);
+		}
+
+		// The first kick needs accelerations; a zero-length force pass computes them without moving anything
+		submitImmediate([this](vk::CommandBuffer commandBuffer)
+		{
+			recordComputePhase(commandBuffer, 1, 0.0f);
+		});
+	}
+
+	void recordComputePhase(vk::CommandBuffer commandBuffer, const uint32_t phase, const float timeStep)
+	{
+		const auto &gravity = m_options.gravity;
+		ComputeParams params{
+			timeStep,
+			gravity.gravitationalConstant,
+			gravity.softening * gravity.softening,
+			static_cast<uint32_t>(m_simulation->bodyCount())
+		};
+
+		commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_computePipelines[phase].get());
+		commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_computePipelineLayout.get(), 0, 1, &m_computeSet, 0, nullptr);
+		commandBuffer.pushConstants(m_computePipelineLayout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(ComputeParams), &params);
+		commandBuffer.dispatch((params.bodyCount + COMPUTE_GROUP_SIZE - 1) / COMPUTE_GROUP_SIZE, 1, 1);
+	}
+
+	void recordComputeStep(vk::CommandBuffer commandBuffer, const float timeStep)
+	{
+		const vk::MemoryBarrier shaderToShader(
+			vk::AccessFlagBits::eShaderWrite,
+			vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite
+		);
+		const vk::MemoryBarrier shaderToVertex(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eVertexAttributeRead);
+
+		// Previous frames may still draw from the body buffer and their force pass wrote the motions
+		commandBuffer.pipelineBarrier(
+			vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eVertexInput,
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::DependencyFlags(),
+			shaderToShader, nullptr, nullptr
 		);
+		recordComputePhase(commandBuffer, 0, timeStep);
 
-		m_vertexDeviceMemory = m_device->allocateMemoryUnique(allocInfo);	
+		commandBuffer.pipelineBarrier(
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::DependencyFlags(),
+			shaderToShader, nullptr, nullptr
+		);
+		recordComputePhase(commandBuffer, 1, timeStep);
+
+		commandBuffer.pipelineBarrier(
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::PipelineStageFlagBits::eVertexInput,
+			vk::DependencyFlags(),
+			shaderToVertex, nullptr, nullptr
+		);
+	}
+
+	// Only this frame's region is rewritten; its fence has already signalled, so the GPU is done reading it
+	// Simulation thread: packs the current positions and hands them to the renderer
+	void publishPositions()
+	{
+		auto &positions = m_published.back();
+		const auto count = m_simulation->bodyCount();
+
+		// The view follows the float origin, which --double keeps at the center of
+		// mass; without it the origin stays at zero and the view at the world origin
+		const auto &origin = m_simulation->particles().origin();
+		m_simulation->setViewOrigin(glm::dvec2(origin[0], origin[1]));
+
+		if (m_options.sprites)
+		{
+			positions.sprites.resize(count);
+			positions.spriteBounds = m_simulation->packSprites(positions.sprites.data());
+		}
+		else
+		{
+			positions.vertices.resize(count);
+			m_simulation->packVertices(positions.vertices.data());
+		}
 
-		void* data = m_device->mapMemory(m_vertexDeviceMemory.get(), 0, bufferInfo.size);		
-		std::memcpy(data, vertecies.data(), static_cast<size_t>(bufferInfo.size));
-		m_device->unmapMemory(m_vertexDeviceMemory.get());
+		const auto layout = m_simulation->layoutVersion();
+		if (positions.layout != layout || positions.colors.size() != count)
+		{
+			const auto *colors = m_simulation->particles().color.data();
+			positions.colors.assign(colors, colors + count);
+			positions.layout = layout;
+		}
 
-		m_device->bindBufferMemory(m_vertexBuffer.get(), m_vertexDeviceMemory.get(), 0);
+		positions.version = ++m_publishedVersion;
+		m_published.publish();
+	}
+
+	// Render thread: copies the newest published positions into the frame's ring
+	// region, unless the region already holds them
+	void updateVertexBuffer(const uint32_t frame)
+	{
+		m_published.update();
+		const auto &positions = m_published.front();
+		if (m_regionVersion[frame] == positions.version)
+		{
+			return;
+		}
+		m_regionVersion[frame] = positions.version;
+
+		// Bodies changed slots: the shared color buffer must follow before this frame draws
+		if (m_colorBuffer && positions.layout != m_colorLayout)
+		{
+			// Frames still in flight read the old order from it
+			std::vector<vk::Fence> fences;
+			for (const auto &fence : m_inFlightImages)
+			{
+				fences.push_back(fence.get());
+			}
+			m_device->waitForFences(fences, VK_TRUE, std::numeric_limits<uint64_t>::max());
+			uploadForCurrentFrame(m_colorBuffer.get(), positions.colors.data(), positions.colors.size() * sizeof(uint32_t));
+			m_colorLayout = positions.layout;
+		}
+
+		if (m_options.sprites)
+		{
+			std::memcpy(m_vertexRing.region(frame), positions.sprites.data(), positions.sprites.size() * sizeof(SpriteInstance));
+			m_spriteBounds[frame] = positions.spriteBounds;
+			return;
+		}
+
+		std::memcpy(m_vertexRing.region(frame), positions.vertices.data(), positions.vertices.size() * sizeof(Vertex));
+	}
+
+	// Steps the CPU simulation as fast as it can (or at --step-rate) while the
+	// render thread draws whatever was published last
+	void startSimulationThread()
+	{
+		if (m_options.gpuIntegrator)
+		{
+			return;
+		}
+
+		m_stopSimulation.store(false, std::memory_order_relaxed);
+		m_simulationThread = std::thread([this]
+		{
+			using Clock = std::chrono::steady_clock;
+			const auto stepPeriod = m_options.stepRate > 0.0
+				? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_options.stepRate))
+				: Clock::duration::zero();
+			auto nextStep = Clock::now();
+
+			try
+			{
+				while (!m_stopSimulation.load(std::memory_order_relaxed))
+				{
+					{
+						ScopedTimer timer(m_profiler.get(), "simulation step");
+						m_simulation->step();
+					}
+					writeStepOutputs();
+					{
+						ScopedTimer timer(m_profiler.get(), "pack vertices");
+						publishPositions();
+					}
+
+					if (stepPeriod > Clock::duration::zero())
+					{
+						nextStep = std::max(nextStep + stepPeriod, Clock::now() - stepPeriod);
+						std::this_thread::sleep_until(nextStep);
+					}
+				}
+			}
+			catch (...)
+			{
+				m_simulationError = std::current_exception();
+				m_simulationFailed.store(true, std::memory_order_release);
+			}
+		});
+	}
+
+	void stopSimulationThread()
+	{
+		m_stopSimulation.store(true, std::memory_order_relaxed);
+		if (m_simulationThread.joinable())
+		{
+			m_simulationThread.join();
+		}
+	}
+
+	void rethrowSimulationError()
+	{
+		if (m_simulationFailed.load(std::memory_order_acquire))
+		{
+			stopSimulationThread();
+			std::rethrow_exception(m_simulationError);
+		}
 	}
 
 	void initVulkan()
@@ -870,19 +1514,163 @@ private:
 		createGraphicsPipeline();
 		createFramebuffers();
 		createCommandPool();
-		createVertexBuffer();
-		createCommandBuffers();
 		createSyncObjects();
+		if (m_options.gpuIntegrator)
+		{
+			createComputeBuffers();
+			createComputeDescriptors();
+			createComputePipelines();
+			createColorBuffer();
+		}
+		else
+		{
+			createVertexBuffer();
+		}
+		createCommandBuffers();
+	}
+
+	void initVulkanHeadless()
+	{
+		createInstance();
+
+		checkValidationLayerSupport();
+		setupDebugMessenger();
+
+		pickPhysicalDevice();
+		createLogicalDevice();
+		createCommandPool();
+		createComputeBuffers();
+		createComputeDescriptors();
+		createComputePipelines();
+	}
+
+	void runHeadless()
+	{
+		// Steps per submission; keeps single submissions short enough for watchdogs
+		constexpr uint64_t GPU_BATCH = 64;
+		// A step records a handful of events; draining this often keeps the ring far from full
+		constexpr uint64_t PROFILE_FLUSH_STEPS = 1024;
+
+		const auto steps = m_options.steps;
+		const auto start = std::chrono::steady_clock::now();
+
+		if (m_options.gpuIntegrator)
+		{
+			for (uint64_t done = 0; done < steps; done += GPU_BATCH)
+			{
+				auto batch = std::min(GPU_BATCH, steps - done);
+				submitImmediate([this, batch](vk::CommandBuffer commandBuffer)
+				{
+					for (uint64_t i = 0; i < batch; ++i)
+					{
+						recordComputeStep(commandBuffer, m_options.timeStep);
+					}
+				});
+			}
+		}
+		else
+		{
+			for (uint64_t i = 0; i < steps; ++i)
+			{
+				if (m_profiler)
+				{
+					m_profiler->setFrame(i);
+					if (i % PROFILE_FLUSH_STEPS == 0)
+					{
+						flushProfile();
+					}
+				}
+				{
+					ScopedTimer timer(m_profiler.get(), "step");
+					m_simulation->step();
+				}
+				writeStepOutputs();
+			}
+		}
+
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		const auto bodies = static_cast<double>(m_simulation->bodyCount());
+		const auto seconds = elapsed.count();
+
+		std::cout
+			<< (m_options.gpuIntegrator ? "gpu" : m_simulation->solver().name())
+			<< " (" << m_options.step.dimensions << "d " << integratorName(m_options.step.integrator) << ' ' << forceLawName(m_options.step.forceLaw) << ")"
+			<< ": " << m_simulation->bodyCount() << " bodies, " << steps << " steps in " << seconds << " s, "
+			<< (steps / seconds) << " steps/s, "
+			<< (seconds * 1e9 / (steps * bodies)) << " ns/body/step\n";
+
+		if (const auto blocks = m_simulation->blockTimesteps())
+		{
+			const auto &stats = blocks->stats();
+			std::cout
+				<< "block timesteps: " << stats.substeps << " substeps, deepest level " << stats.deepestLevel << ", "
+				<< (stats.forceEvaluations / (steps * bodies)) << " force evaluations per body and step\n";
+		}
+
+		const auto *barnesHut = dynamic_cast<const BarnesHutSolver *>(&m_simulation->solver());
+		if (barnesHut && barnesHut->maxOverlap() > 0.0f)
+		{
+			const auto &stats = barnesHut->tree().stats();
+			std::cout
+				<< "barnes-hut tree: " << stats.builds << " builds, " << stats.refits << " refits, "
+				<< (static_cast<double>(stats.refits) / static_cast<double>(std::max<uint64_t>(stats.builds, 1))) << " refits per build\n";
+		}
+
+		if (m_allocator)
+		{
+			const auto memory = m_allocator->stats();
+			std::cout
+				<< "device memory: " << memory.allocationCount << " allocations in " << memory.blockCount << " blocks, "
+				<< (memory.usedBytes >> 10) << " KiB used of " << (memory.reservedBytes >> 10) << " KiB reserved\n";
+		}
+
+		reportDroppedProfileEvents();
+	}
+
+	void reportDroppedProfileEvents()
+	{
+		if (m_profiler && m_profiler->dropped() > 0)
+		{
+			std::cerr << "profiler: dropped " << m_profiler->dropped() << " events, the ring buffer was full\n";
+		}
 	}
 
 	void drawFrame()
 	{
-		m_device->waitForFences(1, &m_inFlightImages[m_currentFrame].get(), VK_TRUE, std::numeric_limits<uint64_t>::max());
+		// Events are drained on a cadence so the ring never has to hold more than a few frames
+		constexpr uint64_t PROFILE_FLUSH_FRAMES = 120;
+
+		if (m_profiler)
+		{
+			m_profiler->setFrame(m_frameCounter);
+			if (m_frameCounter % PROFILE_FLUSH_FRAMES == 0)
+			{
+				flushProfile();
+			}
+		}
+		auto profiler = m_profiler.get();
+
+		rethrowSimulationError();
+
+		{
+			ScopedTimer timer(profiler, "fence wait");
+			m_device->waitForFences(1, &m_inFlightImages[m_currentFrame].get(), VK_TRUE, std::numeric_limits<uint64_t>::max());
+		}
+		if (profiler)
+		{
+			m_gpuTimer.collect(m_currentFrame, *profiler);
+		}
+		releaseRetiredSwapchains();
+
 		const vk::Semaphore* waitSemaphore = &m_imageAvailable[m_currentFrame].get();
 		const vk::Semaphore* signalSemaphore = &m_renderCompleted[m_currentFrame].get();
 
 		uint32_t imageIndex;
-		auto status = m_device->acquireNextImageKHR(m_swapChain.get(), std::numeric_limits<uint64_t>::max(), m_imageAvailable[m_currentFrame].get(), vk::Fence(), &imageIndex);
+		vk::Result status;
+		{
+			ScopedTimer timer(profiler, "acquire");
+			status = m_device->acquireNextImageKHR(m_swapChain.get(), std::numeric_limits<uint64_t>::max(), m_imageAvailable[m_currentFrame].get(), vk::Fence(), &imageIndex);
+		}
 		if (status == vk::Result::eErrorOutOfDateKHR)
 		{
 			recreateSwapchain();
@@ -894,38 +1682,83 @@ private:
 			vk::throwResultException(status, "could not aquire next image");
 		}
 
-		const vk::PipelineStageFlags waitStage(vk::PipelineStageFlagBits::eColorAttachmentOutput);
-		const vk::SubmitInfo submitInfo(1, waitSemaphore, &waitStage, 1, &m_commandBuffers[imageIndex].get(), 1, signalSemaphore);
+		if (!m_options.gpuIntegrator)
+		{
+			ScopedTimer timer(profiler, "copy vertices");
+			updateVertexBuffer(m_currentFrame);
+		}
+		m_uploader.collect();
+
+		std::array<vk::Semaphore, 2> waitSemaphores = { *waitSemaphore, m_uploadCompleted[m_currentFrame].get() };
+		const std::array<vk::PipelineStageFlags, 2> waitStages = {
+			vk::PipelineStageFlags(vk::PipelineStageFlagBits::eColorAttachmentOutput),
+			vk::PipelineStageFlags(vk::PipelineStageFlagBits::eVertexInput)
+		};
+		const uint32_t waitCount = m_uploadPending[m_currentFrame] ? 2 : 1;
+		m_uploadPending[m_currentFrame] = false;
+
+		vk::CommandBuffer commandBuffer;
+		{
+			ScopedTimer timer(profiler, "record");
+			commandBuffer = recordFrame(imageIndex);
+		}
+		const vk::SubmitInfo submitInfo(waitCount, waitSemaphores.data(), waitStages.data(), 1, &commandBuffer, 1, signalSemaphore);
 
 		m_device->resetFences(1, &m_inFlightImages[m_currentFrame].get());
 
-		m_graphicsQueue.submit(vk::ArrayProxy(submitInfo), m_inFlightImages[m_currentFrame].get());
+		{
+			ScopedTimer timer(profiler, "submit");
+			m_gpuTimer.submitted(m_currentFrame, Profiler::now(), m_frameCounter);
+			m_graphicsQueue.submit(vk::ArrayProxy(submitInfo), m_inFlightImages[m_currentFrame].get());
+		}
 
 		vk::PresentInfoKHR presentInfo(1, signalSemaphore, 1, &m_swapChain.get(), &imageIndex);
 
-		status = m_presentQueue.presentKHR(presentInfo);
-		if (status == vk::Result::eErrorOutOfDateKHR || status == vk::Result::eSuboptimalKHR)
 		{
-			recreateSwapchain();
+			ScopedTimer timer(profiler, "present");
+			status = m_presentQueue.presentKHR(presentInfo);
 		}
-
+		++m_frameCounter;
 		m_currentFrame = (m_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+
+		if (status == vk::Result::eErrorOutOfDateKHR || status == vk::Result::eSuboptimalKHR || m_windowSizeChanged)
+		{
+			m_windowSizeChanged = false;
+			recreateSwapchain();
+		}
 	}
 
 	void mainLoop()
 	{
+		startSimulationThread();
 		while (!glfwWindowShouldClose(m_window))
 		{
 			drawFrame();
 			glfwPollEvents();
 		}
+		stopSimulationThread();
+		rethrowSimulationError();
 
 		m_graphicsQueue.waitIdle();
 		m_presentQueue.waitIdle();
+
+		// Frames still in flight finished above, pick up their GPU timings too
+		if (m_profiler)
+		{
+			for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame)
+			{
+				m_gpuTimer.collect(frame, *m_profiler);
+			}
+		}
 	}
 
 	void cleanup()
 	{
+		closeTrajectory();
+		saveCheckpoint();
+		m_pipelineCache.save();
+		flushProfile();
+		reportDroppedProfileEvents();
 		glfwDestroyWindow(m_window);
 		glfwTerminate();
 	}
@@ -937,21 +1770,46 @@ private:
 		vk::DebugUtilsMessengerEXT, 
 		vk::DispatchLoaderDynamic> 			m_debugMessenger;
 	vk::UniqueDevice 						m_device;
+	std::unique_ptr<DeviceAllocator>		m_allocator;
+	PersistentPipelineCache					m_pipelineCache;
+	ShaderModuleCache						m_shaderModules;
 	vk::UniqueCommandPool 					m_commandPool;
 	std::vector<vk::UniqueSemaphore> 		m_imageAvailable;
 	std::vector<vk::UniqueFence> 			m_inFlightImages;
 	std::vector<vk::UniqueSemaphore>		m_renderCompleted;
-	vk::UniqueBuffer						m_vertexBuffer;
-	vk::UniqueDeviceMemory					m_vertexDeviceMemory;
+	std::array<vk::UniqueSemaphore,
+		MAX_FRAMES_IN_FLIGHT>				m_uploadCompleted;
+	std::array<bool, MAX_FRAMES_IN_FLIGHT>	m_uploadPending = {};
+	StreamingRingBuffer						m_vertexRing;
+	vk::UniqueBuffer						m_bodyBuffer;
+	DeviceAllocation						m_bodyMemory;
+	vk::UniqueBuffer						m_motionBuffer;
+	DeviceAllocation						m_motionMemory;
+	vk::UniqueBuffer						m_colorBuffer;
+	DeviceAllocation						m_colorMemory;
+	StagingUploader							m_uploader;		// Destroyed first, waits for copies into the buffers above
+	vk::UniqueDescriptorSetLayout			m_computeSetLayout;
+	vk::UniqueDescriptorPool				m_descriptorPool;
+	vk::DescriptorSet						m_computeSet;
+	vk::UniquePipelineLayout				m_computePipelineLayout;
+	std::array<vk::UniquePipeline, 2>		m_computePipelines;
 	vk::UniqueSwapchainKHR  				m_swapChain;
 	std::vector<vk::UniqueImageView> 		m_swapChainImageViews;
 	vk::UniqueRenderPass 					m_renderPass;
 	vk::UniquePipelineLayout 				m_pipelineLayout;
 	vk::UniquePipeline 						m_pipeline;
-	std::vector<vk::UniqueCommandBuffer>	m_commandBuffers;
+	FrameCommandPools						m_frameCommands;
+	GpuTimer								m_gpuTimer;
+	std::array<glm::vec4,
+		MAX_FRAMES_IN_FLIGHT>				m_spriteBounds;
+	std::array<uint64_t,
+		MAX_FRAMES_IN_FLIGHT>				m_regionVersion = {};
+	uint64_t								m_colorLayout = 0;		// layout version the color buffer holds
 	std::vector<vk::UniqueFramebuffer>		m_frameBuffers;
+	std::vector<RetiredSwapchain>			m_retiredSwapchains;
 
-	int 									m_currentFrame;
+	int 									m_currentFrame = 0;
+	uint64_t								m_frameCounter = 0;
 	vk::DispatchLoaderDynamic 				m_dispatchDynamic;
 	vk::Queue 								m_graphicsQueue;
 	vk::PhysicalDevice 						m_physicalDevice;
@@ -960,16 +1818,36 @@ private:
 	vk::Format   							m_swapChainImageFormat;
 	std::vector<vk::Image>		 			m_swapChainImages;
 	GLFWwindow*								m_window;
-	bool									m_windowSizeChanged;
+	bool									m_windowSizeChanged = false;
+	Options									m_options;
+	ThreadPool								m_threadPool;
+	ThreadPool								m_recordPool;
+	std::unique_ptr<Simulation>				m_simulation;
+	std::unique_ptr<TrajectoryWriter>		m_trajectory;
+	TripleBuffer<PublishedPositions>		m_published;
+	uint64_t								m_publishedVersion = 0;	// simulation thread
+	std::thread								m_simulationThread;
+	std::atomic<bool>						m_stopSimulation{false};
+	std::atomic<bool>						m_simulationFailed{false};
+	std::exception_ptr						m_simulationError;
+	std::unique_ptr<Profiler>				m_profiler;
+	std::unique_ptr<ProfileWriter>			m_profileWriter;
+	std::vector<ProfileEvent>				m_profileEvents;
 
 };
 
-int main()
+int main(int argc, char **argv)
 {
-	auto app = HelloTriangleApp();
-
 	try
 	{
+		auto options = parseOptions(argc, argv);
+		if (options.showHelp)
+		{
+			std::cout << usage(argv[0]);
+			return EXIT_SUCCESS;
+		}
+
+		HelloTriangleApp app(options);
 		app.run();
 	}
 	catch (const VkError &ex)
@@ -0,0 +1,240 @@
+#include "morton_order.h"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+#include "particle_store.h"
+#include "thread_pool.h"
+
+namespace
+{
+	constexpr size_t KEY_GRAIN = 8192;
+	constexpr size_t PERMUTE_GRAIN = 16384;
+	constexpr uint32_t RADIX_BITS = 8;
+	constexpr size_t RADIX_BUCKETS = size_t(1) << RADIX_BITS;
+	// Bodies per histogram chunk of the radix sort
+	constexpr size_t RADIX_CHUNK = 16384;
+
+	uint64_t spreadBits(uint64_t v)
+	{
+		v &= 0x1fffff;
+		v = (v | (v << 32)) & 0x1f00000000ffffull;
+		v = (v | (v << 16)) & 0x1f0000ff0000ffull;
+		v = (v | (v << 8)) & 0x100f00f00f00f00full;
+		v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+		v = (v | (v << 2)) & 0x1249249249249249ull;
+		return v;
+	}
+}
+
+uint64_t mortonEncode(const uint32_t x, const uint32_t y, const uint32_t z)
+{
+	return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+}
+
+void computeMortonKeys(const ParticleStore &particles, ThreadPool &pool, std::vector<MortonKey> &keys)
+{
+	const auto count = particles.size();
+
+	float lo[3] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+	float hi[3] = {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+	std::mutex boundsMutex;
+	pool.parallelFor(0, count, KEY_GRAIN, [&](const size_t first, const size_t last)
+	{
+		float chunkLo[3] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+		float chunkHi[3] = {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+		for (auto i = first; i < last; ++i)
+		{
+			chunkLo[0] = std::min(chunkLo[0], particles.x[i]);
+			chunkLo[1] = std::min(chunkLo[1], particles.y[i]);
+			chunkLo[2] = std::min(chunkLo[2], particles.z[i]);
+			chunkHi[0] = std::max(chunkHi[0], particles.x[i]);
+			chunkHi[1] = std::max(chunkHi[1], particles.y[i]);
+			chunkHi[2] = std::max(chunkHi[2], particles.z[i]);
+		}
+
+		std::lock_guard<std::mutex> lock(boundsMutex);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			lo[axis] = std::min(lo[axis], chunkLo[axis]);
+			hi[axis] = std::max(hi[axis], chunkHi[axis]);
+		}
+	});
+
+	// A cube keeps octants geometrically meaningful
+	auto extent = std::max({hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2], std::numeric_limits<float>::min()});
+	auto scale = static_cast<float>((1u << MORTON_KEY_BITS) - 1) / extent;
+
+	auto quantize = [scale](const float v, const float origin)
+	{
+		return static_cast<uint32_t>(std::min((v - origin) * scale, static_cast<float>((1u << MORTON_KEY_BITS) - 1)));
+	};
+
+	keys.resize(count);
+	pool.parallelFor(0, count, KEY_GRAIN, [&](const size_t first, const size_t last)
+	{
+		for (auto i = first; i < last; ++i)
+		{
+			keys[i].key = mortonEncode(
+				quantize(particles.x[i], lo[0]),
+				quantize(particles.y[i], lo[1]),
+				quantize(particles.z[i], lo[2])
+			);
+			keys[i].index = static_cast<uint32_t>(i);
+		}
+	});
+}
+
+void sortMortonKeys(std::vector<MortonKey> &keys, std::vector<MortonKey> &scratch, ThreadPool &pool)
+{
+	const auto count = keys.size();
+	if (count < 2)
+	{
+		return;
+	}
+
+	// Bits in which any key differs from the first one
+	uint64_t varying = 0;
+	std::mutex varyingMutex;
+	pool.parallelFor(0, count, KEY_GRAIN, [&](const size_t first, const size_t last)
+	{
+		uint64_t chunkVarying = 0;
+		for (auto i = first; i < last; ++i)
+		{
+			chunkVarying |= keys[i].key ^ keys[0].key;
+		}
+
+		std::lock_guard<std::mutex> lock(varyingMutex);
+		varying |= chunkVarying;
+	});
+
+	const auto chunks = std::max<size_t>(1, std::min(4 * pool.concurrency(), count / RADIX_CHUNK));
+	auto chunkBegin = [count, chunks](const size_t chunk)
+	{
+		return chunk * count / chunks;
+	};
+
+	std::vector<size_t> offsets(chunks * RADIX_BUCKETS);
+	scratch.resize(count);
+	auto *source = keys.data();
+	auto *target = scratch.data();
+
+	for (uint32_t shift = 0; shift < 64; shift += RADIX_BITS)
+	{
+		if (((varying >> shift) & (RADIX_BUCKETS - 1)) == 0)
+		{
+			continue;
+		}
+
+		pool.parallelFor(0, chunks, 1, [&](const size_t firstChunk, const size_t lastChunk)
+		{
+			for (auto chunk = firstChunk; chunk < lastChunk; ++chunk)
+			{
+				auto *histogram = offsets.data() + chunk * RADIX_BUCKETS;
+				std::fill(histogram, histogram + RADIX_BUCKETS, size_t(0));
+				for (auto i = chunkBegin(chunk); i < chunkBegin(chunk + 1); ++i)
+				{
+					++histogram[(source[i].key >> shift) & (RADIX_BUCKETS - 1)];
+				}
+			}
+		});
+
+		// Digit-major prefix sum: chunk c writes its bucket d after the same bucket of chunks before it, which keeps the sort stable
+		size_t running = 0;
+		for (size_t digit = 0; digit < RADIX_BUCKETS; ++digit)
+		{
+			for (size_t chunk = 0; chunk < chunks; ++chunk)
+			{
+				auto &offset = offsets[chunk * RADIX_BUCKETS + digit];
+				auto bucketCount = offset;
+				offset = running;
+				running += bucketCount;
+			}
+		}
+
+		pool.parallelFor(0, chunks, 1, [&](const size_t firstChunk, const size_t lastChunk)
+		{
+			for (auto chunk = firstChunk; chunk < lastChunk; ++chunk)
+			{
+				auto *cursor = offsets.data() + chunk * RADIX_BUCKETS;
+				for (auto i = chunkBegin(chunk); i < chunkBegin(chunk + 1); ++i)
+				{
+					target[cursor[(source[i].key >> shift) & (RADIX_BUCKETS - 1)]++] = source[i];
+				}
+			}
+		});
+
+		std::swap(source, target);
+	}
+
+	if (source != keys.data())
+	{
+		keys.swap(scratch);
+	}
+}
+
+void MortonReorder::apply(ParticleStore &particles, ThreadPool &pool)
+{
+	const auto count = particles.size();
+
+	computeMortonKeys(particles, pool, m_keys);
+	sortMortonKeys(m_keys, m_scratch, pool);
+
+	m_order.resize(count);
+	for (size_t k = 0; k < count; ++k)
+	{
+		m_order[k] = m_keys[k].index;
+	}
+
+	for (auto array : {&particles.x, &particles.y, &particles.z, &particles.vx, &particles.vy, &particles.vz, &particles.ax, &particles.ay, &particles.az, &particles.mass})
+	{
+		permute(*array, pool);
+	}
+	permute(particles.color, pool);
+	permute(particles.id, pool);
+	if (particles.doublePrecision())
+	{
+		for (auto array : {&particles.xd, &particles.yd, &particles.zd, &particles.vxd, &particles.vyd, &particles.vzd})
+		{
+			permute(*array, pool);
+		}
+	}
+}
+
+template <typename T>
+void MortonReorder::permute(AlignedBuffer<T> &array, ThreadPool &pool)
+{
+	AlignedBuffer<T> *gathered = nullptr;
+	if constexpr (std::is_same_v<T, float>)
+	{
+		gathered = &m_floats;
+	}
+	else if constexpr (std::is_same_v<T, double>)
+	{
+		gathered = &m_doubles;
+	}
+	else
+	{
+		gathered = &m_words;
+	}
+
+	const auto count = m_order.size();
+	gathered->resize(array.size());
+	const auto *order = m_order.data();
+	const T *source = array.data();
+	T *target = gathered->data();
+	pool.parallelFor(0, count, PERMUTE_GRAIN, [=](const size_t first, const size_t last)
+	{
+		for (auto k = first; k < last; ++k)
+		{
+			target[k] = source[order[k]];
+		}
+	});
+	// Padding does not move
+	std::copy(source + count, source + array.size(), target + count);
+
+	std::swap(array, *gathered);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "aligned_buffer.h"
+
+class ParticleStore;
+class ThreadPool;
+
+// Bits per axis of a Morton key; three axes fill 63 bits
+constexpr uint32_t MORTON_KEY_BITS = 21;
+
+struct MortonKey
+{
+	uint64_t key;
+	uint32_t index;
+};
+
+uint64_t mortonEncode(uint32_t x, uint32_t y, uint32_t z);
+
+// Keys of every body of the store, quantized to the cube around its bounding box
+void computeMortonKeys(const ParticleStore &particles, ThreadPool &pool, std::vector<MortonKey> &keys);
+
+// Stable LSD radix sort by key, eight bits per pass. Every pass histograms
+// and scatters chunks of the array in parallel; passes over a digit that all
+// keys share are skipped, so only the bits that actually vary cost anything.
+// scratch is resized as needed and can be kept between calls.
+void sortMortonKeys(std::vector<MortonKey> &keys, std::vector<MortonKey> &scratch, ThreadPool &pool);
+
+// Sorts the bodies of a store along the Z-order curve so that bodies close in
+// space are close in memory, which keeps the tree walks and the neighbouring
+// targets of the direct kernels in cache. Every per-body array moves,
+// including accelerations and ParticleStore::id, so the physics is untouched
+// and a body stays identifiable across reorders.
+class MortonReorder
+{
+public:
+	void apply(ParticleStore &particles, ThreadPool &pool);
+
+	// New slot -> slot before the last apply()
+	const std::vector<uint32_t> &order() const { return m_order; }
+
+private:
+	template <typename T>
+	void permute(AlignedBuffer<T> &array, ThreadPool &pool);
+
+	std::vector<MortonKey> m_keys;
+	std::vector<MortonKey> m_scratch;
+	std::vector<uint32_t> m_order;
+	// Gather targets, swapped with the store's arrays
+	AlignedBuffer<float> m_floats;
+	AlignedBuffer<double> m_doubles;
+	AlignedBuffer<uint32_t> m_words;
+};
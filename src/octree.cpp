@@ -0,0 +1,331 @@
+#include "octree.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+#include "particle_store.h"
+#include "thread_pool.h"
+
+namespace
+{
+	// Adds the pairwise intersections of node's children and their volumes. pad
+	// thickens every box so flat systems still have volumes to compare.
+	void accumulateOverlap(const std::vector<OctreeNode> &nodes, const OctreeNode &node, const float pad, double &shared, double &volume)
+	{
+		auto overlap = [pad](const float minA, const float maxA, const float minB, const float maxB)
+		{
+			return std::max(0.0f, std::min(maxA, maxB) - std::max(minA, minB) + pad);
+		};
+
+		const auto end = node.firstChild + node.childCount;
+		for (auto a = node.firstChild; a < end; ++a)
+		{
+			const auto &boxA = nodes[a];
+			volume += static_cast<double>(boxA.maxX - boxA.minX + pad) * (boxA.maxY - boxA.minY + pad) * (boxA.maxZ - boxA.minZ + pad);
+			for (auto b = a + 1; b < end; ++b)
+			{
+				const auto &boxB = nodes[b];
+				shared += static_cast<double>(overlap(boxA.minX, boxA.maxX, boxB.minX, boxB.maxX))
+					* overlap(boxA.minY, boxA.maxY, boxB.minY, boxB.maxY)
+					* overlap(boxA.minZ, boxA.maxZ, boxB.minZ, boxB.maxZ);
+			}
+		}
+	}
+}
+
+Octree::Octree(const uint32_t leafCapacity)
+	: m_leafCapacity(std::max(leafCapacity, 1u))
+{
+}
+
+void Octree::build(const ParticleStore &particles, ThreadPool &pool)
+{
+	constexpr size_t GATHER_GRAIN = 4096;
+
+	const auto count = particles.size();
+
+	++m_stats.builds;
+	m_nodes.clear();
+	// Bodies already in Morton order (see MortonReorder) leave this gather and the sort's scatters nearly sequential
+	computeMortonKeys(particles, pool, m_keys);
+	sortMortonKeys(m_keys, m_keyScratch, pool);
+
+	m_order.resize(count);
+	m_ids.resize(count);
+	for (auto array : {&m_x, &m_y, &m_z, &m_mass})
+	{
+		array->resize(count);
+	}
+
+	pool.parallelFor(0, count, GATHER_GRAIN, [this, &particles](const size_t first, const size_t last)
+	{
+		for (auto slot = first; slot < last; ++slot)
+		{
+			auto index = m_keys[slot].index;
+			m_order[slot] = index;
+			m_ids[slot] = particles.id[index];
+			m_x[slot] = particles.x[index];
+			m_y[slot] = particles.y[index];
+			m_z[slot] = particles.z[index];
+			m_mass[slot] = particles.mass[index];
+		}
+	});
+
+	if (count == 0)
+	{
+		m_overlap = 0.0f;
+		return;
+	}
+
+	m_nodes.push_back(OctreeNode{});
+	if (pool.concurrency() == 1)
+	{
+		buildNode(m_nodes, 0, 0, static_cast<uint32_t>(count), 0, nullptr);
+	}
+	else
+	{
+		// The top of the tree is built serially; subtrees below the cutoff go to the pool
+		m_subtreeCutoff = static_cast<uint32_t>(std::max<size_t>(count / (8 * pool.concurrency()), m_leafCapacity));
+		m_deferred.clear();
+		buildNode(m_nodes, 0, 0, static_cast<uint32_t>(count), 0, &m_deferred);
+
+		const auto topCount = static_cast<uint32_t>(m_nodes.size());
+		buildSubtrees(pool);
+
+		// Children follow their parent, so a reverse sweep over the top part is bottom-up
+		for (auto n = topCount; n-- > 0;)
+		{
+			if (!m_nodes[n].isLeaf())
+			{
+				computeInternalMoments(m_nodes, m_nodes[n]);
+			}
+		}
+	}
+
+	m_overlap = 0.0f;
+}
+
+bool Octree::refit(const ParticleStore &particles, ThreadPool &pool)
+{
+	constexpr size_t GATHER_GRAIN = 4096;
+	constexpr size_t LEAF_GRAIN = 256;
+
+	const auto count = particles.size();
+	if (m_nodes.empty() || count != m_order.size())
+	{
+		return false;
+	}
+
+	// Slots that now hold other bodies are caught in the same pass as the gather
+	std::atomic<bool> moved{false};
+	pool.parallelFor(0, count, GATHER_GRAIN, [this, &particles, &moved](const size_t first, const size_t last)
+	{
+		bool chunkMoved = false;
+		for (auto slot = first; slot < last; ++slot)
+		{
+			auto index = m_order[slot];
+			chunkMoved |= particles.id[index] != m_ids[slot];
+			m_x[slot] = particles.x[index];
+			m_y[slot] = particles.y[index];
+			m_z[slot] = particles.z[index];
+			m_mass[slot] = particles.mass[index];
+		}
+		if (chunkMoved)
+		{
+			moved.store(true, std::memory_order_relaxed);
+		}
+	});
+	if (moved.load(std::memory_order_relaxed))
+	{
+		return false;
+	}
+
+	pool.parallelFor(0, m_nodes.size(), LEAF_GRAIN, [this](const size_t first, const size_t last)
+	{
+		for (auto n = first; n < last; ++n)
+		{
+			if (m_nodes[n].isLeaf())
+			{
+				computeLeafMoments(m_nodes[n]);
+			}
+		}
+	});
+
+	// Spliced subtrees also lie behind their parent, so one reverse sweep covers the whole pool
+	// The root still has its previous size here, which is fine as a length scale
+	const auto pad = 1e-4f * m_nodes[0].size;
+	double shared = 0.0, volume = 0.0;
+	for (auto n = m_nodes.size(); n-- > 0;)
+	{
+		if (!m_nodes[n].isLeaf())
+		{
+			computeInternalMoments(m_nodes, m_nodes[n]);
+			accumulateOverlap(m_nodes, m_nodes[n], pad, shared, volume);
+		}
+	}
+
+	m_overlap = volume > 0.0 ? static_cast<float>(shared / volume) : 0.0f;
+	++m_stats.refits;
+	return true;
+}
+
+void Octree::update(const ParticleStore &particles, ThreadPool &pool, const float maxOverlap)
+{
+	if (maxOverlap > 0.0f && refit(particles, pool) && m_overlap <= maxOverlap)
+	{
+		return;
+	}
+	build(particles, pool);
+}
+
+void Octree::buildNode(std::vector<OctreeNode> &nodes, const uint32_t nodeIndex, const uint32_t begin, const uint32_t end, const uint32_t depth, std::vector<Subtree> *deferred) const
+{
+	nodes[nodeIndex].firstBody = begin;
+	nodes[nodeIndex].bodyCount = end - begin;
+	nodes[nodeIndex].firstChild = 0;
+	nodes[nodeIndex].childCount = 0;
+
+	if (end - begin <= m_leafCapacity || depth == MAX_DEPTH)
+	{
+		computeLeafMoments(nodes[nodeIndex]);
+		return;
+	}
+
+	if (deferred && end - begin <= m_subtreeCutoff)
+	{
+		deferred->push_back(Subtree{nodeIndex, begin, end, depth});
+		return;
+	}
+
+	// Keys are sorted, so each octant is a contiguous run
+	const auto shift = 3 * (MORTON_BITS - 1 - depth);
+	uint32_t bounds[9];
+	uint32_t childCount = 0;
+	auto cursor = begin;
+	while (cursor < end)
+	{
+		auto octant = (m_keys[cursor].key >> shift) & 7;
+		auto runEnd = static_cast<uint32_t>(std::partition_point(
+			m_keys.begin() + cursor, m_keys.begin() + end,
+			[shift, octant](const MortonKey &k) { return ((k.key >> shift) & 7) == octant; }
+		) - m_keys.begin());
+		bounds[childCount++] = cursor;
+		cursor = runEnd;
+	}
+	bounds[childCount] = end;
+
+	const auto firstChild = static_cast<uint32_t>(nodes.size());
+	nodes.resize(nodes.size() + childCount);
+	nodes[nodeIndex].firstChild = firstChild;
+	nodes[nodeIndex].childCount = childCount;
+
+	for (uint32_t c = 0; c < childCount; ++c)
+	{
+		buildNode(nodes, firstChild + c, bounds[c], bounds[c + 1], depth + 1, deferred);
+	}
+
+	if (!deferred)
+	{
+		computeInternalMoments(nodes, nodes[nodeIndex]);
+	}
+}
+
+void Octree::buildSubtrees(ThreadPool &pool)
+{
+	if (m_deferred.empty())
+	{
+		return;
+	}
+
+	m_subtreeNodes.resize(m_deferred.size());
+	pool.parallelFor(0, m_deferred.size(), 1, [this](const size_t first, const size_t last)
+	{
+		for (auto i = first; i < last; ++i)
+		{
+			const auto &subtree = m_deferred[i];
+			auto &local = m_subtreeNodes[i];
+			local.clear();
+			local.push_back(OctreeNode{});
+			buildNode(local, 0, subtree.begin, subtree.end, subtree.depth, nullptr);
+		}
+	});
+
+	// Splice every subtree behind the top part: local node k > 0 lands at base + k - 1
+	for (size_t i = 0; i < m_deferred.size(); ++i)
+	{
+		const auto &local = m_subtreeNodes[i];
+		const auto base = static_cast<uint32_t>(m_nodes.size());
+		auto remap = [base](OctreeNode node)
+		{
+			if (!node.isLeaf())
+			{
+				node.firstChild = base + node.firstChild - 1;
+			}
+			return node;
+		};
+
+		m_nodes[m_deferred[i].node] = remap(local[0]);
+		for (size_t k = 1; k < local.size(); ++k)
+		{
+			m_nodes.push_back(remap(local[k]));
+		}
+	}
+}
+
+void Octree::computeLeafMoments(OctreeNode &node) const
+{
+	node.minX = node.minY = node.minZ = std::numeric_limits<float>::max();
+	node.maxX = node.maxY = node.maxZ = std::numeric_limits<float>::lowest();
+	float mass = 0.0f, mx = 0.0f, my = 0.0f, mz = 0.0f;
+
+	for (auto i = node.firstBody; i < node.firstBody + node.bodyCount; ++i)
+	{
+		node.minX = std::min(node.minX, m_x[i]);
+		node.minY = std::min(node.minY, m_y[i]);
+		node.minZ = std::min(node.minZ, m_z[i]);
+		node.maxX = std::max(node.maxX, m_x[i]);
+		node.maxY = std::max(node.maxY, m_y[i]);
+		node.maxZ = std::max(node.maxZ, m_z[i]);
+		mass += m_mass[i];
+		mx += m_mass[i] * m_x[i];
+		my += m_mass[i] * m_y[i];
+		mz += m_mass[i] * m_z[i];
+	}
+
+	node.mass = mass;
+	auto inv = mass > 0.0f ? 1.0f / mass : 0.0f;
+	node.comX = mass > 0.0f ? mx * inv : 0.5f * (node.minX + node.maxX);
+	node.comY = mass > 0.0f ? my * inv : 0.5f * (node.minY + node.maxY);
+	node.comZ = mass > 0.0f ? mz * inv : 0.5f * (node.minZ + node.maxZ);
+	node.size = std::max({node.maxX - node.minX, node.maxY - node.minY, node.maxZ - node.minZ});
+}
+
+void Octree::computeInternalMoments(const std::vector<OctreeNode> &nodes, OctreeNode &node)
+{
+	node.minX = node.minY = node.minZ = std::numeric_limits<float>::max();
+	node.maxX = node.maxY = node.maxZ = std::numeric_limits<float>::lowest();
+	float mass = 0.0f, mx = 0.0f, my = 0.0f, mz = 0.0f;
+
+	for (auto c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+	{
+		const auto &child = nodes[c];
+		node.minX = std::min(node.minX, child.minX);
+		node.minY = std::min(node.minY, child.minY);
+		node.minZ = std::min(node.minZ, child.minZ);
+		node.maxX = std::max(node.maxX, child.maxX);
+		node.maxY = std::max(node.maxY, child.maxY);
+		node.maxZ = std::max(node.maxZ, child.maxZ);
+		mass += child.mass;
+		mx += child.mass * child.comX;
+		my += child.mass * child.comY;
+		mz += child.mass * child.comZ;
+	}
+
+	node.mass = mass;
+	auto inv = mass > 0.0f ? 1.0f / mass : 0.0f;
+	node.comX = mass > 0.0f ? mx * inv : 0.5f * (node.minX + node.maxX);
+	node.comY = mass > 0.0f ? my * inv : 0.5f * (node.minY + node.maxY);
+	node.comZ = mass > 0.0f ? mz * inv : 0.5f * (node.minZ + node.maxZ);
+	node.size = std::max({node.maxX - node.minX, node.maxY - node.minY, node.maxZ - node.minZ});
+}
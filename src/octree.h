@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "aligned_buffer.h"
+#include "morton_order.h"
+
+class ParticleStore;
+class ThreadPool;
+
+struct OctreeNode
+{
+	float minX, minY, minZ;
+	float maxX, maxY, maxZ;
+	float comX, comY, comZ;
+	float mass;
+	// Largest extent of the bounding box, the "s" of the s/d < theta criterion
+	float size;
+	uint32_t firstBody;
+	uint32_t bodyCount;
+	uint32_t firstChild;
+	uint32_t childCount;
+
+	bool isLeaf() const
+	{
+		return childCount == 0;
+	}
+
+	bool contains(const float px, const float py, const float pz) const
+	{
+		return px >= minX && px <= maxX && py >= minY && py <= maxY && pz >= minZ && pz <= maxZ;
+	}
+};
+
+struct OctreeStats
+{
+	uint64_t builds = 0;
+	uint64_t refits = 0;
+};
+
+// Morton-ordered octree in a flat node pool. Children of a node are stored
+// contiguously and bodies are copied into tree order so every leaf covers a
+// contiguous range of the x/y/z/mass arrays below. Node 0 is the root.
+class Octree
+{
+public:
+	static constexpr uint32_t MORTON_BITS = MORTON_KEY_BITS;
+	static constexpr uint32_t MAX_DEPTH = MORTON_BITS;
+
+	explicit Octree(uint32_t leafCapacity = 16);
+
+	void build(const ParticleStore &particles, ThreadPool &pool);
+
+	// Keeps the structure of the last build and only recomputes bounds and
+	// moments, bottom-up, from the bodies' current positions. Bodies stay in
+	// their leaves however far they moved, so the result is still exact for
+	// every node's own bodies, but boxes grow and overlap their siblings and
+	// walks open more nodes. Returns false when the store no longer holds the
+	// same bodies in the same slots, e.g. after a MortonReorder; the tree has
+	// to be rebuilt before it is used again.
+	bool refit(const ParticleStore &particles, ThreadPool &pool);
+
+	// Refits while overlap() stays at or below maxOverlap and rebuilds
+	// otherwise; maxOverlap <= 0 rebuilds every time
+	void update(const ParticleStore &particles, ThreadPool &pool, float maxOverlap);
+
+	// Volume sibling boxes share, as a fraction of their total volume. Octants
+	// are disjoint, so it is 0 after a build; it grows as refitted boxes stretch
+	// over bodies that crossed into a neighbouring cell, and walks slow down with it.
+	float overlap() const
+	{
+		return m_overlap;
+	}
+
+	const OctreeStats &stats() const { return m_stats; }
+
+	const std::vector<OctreeNode> &nodes() const { return m_nodes; }
+
+	// Tree slot -> index in the particle store
+	const std::vector<uint32_t> &order() const { return m_order; }
+
+	const AlignedBuffer<float> &x() const { return m_x; }
+	const AlignedBuffer<float> &y() const { return m_y; }
+	const AlignedBuffer<float> &z() const { return m_z; }
+	const AlignedBuffer<float> &mass() const { return m_mass; }
+
+	size_t bodyCount() const { return m_order.size(); }
+
+	uint32_t leafCapacity() const { return m_leafCapacity; }
+
+private:
+	// A subtree whose construction was handed to a worker; it is spliced back at `node`
+	struct Subtree
+	{
+		uint32_t node;
+		uint32_t begin;
+		uint32_t end;
+		uint32_t depth;
+	};
+
+	void buildNode(std::vector<OctreeNode> &nodes, uint32_t nodeIndex, uint32_t begin, uint32_t end, uint32_t depth, std::vector<Subtree> *deferred) const;
+	void buildSubtrees(ThreadPool &pool);
+	void computeLeafMoments(OctreeNode &node) const;
+	static void computeInternalMoments(const std::vector<OctreeNode> &nodes, OctreeNode &node);
+
+	uint32_t m_leafCapacity;
+	std::vector<OctreeNode> m_nodes;
+	std::vector<MortonKey> m_keys;
+	std::vector<MortonKey> m_keyScratch;
+	std::vector<Subtree> m_deferred;
+	std::vector<std::vector<OctreeNode>> m_subtreeNodes;
+	uint32_t m_subtreeCutoff = 0;
+	std::vector<uint32_t> m_order;
+	// ParticleStore::id of every slot at the last build, to detect moved bodies
+	std::vector<uint32_t> m_ids;
+	AlignedBuffer<float> m_x, m_y, m_z, m_mass;
+	float m_overlap = 0.0f;
+	OctreeStats m_stats;
+};
@@ -0,0 +1,394 @@
+#include "options.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+
+#include "barnes_hut.h"
+#include "direct_sum.h"
+#include "fmm.h"
+#include "particle_mesh.h"
+
+namespace
+{
+	template <typename T>
+	T parseNumber(const std::string &flag, const std::string &text)
+	{
+		// Streams accept "-1" for unsigned types and wrap it around to the maximum
+		const auto negative = std::is_unsigned_v<T> && text.find('-') != std::string::npos;
+
+		std::istringstream stream(text);
+		T value;
+		if (negative || !(stream >> value) || !stream.eof())
+		{
+			throw std::invalid_argument("invalid value for " + flag + ": " + text);
+		}
+		return value;
+	}
+
+	SolverKind parseSolver(const std::string &text)
+	{
+		if (text == "direct")
+		{
+			return SolverKind::Direct;
+		}
+		if (text == "barnes-hut")
+		{
+			return SolverKind::BarnesHut;
+		}
+		if (text == "fmm")
+		{
+			return SolverKind::Fmm;
+		}
+		if (text == "pm")
+		{
+			return SolverKind::ParticleMesh;
+		}
+		if (text == "treepm")
+		{
+			return SolverKind::TreePm;
+		}
+		throw std::invalid_argument("unknown solver: " + text);
+	}
+
+	IntegratorKind parseIntegrator(const std::string &text)
+	{
+		for (const auto kind : { IntegratorKind::Leapfrog, IntegratorKind::VelocityVerlet, IntegratorKind::Yoshida4, IntegratorKind::Rk4 })
+		{
+			if (text == integratorName(kind))
+			{
+				return kind;
+			}
+		}
+		throw std::invalid_argument("unknown integrator: " + text);
+	}
+
+	ForceLaw parseForceLaw(const std::string &text)
+	{
+		for (const auto law : { ForceLaw::Plummer, ForceLaw::Spline })
+		{
+			if (text == forceLawName(law))
+			{
+				return law;
+			}
+		}
+		throw std::invalid_argument("unknown force law: " + text);
+	}
+
+	TrajectoryCompression parseCompression(const std::string &text)
+	{
+		if (text == "none")
+		{
+			return TrajectoryCompression::None;
+		}
+		if (text == "xor")
+		{
+			return TrajectoryCompression::XorDelta;
+		}
+		throw std::invalid_argument("unknown trajectory compression: " + text);
+	}
+
+	ProfileFormat parseProfileFormat(const std::string &text)
+	{
+		if (text == "csv")
+		{
+			return ProfileFormat::Csv;
+		}
+		if (text == "json")
+		{
+			return ProfileFormat::Json;
+		}
+		if (text == "chrome")
+		{
+			return ProfileFormat::ChromeTrace;
+		}
+		throw std::invalid_argument("unknown profile format: " + text);
+	}
+}
+
+Options parseOptions(const int argc, const char *const *argv)
+{
+	Options options;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string flag = argv[i];
+
+		auto value = [&]() -> std::string
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::invalid_argument("missing value for " + flag);
+			}
+			return argv[++i];
+		};
+
+		if (flag == "--help" || flag == "-h")
+		{
+			options.showHelp = true;
+		}
+		else if (flag == "--bodies")
+		{
+			options.bodyCount = parseNumber<size_t>(flag, value());
+		}
+		else if (flag == "--seed")
+		{
+			options.seed = parseNumber<uint32_t>(flag, value());
+		}
+		else if (flag == "--dt")
+		{
+			options.timeStep = parseNumber<float>(flag, value());
+		}
+		else if (flag == "--softening")
+		{
+			options.gravity.softening = parseNumber<float>(flag, value());
+		}
+		else if (flag == "--solver")
+		{
+			options.solver = parseSolver(value());
+		}
+		else if (flag == "--dimensions")
+		{
+			options.step.dimensions = parseNumber<uint32_t>(flag, value());
+			if (options.step.dimensions != 2 && options.step.dimensions != 3)
+			{
+				throw std::invalid_argument("--dimensions must be 2 or 3");
+			}
+		}
+		else if (flag == "--integrator")
+		{
+			options.step.integrator = parseIntegrator(value());
+		}
+		else if (flag == "--force-law")
+		{
+			options.step.forceLaw = parseForceLaw(value());
+		}
+		else if (flag == "--block-levels")
+		{
+			options.blockLevels = parseNumber<uint32_t>(flag, value());
+		}
+		else if (flag == "--eta")
+		{
+			options.timestepAccuracy = parseNumber<float>(flag, value());
+		}
+		else if (flag == "--double")
+		{
+			options.doublePrecision = true;
+		}
+		else if (flag == "--reorder-every")
+		{
+			options.reorderInterval = parseNumber<uint64_t>(flag, value());
+		}
+		else if (flag == "--theta")
+		{
+			options.openingAngle = parseNumber<float>(flag, value());
+		}
+		else if (flag == "--refit")
+		{
+			options.maxTreeOverlap = parseNumber<float>(flag, value());
+		}
+		else if (flag == "--leaf-size")
+		{
+			options.leafCapacity = parseNumber<uint32_t>(flag, value());
+		}
+		else if (flag == "--gpu")
+		{
+			options.gpuIntegrator = true;
+		}
+		else if (flag == "--sprites")
+		{
+			options.sprites = true;
+		}
+		else if (flag == "--step-rate")
+		{
+			options.stepRate = parseNumber<double>(flag, value());
+		}
+		else if (flag == "--headless")
+		{
+			options.headless = true;
+		}
+		else if (flag == "--steps")
+		{
+			options.steps = parseNumber<uint64_t>(flag, value());
+		}
+		else if (flag == "--load")
+		{
+			options.loadPath = value();
+		}
+		else if (flag == "--no-verify")
+		{
+			options.loadVerify = SnapshotVerify::Header;
+		}
+		else if (flag == "--save")
+		{
+			options.savePath = value();
+		}
+		else if (flag == "--checkpoint")
+		{
+			options.checkpointInterval = parseNumber<uint64_t>(flag, value());
+		}
+		else if (flag == "--trajectory")
+		{
+			options.trajectoryPath = value();
+		}
+		else if (flag == "--capture-every")
+		{
+			options.trajectoryInterval = parseNumber<uint64_t>(flag, value());
+		}
+		else if (flag == "--compression")
+		{
+			options.trajectoryCompression = parseCompression(value());
+		}
+		else if (flag == "--profile")
+		{
+			options.profilePath = value();
+		}
+		else if (flag == "--profile-format")
+		{
+			options.profileFormat = parseProfileFormat(value());
+		}
+		else if (flag == "--threads")
+		{
+			options.threadCount = parseNumber<size_t>(flag, value());
+		}
+		else if (flag == "--fmm-order")
+		{
+			options.expansionOrder = parseNumber<uint32_t>(flag, value());
+		}
+		else if (flag == "--box")
+		{
+			options.boxSize = parseNumber<float>(flag, value());
+		}
+		else if (flag == "--mesh")
+		{
+			options.meshSize = parseNumber<uint32_t>(flag, value());
+		}
+		else if (flag == "--split")
+		{
+			options.splitScale = parseNumber<float>(flag, value());
+		}
+		else
+		{
+			throw std::invalid_argument("unknown option: " + flag);
+		}
+	}
+
+	// Bodies integrated on the GPU are never read back
+	if (options.gpuIntegrator && (!options.savePath.empty() || !options.trajectoryPath.empty() || options.blockLevels > 0 || options.doublePrecision))
+	{
+		throw std::invalid_argument("--save, --trajectory, --block-levels and --double are not supported with --gpu");
+	}
+
+	const auto defaultStep = options.step.dimensions == 3 && options.step.integrator == IntegratorKind::Leapfrog && options.step.forceLaw == ForceLaw::Plummer;
+	if (!defaultStep && (options.gpuIntegrator || options.blockLevels > 0))
+	{
+		throw std::invalid_argument("--dimensions, --integrator and --force-law are not supported with --gpu or --block-levels");
+	}
+	// Only 3D Plummer forces come from the solver, everything else sums directly
+	if ((options.step.dimensions == 2 || options.step.forceLaw == ForceLaw::Spline) && options.solver != SolverKind::Direct)
+	{
+		throw std::invalid_argument("--dimensions 2 and --force-law spline require --solver direct");
+	}
+
+	// Other solvers evaluate every body on each substep, which costs more than a global step
+	if (options.blockLevels > 0 && options.solver != SolverKind::Direct && options.solver != SolverKind::BarnesHut)
+	{
+		throw std::invalid_argument("--block-levels requires --solver direct or barnes-hut");
+	}
+
+	if (options.checkpointInterval > 0 && options.savePath.empty())
+	{
+		throw std::invalid_argument("--checkpoint requires --save");
+	}
+
+	// The direct kernels include each body's own term, which is only 0 with eps > 0
+	if (!(options.gravity.softening > 0.0f))
+	{
+		throw std::invalid_argument("--softening must be positive");
+	}
+	if (!(options.timeStep > 0.0f))
+	{
+		throw std::invalid_argument("--dt must be positive");
+	}
+
+	if (options.steps == 0)
+	{
+		throw std::invalid_argument("--steps must be at least 1");
+	}
+
+	if (!(options.maxTreeOverlap >= 0.0f && options.maxTreeOverlap < 1.0f))
+	{
+		throw std::invalid_argument("--refit must be in [0, 1)");
+	}
+	if (options.solver == SolverKind::TreePm && !(options.splitScale > 0.0f))
+	{
+		throw std::invalid_argument("--split must be positive with --solver treepm");
+	}
+
+	return options;
+}
+
+std::string usage(const char *program)
+{
+	return std::string("usage: ") + program + " [options]\n"
+		"  --bodies N          number of bodies (default 4096)\n"
+		"  --seed N            initial conditions seed\n"
+		"  --dt X              time step\n"
+		"  --softening X       Plummer softening length\n"
+		"  --solver NAME       direct | barnes-hut | fmm | pm | treepm (pm: periodic box)\n"
+		"  --dimensions D      2 (bodies stay in the xy plane) or 3 (default)\n"
+		"  --integrator NAME   leapfrog | verlet | yoshida4 | rk4 (default leapfrog)\n"
+		"  --force-law NAME    softening kernel: plummer | spline (default plummer)\n"
+		"  --block-levels L    block timesteps down to dt / 2^L per body (default 0: global step; direct and barnes-hut only)\n"
+		"  --eta X             block timestep accuracy parameter (default 0.2)\n"
+		"  --double            integrate positions and velocities in double, forces stay float\n"
+		"  --reorder-every N   sort bodies along the Morton curve every N steps (default 256, 0: never)\n"
+		"  --theta X           tree opening angle (default 0.5)\n"
+		"  --refit X           refit the barnes-hut tree between rebuilds until sibling boxes overlap by X (e.g. 0.02, default 0: off)\n"
+		"  --leaf-size N       bodies per tree leaf (default 16)\n"
+		"  --fmm-order P       FMM expansion order (default 4)\n"
+		"  --box L             side of the periodic pm/treepm box centered on the origin (default 4)\n"
+		"  --mesh N            pm/treepm cells per side, a power of two (default 64)\n"
+		"  --split RS          treepm long/short-range split scale in cells (default 1.25)\n"
+		"  --threads N         worker threads including the main one (default: all cores)\n"
+		"  --gpu               integrate on the GPU with a compute shader (direct sum)\n"
+		"  --sprites           draw each body as an instanced round sprite with quantized positions\n"
+		"  --step-rate HZ      cap simulation steps per second while rendering (default: unlimited)\n"
+		"  --headless          no window: run --steps steps as fast as possible and report throughput\n"
+		"  --steps N           steps to run in headless mode, at least 1 (default 1000)\n"
+		"  --load FILE         start from a snapshot instead of the generated disk (ignores --bodies)\n"
+		"  --no-verify         check only the --load header checksum; sections stay mapped until used\n"
+		"  --save FILE         write a restart snapshot on exit\n"
+		"  --checkpoint N      also write the --save snapshot every N steps\n"
+		"  --trajectory FILE   stream positions and velocities to FILE from a background thread\n"
+		"  --capture-every K   trajectory frame every K steps (default 10)\n"
+		"  --compression C     trajectory compression: none | xor (default xor)\n"
+		"  --profile FILE      write CPU frame phases and GPU pass timings to FILE\n"
+		"  --profile-format F  csv | json | chrome (trace viewer), default csv\n";
+}
+
+std::unique_ptr<ForceSolver> createForceSolver(const Options &options)
+{
+	switch (options.solver)
+	{
+	case SolverKind::Direct:
+		return std::make_unique<DirectSumSolver>(options.gravity);
+	case SolverKind::BarnesHut:
+		return std::make_unique<BarnesHutSolver>(options.gravity, options.openingAngle, options.leafCapacity, options.maxTreeOverlap);
+	case SolverKind::Fmm:
+		return std::make_unique<FmmSolver>(options.gravity, options.expansionOrder, options.openingAngle, options.leafCapacity);
+	case SolverKind::ParticleMesh:
+	case SolverKind::TreePm:
+	{
+		ParticleMeshParams mesh;
+		mesh.boxSize = options.boxSize;
+		mesh.meshSize = options.meshSize;
+		mesh.splitScale = options.solver == SolverKind::TreePm ? options.splitScale : 0.0f;
+		mesh.openingAngle = options.openingAngle;
+		mesh.leafCapacity = options.leafCapacity;
+		return std::make_unique<ParticleMeshSolver>(options.gravity, mesh);
+	}
+	}
+
+	throw std::invalid_argument("unsupported solver");
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "force_solver.h"
+#include "profiler.h"
+#include "snapshot.h"
+#include "step_pipeline.h"
+#include "trajectory.h"
+
+enum class SolverKind
+{
+	Direct,
+	BarnesHut,
+	Fmm,
+	ParticleMesh,
+	TreePm
+};
+
+struct Options
+{
+	size_t bodyCount = 4096;
+	uint32_t seed = 1;
+	float timeStep = 0.001f;
+	GravityParams gravity;
+	SolverKind solver = SolverKind::Direct;
+	StepConfig step;
+	uint32_t blockLevels = 0;
+	float timestepAccuracy = 0.2f;
+	bool doublePrecision = false;
+	uint64_t reorderInterval = 256;
+	float openingAngle = 0.5f;
+	float maxTreeOverlap = 0.0f;
+	uint32_t leafCapacity = 16;
+	uint32_t expansionOrder = 4;
+	float boxSize = 4.0f;
+	uint32_t meshSize = 64;
+	float splitScale = 1.25f;
+	size_t threadCount = 0;
+	bool gpuIntegrator = false;
+	bool sprites = false;
+	double stepRate = 0.0;
+	bool headless = false;
+	uint64_t steps = 1000;
+	std::string loadPath;
+	SnapshotVerify loadVerify = SnapshotVerify::Full;
+	std::string savePath;
+	uint64_t checkpointInterval = 0;
+	std::string trajectoryPath;
+	uint64_t trajectoryInterval = 10;
+	TrajectoryCompression trajectoryCompression = TrajectoryCompression::XorDelta;
+	std::string profilePath;
+	ProfileFormat profileFormat = ProfileFormat::Csv;
+	bool showHelp = false;
+};
+
+// Throws std::invalid_argument on unknown flags or malformed values.
+Options parseOptions(int argc, const char *const *argv);
+
+std::string usage(const char *program);
+
+std::unique_ptr<ForceSolver> createForceSolver(const Options &options);
@@ -0,0 +1,616 @@
+#include "particle_mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "thread_pool.h"
+
+namespace
+{
+	using Complex = std::complex<float>;
+
+	constexpr size_t BODY_GRAIN = 4096;
+	// Short-range walks vary in cost like Barnes-Hut walks
+	constexpr size_t WALK_GRAIN = 256;
+	constexpr double PI = 3.14159265358979323846;
+	// Samples of the short-range force factor between 0 and the cutoff
+	constexpr size_t SHORT_RANGE_TABLE = 1024;
+
+	// In-place radix-2 FFT of n points, unnormalized. twiddles[k * stride] is exp(-2 pi i k / n) for k < n / 2.
+	void fft(Complex *data, const size_t n, const Complex *twiddles, const size_t stride, const bool inverse)
+	{
+		for (size_t i = 1, j = 0; i < n; ++i)
+		{
+			auto bit = n >> 1;
+			for (; j & bit; bit >>= 1)
+			{
+				j ^= bit;
+			}
+			j ^= bit;
+			if (i < j)
+			{
+				std::swap(data[i], data[j]);
+			}
+		}
+
+		for (size_t length = 2; length <= n; length <<= 1)
+		{
+			const auto half = length / 2;
+			const auto step = n / length * stride;
+			for (size_t begin = 0; begin < n; begin += length)
+			{
+				for (size_t k = 0; k < half; ++k)
+				{
+					const auto w = inverse ? std::conj(twiddles[k * step]) : twiddles[k * step];
+					const auto u = data[begin + k];
+					const auto v = data[begin + k + half] * w;
+					data[begin + k] = u + v;
+					data[begin + k + half] = u - v;
+				}
+			}
+		}
+	}
+
+	// Spectrum out[0..n/2] of n real samples through one complex FFT of n / 2
+	// points: even samples go to the real part, odd ones to the imaginary part,
+	// and the two interleaved spectra are separated afterwards.
+	void realForward(const float *in, Complex *out, const size_t n, const Complex *twiddles)
+	{
+		const auto half = n / 2;
+		for (size_t j = 0; j < half; ++j)
+		{
+			out[j] = Complex(in[2 * j], in[2 * j + 1]);
+		}
+		fft(out, half, twiddles, 2, false);
+
+		const auto z0 = out[0];
+		out[0] = Complex(z0.real() + z0.imag(), 0.0f);
+		out[half] = Complex(z0.real() - z0.imag(), 0.0f);
+		const Complex minusHalfI(0.0f, -0.5f);
+		for (size_t k = 1; k <= half / 2; ++k)
+		{
+			const auto a = out[k];
+			const auto b = out[half - k];
+			out[k] = 0.5f * (a + std::conj(b)) + twiddles[k] * (a - std::conj(b)) * minusHalfI;
+			out[half - k] = 0.5f * (b + std::conj(a)) + twiddles[half - k] * (b - std::conj(a)) * minusHalfI;
+		}
+	}
+
+	// Inverse of realForward, scaled by n; clobbers in
+	void realInverse(Complex *in, float *out, const size_t n, const Complex *twiddles)
+	{
+		const auto half = n / 2;
+		const Complex i(0.0f, 1.0f);
+		// Even and odd spectra recombined into one of n / 2 points; in[half] is only read
+		for (size_t k = 0; k <= half / 2; ++k)
+		{
+			const auto a = in[k];
+			const auto b = in[half - k];
+			in[k] = (a + std::conj(b)) + i * ((a - std::conj(b)) * std::conj(twiddles[k]));
+			if (k != 0)
+			{
+				in[half - k] = (b + std::conj(a)) + i * ((b - std::conj(a)) * std::conj(twiddles[half - k]));
+			}
+		}
+		fft(in, half, twiddles, 2, true);
+
+		for (size_t j = 0; j < half; ++j)
+		{
+			out[2 * j] = in[j].real();
+			out[2 * j + 1] = in[j].imag();
+		}
+	}
+
+	// FFTs down every column of a rows x columns block whose rows are rowStride
+	// apart. Columns are transposed into scratch so each transform runs on
+	// contiguous data, and the rows themselves are read and written whole.
+	void transformColumns(Complex *block, const size_t rowStride, const size_t rows, const size_t columns, Complex *scratch, const Complex *twiddles, const bool inverse)
+	{
+		for (size_t r = 0; r < rows; ++r)
+		{
+			for (size_t c = 0; c < columns; ++c)
+			{
+				scratch[c * rows + r] = block[r * rowStride + c];
+			}
+		}
+		for (size_t c = 0; c < columns; ++c)
+		{
+			fft(scratch + c * rows, rows, twiddles, 1, inverse);
+		}
+		for (size_t r = 0; r < rows; ++r)
+		{
+			for (size_t c = 0; c < columns; ++c)
+			{
+				block[r * rowStride + c] = scratch[c * rows + r];
+			}
+		}
+	}
+
+	// Lower cell and weight of the upper one for CIC, with cell centers at (i + 0.5) h
+	inline void cicCell(const float u, const int n, int &cell, float &weight)
+	{
+		const auto shifted = u - 0.5f;
+		const auto lower = std::floor(shifted);
+		weight = shifted - lower;
+		cell = static_cast<int>(lower);
+		cell = cell < 0 ? cell + n : (cell >= n ? cell - n : cell);
+	}
+
+	// sin(x) / x
+	double sinc(const double x)
+	{
+		return x == 0.0 ? 1.0 : std::sin(x) / x;
+	}
+}
+
+ParticleMeshSolver::ParticleMeshSolver(const GravityParams &params, const ParticleMeshParams &mesh)
+	: ForceSolver(params), m_mesh(mesh), m_tree(mesh.leafCapacity)
+{
+	const auto n = static_cast<size_t>(m_mesh.meshSize);
+	if (n < 8 || (n & (n - 1)) != 0)
+	{
+		throw std::invalid_argument("particle mesh size must be a power of two of at least 8");
+	}
+	if (!(m_mesh.boxSize > 0.0f))
+	{
+		throw std::invalid_argument("periodic box size must be positive");
+	}
+	const auto cell = m_mesh.boxSize / static_cast<float>(n);
+	if (m_mesh.splitScale > 0.0f && m_mesh.cutoff * m_mesh.splitScale * cell >= 0.5f * m_mesh.boxSize)
+	{
+		throw std::invalid_argument("TreePM short-range cutoff must stay below half the box");
+	}
+
+	m_twiddles.resize(n / 2);
+	for (size_t k = 0; k < n / 2; ++k)
+	{
+		m_twiddles[k] = Complex(std::polar(1.0, -2.0 * PI * static_cast<double>(k) / static_cast<double>(n)));
+	}
+
+	m_density.resize(n * n * n);
+	m_forceX.resize(n * n * n);
+	m_forceY.resize(n * n * n);
+	m_forceZ.resize(n * n * n);
+
+	// phi_k = -4 pi G rho_k / k^2, with rho = mass / h^3 per cell, the split
+	// filter, CIC deconvolution for assignment and interpolation (TreePM only),
+	// and the 1 / n^3 of the unnormalized inverse transform folded in
+	const auto columns = n / 2 + 1;
+	m_spectrum.resize(n * n * columns);
+	m_greens.resize(n * n * columns);
+	const double box = m_mesh.boxSize;
+	const double h = box / static_cast<double>(n);
+	const double rs = m_mesh.splitScale * h;
+	const double scale = -4.0 * PI * m_params.gravitationalConstant / (h * h * h) / static_cast<double>(n * n * n);
+	auto wave = [n](const size_t index)
+	{
+		return static_cast<double>(index <= n / 2 ? static_cast<long long>(index) : static_cast<long long>(index) - static_cast<long long>(n));
+	};
+	for (size_t ix = 0; ix < n; ++ix)
+	{
+		for (size_t iy = 0; iy < n; ++iy)
+		{
+			for (size_t iz = 0; iz < columns; ++iz)
+			{
+				const double mode[3] = { wave(ix), wave(iy), wave(iz) };
+				double k2 = 0.0, window = 1.0;
+				for (const auto m : mode)
+				{
+					const auto k = 2.0 * PI * m / box;
+					k2 += k * k;
+					const auto w = sinc(PI * m / static_cast<double>(n));
+					window *= w * w;
+				}
+
+				// Deconvolving both CIC passes only pays off under the split filter, which
+				// removes the modes near Nyquist where the window is small. Unfiltered, it
+				// amplifies them and the force rings along the mesh axes, so pure PM keeps
+				// the window as its smoothing.
+				const auto deconvolution = rs > 0.0 ? window * window : 1.0;
+				auto &greens = m_greens[(ix * n + iy) * columns + iz];
+				greens = k2 > 0.0 ? static_cast<float>(scale / k2 * std::exp(-k2 * rs * rs) / deconvolution) : 0.0f;
+			}
+		}
+	}
+
+	// The complement of the mesh filter in real space:
+	// erfc(r / 2rs) + r / (rs sqrt(pi)) exp(-r^2 / 4rs^2) times the Newtonian force
+	if (rs > 0.0)
+	{
+		const auto cutoff = m_mesh.cutoff * rs;
+		m_shortRange.resize(SHORT_RANGE_TABLE);
+		for (size_t k = 0; k < SHORT_RANGE_TABLE; ++k)
+		{
+			const auto r = cutoff * static_cast<double>(k) / static_cast<double>(SHORT_RANGE_TABLE - 1);
+			m_shortRange[k] = static_cast<float>(std::erfc(r / (2.0 * rs)) + r / (rs * std::sqrt(PI)) * std::exp(-r * r / (4.0 * rs * rs)));
+		}
+	}
+}
+
+void ParticleMeshSolver::computeAccelerations(ParticleStore &particles, ThreadPool &pool)
+{
+	wrapBodies(particles, pool);
+	assignMass(pool);
+	solvePotential(pool);
+	differentiate(pool);
+	interpolate(particles, pool);
+	if (m_mesh.splitScale > 0.0f)
+	{
+		m_tree.build(m_wrapped, pool);
+		addShortRange(particles, pool);
+	}
+}
+
+void ParticleMeshSolver::wrapBodies(const ParticleStore &particles, ThreadPool &pool)
+{
+	const auto count = particles.size();
+	const auto box = m_mesh.boxSize;
+	const auto invBox = 1.0f / box;
+	const auto halfBox = 0.5f * box;
+
+	if (m_wrapped.size() != count)
+	{
+		m_wrapped = ParticleStore(count);
+	}
+
+	pool.parallelFor(0, count, BODY_GRAIN, [&](const size_t first, const size_t last)
+	{
+		auto wrap = [box, invBox, halfBox](const float v)
+		{
+			const auto u = v + halfBox;
+			const auto wrapped = u - box * std::floor(u * invBox);
+			// Rounding can land exactly on the upper face
+			return wrapped < box ? wrapped : 0.0f;
+		};
+
+		for (auto i = first; i < last; ++i)
+		{
+			m_wrapped.x[i] = wrap(particles.x[i]);
+			m_wrapped.y[i] = wrap(particles.y[i]);
+			m_wrapped.z[i] = wrap(particles.z[i]);
+			m_wrapped.mass[i] = particles.mass[i];
+			m_wrapped.id[i] = particles.id[i];
+		}
+	});
+}
+
+void ParticleMeshSolver::assignMass(ThreadPool &pool)
+{
+	const auto n = static_cast<int>(m_mesh.meshSize);
+	const auto cells = static_cast<size_t>(n);
+	const auto count = m_wrapped.size();
+	const auto invCell = static_cast<float>(n) / m_mesh.boxSize;
+
+	// Bodies sorted by the lower x plane they write
+	m_slabKeys.resize(count);
+	pool.parallelFor(0, count, BODY_GRAIN, [&](const size_t first, const size_t last)
+	{
+		for (auto i = first; i < last; ++i)
+		{
+			int cell;
+			float weight;
+			cicCell(m_wrapped.x[i] * invCell, n, cell, weight);
+			m_slabKeys[i] = { static_cast<uint64_t>(cell), static_cast<uint32_t>(i) };
+		}
+	});
+	sortMortonKeys(m_slabKeys, m_slabScratch, pool);
+
+	m_slabStart.assign(cells + 1, static_cast<uint32_t>(count));
+	for (size_t k = count; k-- > 0;)
+	{
+		m_slabStart[m_slabKeys[k].key] = static_cast<uint32_t>(k);
+	}
+	for (size_t s = cells; s-- > 0;)
+	{
+		m_slabStart[s] = std::min(m_slabStart[s], m_slabStart[s + 1]);
+	}
+
+	std::fill(m_density.begin(), m_density.end(), 0.0f);
+
+	// A slab writes its own plane and the next one, so even slabs never collide
+	// with each other, and neither do odd ones
+	for (size_t parity = 0; parity < 2; ++parity)
+	{
+		pool.parallelFor(0, cells / 2, 1, [&](const size_t first, const size_t last)
+		{
+			float *density = m_density.data();
+			for (auto pair = first; pair < last; ++pair)
+			{
+				const auto slab = 2 * pair + parity;
+				for (auto k = m_slabStart[slab]; k < m_slabStart[slab + 1]; ++k)
+				{
+					const auto i = m_slabKeys[k].index;
+					int cx, cy, cz;
+					float tx, ty, tz;
+					cicCell(m_wrapped.x[i] * invCell, n, cx, tx);
+					cicCell(m_wrapped.y[i] * invCell, n, cy, ty);
+					cicCell(m_wrapped.z[i] * invCell, n, cz, tz);
+					const int xs[2] = { cx, cx + 1 == n ? 0 : cx + 1 };
+					const int ys[2] = { cy, cy + 1 == n ? 0 : cy + 1 };
+					const int zs[2] = { cz, cz + 1 == n ? 0 : cz + 1 };
+					const float wx[2] = { 1.0f - tx, tx };
+					const float wy[2] = { 1.0f - ty, ty };
+					const float wz[2] = { 1.0f - tz, tz };
+					const auto m = m_wrapped.mass[i];
+
+					for (int a = 0; a < 2; ++a)
+					{
+						for (int b = 0; b < 2; ++b)
+						{
+							auto *row = density + (static_cast<size_t>(xs[a]) * cells + static_cast<size_t>(ys[b])) * cells;
+							const auto w = m * wx[a] * wy[b];
+							row[zs[0]] += w * wz[0];
+							row[zs[1]] += w * wz[1];
+						}
+					}
+				}
+			}
+		});
+	}
+}
+
+void ParticleMeshSolver::solvePotential(ThreadPool &pool)
+{
+	const auto n = static_cast<size_t>(m_mesh.meshSize);
+	const auto columns = n / 2 + 1;
+	const auto *twiddles = m_twiddles.data();
+	float *mesh = m_density.data();
+	Complex *spectrum = m_spectrum.data();
+
+	// z: real-to-complex along the contiguous axis
+	pool.parallelFor(0, n * n, 64, [=](const size_t first, const size_t last)
+	{
+		for (auto line = first; line < last; ++line)
+		{
+			realForward(mesh + line * n, spectrum + line * columns, n, twiddles);
+		}
+	});
+
+	// y within every x plane, then x for every y; both leave the other axes alone
+	auto transformAxes = [&](const bool inverse)
+	{
+		for (const bool alongY : { !inverse, inverse })
+		{
+			pool.parallelFor(0, n, 1, [&](const size_t first, const size_t last)
+			{
+				std::vector<Complex> scratch(n * columns);
+				for (auto plane = first; plane < last; ++plane)
+				{
+					if (alongY)
+					{
+						transformColumns(spectrum + plane * n * columns, columns, n, columns, scratch.data(), twiddles, inverse);
+					}
+					else
+					{
+						transformColumns(spectrum + plane * columns, n * columns, n, columns, scratch.data(), twiddles, inverse);
+					}
+				}
+			});
+		}
+	};
+
+	transformAxes(false);
+
+	const float *greens = m_greens.data();
+	pool.parallelFor(0, n * n * columns, 16384, [=](const size_t first, const size_t last)
+	{
+		for (auto k = first; k < last; ++k)
+		{
+			spectrum[k] *= greens[k];
+		}
+	});
+
+	transformAxes(true);
+
+	// The potential replaces the density
+	pool.parallelFor(0, n * n, 64, [=](const size_t first, const size_t last)
+	{
+		for (auto line = first; line < last; ++line)
+		{
+			realInverse(spectrum + line * columns, mesh + line * n, n, twiddles);
+		}
+	});
+}
+
+void ParticleMeshSolver::differentiate(ThreadPool &pool)
+{
+	const auto n = static_cast<size_t>(m_mesh.meshSize);
+	const auto invCell = static_cast<float>(n) / m_mesh.boxSize;
+
+	// a = -grad phi with the fourth-order central difference
+	// (8 (phi[i+1] - phi[i-1]) - (phi[i+2] - phi[i-2])) / 12h
+	pool.parallelFor(0, n, 1, [&](const size_t first, const size_t last)
+	{
+		const float *phi = m_density.data();
+		auto at = [n, phi](const size_t x, const size_t y, const size_t z)
+		{
+			return phi[(x * n + y) * n + z];
+		};
+		// Periodic neighbour `by` cells up; n - by is the same distance down
+		auto up = [n](const size_t i, const size_t by)
+		{
+			return (i + by) & (n - 1);
+		};
+		const auto c = -invCell / 12.0f;
+
+		for (auto x = first; x < last; ++x)
+		{
+			for (size_t y = 0; y < n; ++y)
+			{
+				for (size_t z = 0; z < n; ++z)
+				{
+					const auto k = (x * n + y) * n + z;
+					m_forceX[k] = c * (8.0f * (at(up(x, 1), y, z) - at(up(x, n - 1), y, z)) - (at(up(x, 2), y, z) - at(up(x, n - 2), y, z)));
+					m_forceY[k] = c * (8.0f * (at(x, up(y, 1), z) - at(x, up(y, n - 1), z)) - (at(x, up(y, 2), z) - at(x, up(y, n - 2), z)));
+					m_forceZ[k] = c * (8.0f * (at(x, y, up(z, 1)) - at(x, y, up(z, n - 1))) - (at(x, y, up(z, 2)) - at(x, y, up(z, n - 2))));
+				}
+			}
+		}
+	});
+}
+
+void ParticleMeshSolver::interpolate(ParticleStore &particles, ThreadPool &pool) const
+{
+	const auto n = static_cast<int>(m_mesh.meshSize);
+	const auto cells = static_cast<size_t>(n);
+	const auto invCell = static_cast<float>(n) / m_mesh.boxSize;
+
+	pool.parallelFor(0, particles.size(), BODY_GRAIN, [&](const size_t first, const size_t last)
+	{
+		for (auto i = first; i < last; ++i)
+		{
+			int cx, cy, cz;
+			float tx, ty, tz;
+			cicCell(m_wrapped.x[i] * invCell, n, cx, tx);
+			cicCell(m_wrapped.y[i] * invCell, n, cy, ty);
+			cicCell(m_wrapped.z[i] * invCell, n, cz, tz);
+			const int xs[2] = { cx, cx + 1 == n ? 0 : cx + 1 };
+			const int ys[2] = { cy, cy + 1 == n ? 0 : cy + 1 };
+			const int zs[2] = { cz, cz + 1 == n ? 0 : cz + 1 };
+			const float wx[2] = { 1.0f - tx, tx };
+			const float wy[2] = { 1.0f - ty, ty };
+			const float wz[2] = { 1.0f - tz, tz };
+
+			float ax = 0.0f, ay = 0.0f, az = 0.0f;
+			for (int a = 0; a < 2; ++a)
+			{
+				for (int b = 0; b < 2; ++b)
+				{
+					for (int c = 0; c < 2; ++c)
+					{
+						const auto k = (static_cast<size_t>(xs[a]) * cells + static_cast<size_t>(ys[b])) * cells + static_cast<size_t>(zs[c]);
+						const auto w = wx[a] * wy[b] * wz[c];
+						ax += w * m_forceX[k];
+						ay += w * m_forceY[k];
+						az += w * m_forceZ[k];
+					}
+				}
+			}
+			particles.ax[i] = ax;
+			particles.ay[i] = ay;
+			particles.az[i] = az;
+		}
+	});
+}
+
+void ParticleMeshSolver::addShortRange(ParticleStore &particles, ThreadPool &pool) const
+{
+	constexpr size_t STACK_SIZE = 8 * Octree::MAX_DEPTH + 1;
+
+	const auto &nodes = m_tree.nodes();
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	const auto box = m_mesh.boxSize;
+	const auto invBox = 1.0f / box;
+	const auto cutoff = m_mesh.cutoff * m_mesh.splitScale * box / static_cast<float>(m_mesh.meshSize);
+	const auto cutoff2 = cutoff * cutoff;
+	const auto tableScale = static_cast<float>(SHORT_RANGE_TABLE - 1) / cutoff;
+	const auto eps2 = m_params.softening * m_params.softening;
+	const auto theta2 = m_mesh.openingAngle * m_mesh.openingAngle;
+	const auto G = m_params.gravitationalConstant;
+	const float *x = m_tree.x().data();
+	const float *y = m_tree.y().data();
+	const float *z = m_tree.z().data();
+	const float *m = m_tree.mass().data();
+	const float *table = m_shortRange.data();
+	const auto &order = m_tree.order();
+
+	// Displacement to the nearest periodic image
+	auto nearest = [box, invBox](const float d)
+	{
+		return d - box * std::floor(d * invBox + 0.5f);
+	};
+	auto factor = [tableScale, table](const float r)
+	{
+		const auto u = r * tableScale;
+		const auto k = static_cast<size_t>(u);
+		if (k >= SHORT_RANGE_TABLE - 1)
+		{
+			return 0.0f;
+		}
+		const auto t = u - static_cast<float>(k);
+		return table[k] + t * (table[k + 1] - table[k]);
+	};
+
+	pool.parallelFor(0, m_tree.bodyCount(), WALK_GRAIN, [&](const size_t first, const size_t last)
+	{
+		uint32_t stack[STACK_SIZE];
+		for (auto slot = first; slot < last; ++slot)
+		{
+			const auto px = x[slot], py = y[slot], pz = z[slot];
+			float ax = 0.0f, ay = 0.0f, az = 0.0f;
+
+			size_t top = 0;
+			stack[top++] = 0;
+			while (top > 0)
+			{
+				const auto &node = nodes[stack[--top]];
+
+				// Nodes whose nearest image lies beyond the cutoff contribute nothing
+				const auto cx = nearest(0.5f * (node.minX + node.maxX) - px);
+				const auto cy = nearest(0.5f * (node.minY + node.maxY) - py);
+				const auto cz = nearest(0.5f * (node.minZ + node.maxZ) - pz);
+				const auto hx = 0.5f * (node.maxX - node.minX);
+				const auto hy = 0.5f * (node.maxY - node.minY);
+				const auto hz = 0.5f * (node.maxZ - node.minZ);
+				const auto gx = std::max(0.0f, std::fabs(cx) - hx);
+				const auto gy = std::max(0.0f, std::fabs(cy) - hy);
+				const auto gz = std::max(0.0f, std::fabs(cz) - hz);
+				if (gx * gx + gy * gy + gz * gz > cutoff2)
+				{
+					continue;
+				}
+
+				const auto dx = nearest(node.comX - px);
+				const auto dy = nearest(node.comY - py);
+				const auto dz = nearest(node.comZ - pz);
+				const auto d2 = dx * dx + dy * dy + dz * dz;
+				const bool inside = gx == 0.0f && gy == 0.0f && gz == 0.0f;
+
+				if (node.size * node.size < theta2 * d2 && !inside)
+				{
+					const auto invR = 1.0f / std::sqrt(d2 + eps2);
+					const auto s = node.mass * factor(std::sqrt(d2)) * invR * invR * invR;
+					ax += dx * s;
+					ay += dy * s;
+					az += dz * s;
+				}
+				else if (node.isLeaf())
+				{
+					for (auto j = node.firstBody; j < node.firstBody + node.bodyCount; ++j)
+					{
+						const auto bx = nearest(x[j] - px);
+						const auto by = nearest(y[j] - py);
+						const auto bz = nearest(z[j] - pz);
+						const auto r2 = bx * bx + by * by + bz * bz;
+						if (r2 >= cutoff2)
+						{
+							continue;
+						}
+						const auto invR = 1.0f / std::sqrt(r2 + eps2);
+						const auto s = m[j] * factor(std::sqrt(r2)) * invR * invR * invR;
+						ax += bx * s;
+						ay += by * s;
+						az += bz * s;
+					}
+				}
+				else
+				{
+					for (auto c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+					{
+						stack[top++] = c;
+					}
+				}
+			}
+
+			const auto index = order[slot];
+			particles.ax[index] += G * ax;
+			particles.ay[index] += G * ay;
+			particles.az[index] += G * az;
+		}
+	});
+}
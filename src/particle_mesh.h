@@ -0,0 +1,84 @@
+#pragma once
+
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#include "aligned_buffer.h"
+#include "force_solver.h"
+#include "morton_order.h"
+#include "octree.h"
+#include "particle_store.h"
+
+struct ParticleMeshParams
+{
+	// Side of the periodic cube, centered on the origin
+	float boxSize = 4.0f;
+	// Cells per side, a power of two
+	uint32_t meshSize = 64;
+	// TreePM split scale in cells: the mesh only carries the force filtered by
+	// exp(-k^2 rs^2), and an octree walk adds the erfc-truncated remainder out to
+	// cutoff * rs. 0 runs the mesh alone, which is only within ~5% of Newtonian
+	// from four cells out.
+	float splitScale = 0.0f;
+	float cutoff = 4.5f;
+	// Opening angle of the short-range walk
+	float openingAngle = 0.5f;
+	uint32_t leafCapacity = 16;
+};
+
+// Periodic particle-mesh gravity: cloud-in-cell mass assignment, a 3D
+// real-to-complex FFT Poisson solve (with the CIC window deconvolved under a
+// TreePM split), a four-point finite-difference gradient and CIC
+// interpolation back to the bodies. Cost is O(N + M log M) for M cells. The mean density does not
+// attract, as in a cosmological box. Bodies outside the box act through their
+// periodic images; the store itself is never wrapped.
+//
+// Every stage runs on the pool: FFT lines are independent, and deposition
+// sorts bodies into x slabs so that even and odd slabs can scatter in two
+// conflict-free passes.
+class ParticleMeshSolver : public ForceSolver
+{
+public:
+	// Throws std::invalid_argument for a mesh that is not a power of two of at
+	// least 8, a non-positive box, or a short-range cutoff beyond half the box
+	ParticleMeshSolver(const GravityParams &params, const ParticleMeshParams &mesh);
+
+	const char *name() const override
+	{
+		return m_mesh.splitScale > 0.0f ? "treepm" : "pm";
+	}
+
+	void computeAccelerations(ParticleStore &particles, ThreadPool &pool) override;
+
+	const ParticleMeshParams &mesh() const
+	{
+		return m_mesh;
+	}
+
+private:
+	using Complex = std::complex<float>;
+
+	void wrapBodies(const ParticleStore &particles, ThreadPool &pool);
+	void assignMass(ThreadPool &pool);
+	void solvePotential(ThreadPool &pool);
+	void differentiate(ThreadPool &pool);
+	void interpolate(ParticleStore &particles, ThreadPool &pool) const;
+	void addShortRange(ParticleStore &particles, ThreadPool &pool) const;
+
+	ParticleMeshParams m_mesh;
+	// Bodies wrapped into [0, boxSize), with their masses and ids
+	ParticleStore m_wrapped;
+	std::vector<MortonKey> m_slabKeys;
+	std::vector<MortonKey> m_slabScratch;
+	std::vector<uint32_t> m_slabStart;
+	AlignedBuffer<float> m_density;
+	std::vector<Complex> m_spectrum;
+	// Green's function of the filtered, deconvolved Poisson equation per mode
+	std::vector<float> m_greens;
+	std::vector<Complex> m_twiddles;
+	// Short-range force factor sampled out to the cutoff, empty without a split
+	std::vector<float> m_shortRange;
+	AlignedBuffer<float> m_forceX, m_forceY, m_forceZ;
+	Octree m_tree;
+};
@@ -0,0 +1,134 @@
+#include "particle_store.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+void ParticleStore::resize(const size_t count)
+{
+	auto padded = paddedCount(count);
+
+	for (auto array : {&x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &mass})
+	{
+		array->resize(padded);
+	}
+	color.resize(padded);
+	id.resize(padded);
+	if (m_doublePrecision)
+	{
+		for (auto array : {&xd, &yd, &zd, &vxd, &vyd, &vzd})
+		{
+			array->resize(padded);
+		}
+	}
+
+	for (auto i = std::min(m_count, count); i < padded; ++i)
+	{
+		id[i] = static_cast<uint32_t>(i);
+	}
+	for (auto i = count; i < padded; ++i)
+	{
+		x[i] = y[i] = z[i] = 0.0f;
+		vx[i] = vy[i] = vz[i] = 0.0f;
+		mass[i] = 0.0f;
+		if (m_doublePrecision)
+		{
+			xd[i] = yd[i] = zd[i] = 0.0;
+			vxd[i] = vyd[i] = vzd[i] = 0.0;
+		}
+	}
+
+	m_count = count;
+	m_paddedCount = padded;
+}
+
+void ParticleStore::adopt(const size_t count, const std::array<double, 3> &origin)
+{
+	const auto padded = paddedCount(count);
+
+	for (auto array : {&x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &mass})
+	{
+		if (array->size() != padded)
+		{
+			throw std::invalid_argument("particle array does not match the body count");
+		}
+	}
+	if (color.size() != padded || id.size() != padded)
+	{
+		throw std::invalid_argument("particle array does not match the body count");
+	}
+
+	// Double arrays are either all present or all absent
+	m_doublePrecision = xd.size() != 0;
+	for (auto array : {&xd, &yd, &zd, &vxd, &vyd, &vzd})
+	{
+		if (array->size() != (m_doublePrecision ? padded : 0))
+		{
+			throw std::invalid_argument("particle array does not match the body count");
+		}
+	}
+
+	m_count = count;
+	m_paddedCount = padded;
+	m_origin = m_doublePrecision ? origin : std::array<double, 3>{};
+}
+
+void ParticleStore::enableDoublePrecision()
+{
+	if (m_doublePrecision)
+	{
+		return;
+	}
+
+	const std::pair<AlignedBuffer<double> *, const AlignedBuffer<float> *> arrays[] = {
+		{ &xd, &x }, { &yd, &y }, { &zd, &z }, { &vxd, &vx }, { &vyd, &vy }, { &vzd, &vz }
+	};
+	for (const auto &array : arrays)
+	{
+		array.first->resize(m_paddedCount);
+		std::copy(array.second->begin(), array.second->end(), array.first->begin());
+	}
+	m_doublePrecision = true;
+	recenter();
+}
+
+void ParticleStore::recenter()
+{
+	if (!m_doublePrecision)
+	{
+		return;
+	}
+
+	double center[3] = {};
+	double totalMass = 0.0;
+	for (size_t i = 0; i < m_count; ++i)
+	{
+		center[0] += mass[i] * xd[i];
+		center[1] += mass[i] * yd[i];
+		center[2] += mass[i] * zd[i];
+		totalMass += mass[i];
+	}
+	if (totalMass > 0.0)
+	{
+		m_origin = { center[0] / totalMass, center[1] / totalMass, center[2] / totalMass };
+	}
+
+	// Padding stays at the origin
+	for (size_t i = 0; i < m_count; ++i)
+	{
+		x[i] = static_cast<float>(xd[i] - m_origin[0]);
+		y[i] = static_cast<float>(yd[i] - m_origin[1]);
+		z[i] = static_cast<float>(zd[i] - m_origin[2]);
+	}
+}
+
+uint32_t ParticleStore::packColor(const float r, const float g, const float b, const float a)
+{
+	auto toByte = [](const float channel)
+	{
+		return static_cast<uint32_t>(std::lround(std::clamp(channel, 0.0f, 1.0f) * 255.0f));
+	};
+
+	return toByte(r) | (toByte(g) << 8) | (toByte(b) << 16) | (toByte(a) << 24);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "aligned_buffer.h"
+
+// Structure-of-arrays body storage. Every array is padded to a multiple of
+// LANE_PADDING so vector kernels never need a scalar tail; padding bodies have
+// zero mass and therefore exert no force.
+class ParticleStore
+{
+public:
+	static constexpr size_t LANE_PADDING = 16;
+
+	ParticleStore() = default;
+
+	explicit ParticleStore(const size_t count)
+	{
+		resize(count);
+	}
+
+	void resize(size_t count);
+
+	static size_t paddedCount(size_t count)
+	{
+		return (count + LANE_PADDING - 1) / LANE_PADDING * LANE_PADDING;
+	}
+
+	// Sets the body count after the arrays were replaced directly, e.g. with views
+	// into a mapped snapshot. Every array must already hold paddedCount(count)
+	// elements with zeroed padding; throws std::invalid_argument otherwise. The
+	// double arrays are either all empty or all filled, and origin is the one the
+	// float positions are relative to.
+	void adopt(size_t count, const std::array<double, 3> &origin = {});
+
+	size_t size() const { return m_count; }
+	size_t paddedSize() const { return m_paddedCount; }
+
+	static uint32_t packColor(float r, float g, float b, float a = 1.0f);
+
+	// Mixed precision: positions and velocities are integrated in the double
+	// arrays below, and x/y/z/vx/vy/vz become float copies of them, which is all
+	// the force kernels read. The float positions are relative to origin(), kept
+	// near the center of mass, so they resolve separations equally well wherever
+	// the system is; forces only depend on separations.
+	void enableDoublePrecision();
+
+	// Moves origin() to the center of mass and refreshes the float positions
+	void recenter();
+
+	bool doublePrecision() const { return m_doublePrecision; }
+
+	// Zero unless doublePrecision()
+	const std::array<double, 3> &origin() const { return m_origin; }
+
+	AlignedBuffer<float> x, y, z;
+	AlignedBuffer<float> vx, vy, vz;
+	AlignedBuffer<float> ax, ay, az;
+	AlignedBuffer<float> mass;
+	AlignedBuffer<uint32_t> color;
+	// Stable identity of the body in each slot; slots move when the store is
+	// reordered, ids never do. resize() numbers new slots by their index.
+	AlignedBuffer<uint32_t> id;
+	// Empty unless doublePrecision()
+	AlignedBuffer<double> xd, yd, zd;
+	AlignedBuffer<double> vxd, vyd, vzd;
+
+private:
+	size_t m_count = 0;
+	size_t m_paddedCount = 0;
+	bool m_doublePrecision = false;
+	std::array<double, 3> m_origin = {};
+};
@@ -0,0 +1,128 @@
+#include "pipeline_cache.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#include "snapshot.h"
+
+namespace
+{
+
+// VkPipelineCacheHeaderVersionOne, laid out as the specification stores it
+struct PipelineCacheHeader
+{
+	uint32_t headerSize;
+	uint32_t headerVersion;
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+bool matchesDevice(const std::vector<char> &data, const vk::PhysicalDeviceProperties &properties)
+{
+	PipelineCacheHeader header;
+	if (data.size() < sizeof(header))
+	{
+		return false;
+	}
+	std::memcpy(&header, data.data(), sizeof(header));
+
+	return header.headerSize >= sizeof(header)
+		&& header.headerVersion == static_cast<uint32_t>(vk::PipelineCacheHeaderVersion::eOne)
+		&& header.vendorID == properties.vendorID
+		&& header.deviceID == properties.deviceID
+		&& std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+}
+
+} // namespace
+
+std::vector<char> readFile(const std::string &path)
+{
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+	{
+		throw std::runtime_error(std::string("could not open shader file: ") + path);
+	}
+
+	auto fileSize = file.tellg();
+	std::vector<char> buffer(fileSize);
+	file.seekg(0);
+	file.read(buffer.data(), fileSize);
+	file.close();
+
+	return buffer;
+}
+
+PersistentPipelineCache::PersistentPipelineCache(vk::Device device, vk::PhysicalDevice physicalDevice, std::string path)
+	: m_device(device), m_path(std::move(path))
+{
+	// A missing file just means nothing was cached yet
+	std::vector<char> data;
+	std::ifstream file(m_path, std::ios::ate | std::ios::binary);
+	if (file.is_open())
+	{
+		data.resize(file.tellg());
+		file.seekg(0);
+		file.read(data.data(), data.size());
+	}
+
+	if (!data.empty() && !matchesDevice(data, physicalDevice.getProperties()))
+	{
+		std::cerr << "pipeline cache " << m_path << " was written for another device or driver, ignoring it\n";
+		data.clear();
+	}
+
+	vk::PipelineCacheCreateInfo cacheInfo(vk::PipelineCacheCreateFlags(), data.size(), data.data());
+	m_cache = m_device.createPipelineCacheUnique(cacheInfo);
+}
+
+void PersistentPipelineCache::save() const
+{
+	if (!m_cache)
+	{
+		return;
+	}
+
+	auto data = m_device.getPipelineCacheData(m_cache.get());
+
+	const auto temporary = m_path + ".tmp";
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		if (!file.write(reinterpret_cast<const char *>(data.data()), data.size()))
+		{
+			std::cerr << "could not write pipeline cache " << temporary << '\n';
+			return;
+		}
+	}
+
+	if (!replaceFile(temporary, m_path))
+	{
+		std::remove(temporary.c_str());
+		std::cerr << "could not replace pipeline cache " << m_path << '\n';
+	}
+}
+
+vk::ShaderModule ShaderModuleCache::get(const std::string &path)
+{
+	auto cached = m_modules.find(path);
+	if (cached != m_modules.end())
+	{
+		return cached->second.get();
+	}
+
+	auto code = readFile(path);
+	vk::ShaderModuleCreateInfo shaderInfo(
+		vk::ShaderModuleCreateFlags(),
+		code.size(),
+		reinterpret_cast<const uint32_t *>(code.data())
+	);
+
+	auto &module = m_modules[path];
+	module = m_device.createShaderModuleUnique(shaderInfo);
+	return module.get();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+std::vector<char> readFile(const std::string &path);
+
+// VkPipelineCache backed by a file. The stored blob is only handed to the
+// driver when its header matches this device's vendor, device and cache UUID,
+// so a driver update or a different GPU starts from an empty cache instead of
+// relying on every driver to reject foreign data.
+class PersistentPipelineCache
+{
+public:
+	PersistentPipelineCache() = default;
+	PersistentPipelineCache(vk::Device device, vk::PhysicalDevice physicalDevice, std::string path);
+
+	PersistentPipelineCache(PersistentPipelineCache &&) = default;
+	PersistentPipelineCache &operator=(PersistentPipelineCache &&) = default;
+
+	vk::PipelineCache get() const
+	{
+		return m_cache.get();
+	}
+
+	// Writes the current cache contents; the file is replaced atomically.
+	void save() const;
+
+private:
+	vk::Device m_device;
+	std::string m_path;
+	vk::UniquePipelineCache m_cache;
+};
+
+// SPIR-V modules by file name, loaded and created once per device.
+class ShaderModuleCache
+{
+public:
+	ShaderModuleCache() = default;
+
+	explicit ShaderModuleCache(vk::Device device)
+		: m_device(device)
+	{
+	}
+
+	vk::ShaderModule get(const std::string &path);
+
+private:
+	vk::Device m_device;
+	std::unordered_map<std::string, vk::UniqueShaderModule> m_modules;
+};
@@ -0,0 +1,160 @@
+#include "profiler.h"
+
+#include <chrono>
+#include <iomanip>
+#include <stdexcept>
+
+Profiler::Profiler(size_t capacity)
+{
+	size_t size = 1;
+	while (size < capacity)
+	{
+		size <<= 1;
+	}
+
+	m_slots = std::make_unique<Slot[]>(size);
+	m_mask = size - 1;
+	for (size_t i = 0; i < size; ++i)
+	{
+		m_slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+uint64_t Profiler::now()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+	).count());
+}
+
+uint32_t Profiler::threadSlot()
+{
+	static std::atomic<uint32_t> nextSlot{0};
+	thread_local const uint32_t slot = nextSlot.fetch_add(1, std::memory_order_relaxed);
+	return slot;
+}
+
+void Profiler::record(const char *name, const uint64_t beginNs, const uint64_t endNs, const uint32_t thread)
+{
+	record(ProfileEvent{name, beginNs, endNs, frame(), thread});
+}
+
+void Profiler::record(const ProfileEvent &event)
+{
+	auto position = m_writeCursor.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		auto &slot = m_slots[position & m_mask];
+		const auto sequence = slot.sequence.load(std::memory_order_acquire);
+		const auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+		if (difference == 0)
+		{
+			if (m_writeCursor.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				slot.event = event;
+				slot.sequence.store(position + 1, std::memory_order_release);
+				return;
+			}
+		}
+		else if (difference < 0)
+		{
+			// The consumer has not caught up with a full lap
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else
+		{
+			position = m_writeCursor.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+size_t Profiler::drain(std::vector<ProfileEvent> &out)
+{
+	size_t count = 0;
+	for (;;)
+	{
+		auto &slot = m_slots[m_readCursor & m_mask];
+		if (slot.sequence.load(std::memory_order_acquire) != m_readCursor + 1)
+		{
+			return count;
+		}
+
+		out.push_back(slot.event);
+		slot.sequence.store(m_readCursor + m_mask + 1, std::memory_order_release);
+		++m_readCursor;
+		++count;
+	}
+}
+
+ProfileWriter::ProfileWriter(const std::string &path, const ProfileFormat format, const uint64_t originNs)
+	: m_file(path, std::ios::trunc), m_format(format), m_originNs(originNs)
+{
+	if (!m_file)
+	{
+		throw std::runtime_error("could not open profile output: " + path);
+	}
+	m_file << std::fixed << std::setprecision(3);
+
+	switch (m_format)
+	{
+	case ProfileFormat::Csv:
+		m_file << "name,thread,frame,begin_ns,duration_ns\n";
+		break;
+	case ProfileFormat::Json:
+		m_file << "[\n";
+		break;
+	case ProfileFormat::ChromeTrace:
+		m_file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+		break;
+	}
+}
+
+ProfileWriter::~ProfileWriter()
+{
+	switch (m_format)
+	{
+	case ProfileFormat::Csv:
+		break;
+	case ProfileFormat::Json:
+		m_file << "\n]\n";
+		break;
+	case ProfileFormat::ChromeTrace:
+		m_file << "\n]}\n";
+		break;
+	}
+}
+
+void ProfileWriter::write(const std::vector<ProfileEvent> &events)
+{
+	for (const auto &event : events)
+	{
+		const auto begin = event.beginNs >= m_originNs ? event.beginNs - m_originNs : 0;
+		const auto duration = event.endNs - event.beginNs;
+		const bool gpu = event.thread == Profiler::GPU_THREAD;
+
+		switch (m_format)
+		{
+		case ProfileFormat::Csv:
+			m_file << event.name << ',' << (gpu ? std::string("gpu") : std::to_string(event.thread)) << ','
+				<< event.frame << ',' << begin << ',' << duration << '\n';
+			break;
+		case ProfileFormat::Json:
+			m_file << (m_first ? "" : ",\n")
+				<< "{\"name\":\"" << event.name << "\",\"thread\":" << (gpu ? std::string("\"gpu\"") : std::to_string(event.thread))
+				<< ",\"frame\":" << event.frame << ",\"begin_ns\":" << begin << ",\"duration_ns\":" << duration << '}';
+			break;
+		case ProfileFormat::ChromeTrace:
+			// Complete events in microseconds; the GPU gets its own track
+			m_file << (m_first ? "" : ",\n")
+				<< "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":" << (gpu ? 2 : 1)
+				<< ",\"tid\":" << (gpu ? 0u : event.thread)
+				<< ",\"ts\":" << begin / 1000.0 << ",\"dur\":" << duration / 1000.0
+				<< ",\"args\":{\"frame\":" << event.frame << "}}";
+			break;
+		}
+		m_first = false;
+	}
+	m_file.flush();
+}
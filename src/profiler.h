@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct ProfileEvent
+{
+	const char *name;	// must outlive the profiler, normally a string literal
+	uint64_t beginNs;
+	uint64_t endNs;
+	uint64_t frame;
+	uint32_t thread;	// CPU thread slot, or GPU_THREAD for queue timestamps
+};
+
+// Collects timed events from any thread into a bounded lock-free ring
+// (Vyukov's bounded queue: every slot carries a sequence number, so producers
+// only contend on one fetch of the write cursor). A single consumer drains it
+// periodically; when the ring is full new events are dropped and counted.
+class Profiler
+{
+public:
+	static constexpr uint32_t GPU_THREAD = 0xffffffffu;
+
+	// capacity is rounded up to a power of two
+	explicit Profiler(size_t capacity = 1 << 16);
+
+	Profiler(const Profiler &) = delete;
+	Profiler &operator=(const Profiler &) = delete;
+
+	// Monotonic clock shared by every event, in nanoseconds
+	static uint64_t now();
+
+	// Small dense id of the calling thread
+	static uint32_t threadSlot();
+
+	void setFrame(uint64_t frame)
+	{
+		m_frame.store(frame, std::memory_order_relaxed);
+	}
+
+	uint64_t frame() const
+	{
+		return m_frame.load(std::memory_order_relaxed);
+	}
+
+	void record(const char *name, uint64_t beginNs, uint64_t endNs, uint32_t thread = threadSlot());
+	void record(const ProfileEvent &event);
+
+	// Moves every queued event into out; only one thread may drain at a time
+	size_t drain(std::vector<ProfileEvent> &out);
+
+	uint64_t dropped() const
+	{
+		return m_dropped.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct alignas(64) Slot
+	{
+		std::atomic<size_t> sequence;
+		ProfileEvent event;
+	};
+
+	std::unique_ptr<Slot[]> m_slots;
+	size_t m_mask;
+	alignas(64) std::atomic<size_t> m_writeCursor{0};
+	alignas(64) size_t m_readCursor = 0;
+	std::atomic<uint64_t> m_frame{0};
+	std::atomic<uint64_t> m_dropped{0};
+};
+
+// Records the lifetime of the scope; a null profiler makes it a no-op
+class ScopedTimer
+{
+public:
+	ScopedTimer(Profiler *profiler, const char *name)
+		: m_profiler(profiler), m_name(name), m_begin(profiler ? Profiler::now() : 0)
+	{
+	}
+
+	~ScopedTimer()
+	{
+		if (m_profiler)
+		{
+			m_profiler->record(m_name, m_begin, Profiler::now());
+		}
+	}
+
+	ScopedTimer(const ScopedTimer &) = delete;
+	ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+	Profiler *m_profiler;
+	const char *m_name;
+	uint64_t m_begin;
+};
+
+enum class ProfileFormat
+{
+	Csv,
+	Json,
+	ChromeTrace
+};
+
+// Streams drained events to a file. CSV rows are appended as they come; the
+// JSON formats keep one array open and close it in the destructor, so the
+// file is complete once the writer is gone.
+class ProfileWriter
+{
+public:
+	// Event times are written relative to originNs
+	ProfileWriter(const std::string &path, ProfileFormat format, uint64_t originNs = Profiler::now());
+	~ProfileWriter();
+
+	ProfileWriter(const ProfileWriter &) = delete;
+	ProfileWriter &operator=(const ProfileWriter &) = delete;
+
+	void write(const std::vector<ProfileEvent> &events);
+
+private:
+	std::ofstream m_file;
+	ProfileFormat m_format;
+	bool m_first = true;
+	uint64_t m_originNs = 0;
+};
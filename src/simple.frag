@@ -2,9 +2,16 @@
 #extension GL_ARB_separate_shader_objects : enable
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 spriteCoord;
 layout(location = 0) out vec4 outColor;
 
 void main() 
 {
+    // Round sprites; plain points always sit at the center
+    if (dot(spriteCoord, spriteCoord) > 1.0)
+    {
+        discard;
+    }
+
     outColor = vec4(fragColor, 1.0);
-}
\ No newline at end of file
+}
@@ -1,12 +1,36 @@
 #version 450
 
+// 1: one instance per body, expanded to a screen-aligned quad (triangle strip)
+layout (constant_id = 0) const uint SPRITES = 0;
+
 layout (location = 0) in vec2 iPosition;
 layout (location = 1) in vec3 iColor;
 
+// Sprite positions arrive as unorm inside this box; the GPU integrator passes (0, 0, 1, 1)
+layout (push_constant) uniform SpriteParams
+{
+    vec2 boundsMin;
+    vec2 boundsExtent;
+    vec2 halfSize;
+} sprite;
+
 layout (location = 0) out vec3 oFragColor;
+layout (location = 1) out vec2 oSpriteCoord;
 
 void main()
 {
-    gl_Position = vec4(iPosition, 0.0, 1.0);
     oFragColor = iColor;
-}
\ No newline at end of file
+
+    if (SPRITES == 0)
+    {
+        gl_Position = vec4(iPosition, 0.0, 1.0);
+        gl_PointSize = 1.0;
+        oSpriteCoord = vec2(0.0);
+        return;
+    }
+
+    vec2 corner = vec2(float(gl_VertexIndex & 1), float(gl_VertexIndex >> 1)) * 2.0 - 1.0;
+    vec2 center = sprite.boundsMin + iPosition * sprite.boundsExtent;
+    gl_Position = vec4(center + corner * sprite.halfSize, 0.0, 1.0);
+    oSpriteCoord = corner;
+}
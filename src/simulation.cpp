@@ -0,0 +1,156 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <utility>
+
+#include "profiler.h"
+#include "thread_pool.h"
+#include "vertex.h"
+
+namespace
+{
+	constexpr size_t INTEGRATION_GRAIN = 16384;
+	constexpr uint64_t RECENTER_INTERVAL = 64;
+
+	// Body position relative to the view origin, subtracted at the store's precision
+	struct ViewPosition
+	{
+		const float *x;
+		const float *y;
+		const double *xd;
+		const double *yd;
+		glm::dvec2 origin;
+
+		glm::vec2 operator()(const size_t i) const
+		{
+			if (xd)
+			{
+				return glm::vec2(static_cast<float>(xd[i] - origin.x), static_cast<float>(yd[i] - origin.y));
+			}
+			return glm::vec2(x[i] - static_cast<float>(origin.x), y[i] - static_cast<float>(origin.y));
+		}
+	};
+
+	ViewPosition viewPosition(const ParticleStore &particles, const glm::dvec2 &origin)
+	{
+		const auto precise = particles.doublePrecision();
+		return ViewPosition{
+			particles.x.data(), particles.y.data(),
+			precise ? particles.xd.data() : nullptr, precise ? particles.yd.data() : nullptr,
+			origin
+		};
+	}
+}
+
+Simulation::Simulation(ParticleStore particles, std::unique_ptr<ForceSolver> solver, const float timeStep, ThreadPool &pool)
+	: m_particles(std::move(particles)), m_solver(std::move(solver)), m_timeStep(timeStep), m_pool(pool),
+	m_pipeline(createStepPipeline(StepConfig()))
+{
+}
+
+void Simulation::setStepConfig(const StepConfig &config)
+{
+	m_pipeline = createStepPipeline(config);
+	m_pipeline->setProfiler(m_profiler);
+}
+
+void Simulation::step()
+{
+	if (m_reorderInterval != 0 && m_stepCount % m_reorderInterval == 0)
+	{
+		reorder();
+	}
+
+	if (m_blockTimesteps)
+	{
+		ScopedTimer timer(m_profiler, "block step");
+		m_blockTimesteps->step(m_particles, *m_solver, m_timeStep, m_pool);
+	}
+	else
+	{
+		m_pipeline->step(m_particles, *m_solver, m_timeStep, m_pool);
+	}
+
+	m_time += m_timeStep;
+	++m_stepCount;
+
+	// Keeps the float positions the kernels read close to the bodies
+	if (m_particles.doublePrecision() && m_stepCount % RECENTER_INTERVAL == 0)
+	{
+		m_particles.recenter();
+	}
+}
+
+void Simulation::reorder()
+{
+	ScopedTimer timer(m_profiler, "reorder");
+
+	// Accelerations move with their bodies, so the pipeline's stay valid
+	m_reorder.apply(m_particles, m_pool);
+	if (m_blockTimesteps)
+	{
+		m_blockTimesteps->reorder(m_reorder.order());
+	}
+	++m_layoutVersion;
+}
+
+void Simulation::packVertices(Vertex *dst) const
+{
+	const auto position = viewPosition(m_particles, m_viewOrigin);
+
+	m_pool.parallelFor(0, m_particles.size(), INTEGRATION_GRAIN, [=](const size_t first, const size_t last)
+	{
+		for (auto i = first; i < last; ++i)
+		{
+			dst[i].pos = position(i);
+		}
+	});
+}
+
+glm::vec4 Simulation::packSprites(SpriteInstance *dst) const
+{
+	const auto position = viewPosition(m_particles, m_viewOrigin);
+	const auto count = m_particles.size();
+
+	glm::vec2 lo(std::numeric_limits<float>::max());
+	glm::vec2 hi(std::numeric_limits<float>::lowest());
+	std::mutex boundsMutex;
+	m_pool.parallelFor(0, count, INTEGRATION_GRAIN, [&](const size_t first, const size_t last)
+	{
+		glm::vec2 chunkLo(std::numeric_limits<float>::max());
+		glm::vec2 chunkHi(std::numeric_limits<float>::lowest());
+		for (auto i = first; i < last; ++i)
+		{
+			const auto p = position(i);
+			chunkLo = glm::min(chunkLo, p);
+			chunkHi = glm::max(chunkHi, p);
+		}
+
+		std::lock_guard<std::mutex> lock(boundsMutex);
+		lo = glm::min(lo, chunkLo);
+		hi = glm::max(hi, chunkHi);
+	});
+
+	if (count == 0)
+	{
+		return glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	}
+
+	const glm::vec2 extent = glm::max(hi - lo, glm::vec2(std::numeric_limits<float>::min()));
+	const glm::vec2 scale = 65535.0f / extent;
+
+	m_pool.parallelFor(0, count, INTEGRATION_GRAIN, [=](const size_t first, const size_t last)
+	{
+		for (auto i = first; i < last; ++i)
+		{
+			const auto p = position(i);
+			dst[i].x = static_cast<uint16_t>(std::lround(std::min((p.x - lo.x) * scale.x, 65535.0f)));
+			dst[i].y = static_cast<uint16_t>(std::lround(std::min((p.y - lo.y) * scale.y, 65535.0f)));
+		}
+	});
+
+	return glm::vec4(lo, extent);
+}
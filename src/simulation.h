@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <glm/glm.hpp>
+
+#include "block_timestep.h"
+#include "force_solver.h"
+#include "morton_order.h"
+#include "particle_store.h"
+#include "step_pipeline.h"
+
+class Profiler;
+class ThreadPool;
+struct SpriteInstance;
+struct Vertex;
+
+// Advances a particle store with a step pipeline, kick-drift-kick leapfrog in
+// 3D with Plummer softening unless configured otherwise.
+class Simulation
+{
+public:
+	Simulation(ParticleStore particles, std::unique_ptr<ForceSolver> solver, float timeStep, ThreadPool &pool);
+
+	void step();
+
+	// Replaces the step pipeline; the dispatch over the configuration happens here once
+	void setStepConfig(const StepConfig &config);
+
+	const StepConfig &stepConfig() const
+	{
+		return m_pipeline->config();
+	}
+
+	// Switches step() to hierarchical block timesteps; the time step set at
+	// construction becomes the largest one
+	void enableBlockTimesteps(const BlockTimestepParams &params)
+	{
+		m_blockTimesteps = std::make_unique<BlockTimestepIntegrator>(params);
+	}
+
+	// Null with the global leapfrog
+	const BlockTimestepIntegrator *blockTimesteps() const
+	{
+		return m_blockTimesteps.get();
+	}
+
+	// Times the phases of step() when set; may be null
+	void setProfiler(Profiler *profiler)
+	{
+		m_profiler = profiler;
+		m_pipeline->setProfiler(profiler);
+	}
+
+	// Sorts the store along the Z-order curve before every step that is a
+	// multiple of steps; 0 never reorders. Bodies drift apart in memory as they
+	// move, and a few hundred steps is when that starts to cost cache misses.
+	void setReorderInterval(const uint64_t steps)
+	{
+		m_reorderInterval = steps;
+	}
+
+	// Bumped by every reorder. The slots of particles() and of packed vertices
+	// only keep their bodies between equal versions; ParticleStore::id does not change.
+	uint64_t layoutVersion() const
+	{
+		return m_layoutVersion;
+	}
+
+	// World position shown at the center of the view. Packing subtracts it before
+	// converting to float, in double when the store has double positions, so
+	// bodies far from the world origin still render at full precision.
+	void setViewOrigin(const glm::dvec2 &origin)
+	{
+		m_viewOrigin = origin;
+	}
+
+	// Writes bodyCount() view-relative vertex positions to dst; dst is typically mapped device memory.
+	void packVertices(Vertex *dst) const;
+
+	// Writes bodyCount() quantized sprite instances to dst and returns the
+	// view-relative xy bounding box they are relative to as (minX, minY, extentX, extentY).
+	glm::vec4 packSprites(SpriteInstance *dst) const;
+
+	size_t bodyCount() const
+	{
+		return m_particles.size();
+	}
+
+	const ParticleStore &particles() const
+	{
+		return m_particles;
+	}
+
+	const ForceSolver &solver() const
+	{
+		return *m_solver;
+	}
+
+	double time() const
+	{
+		return m_time;
+	}
+
+	uint64_t stepCount() const
+	{
+		return m_stepCount;
+	}
+
+	// Continues the clock of a restarted run
+	void setClock(const double time, const uint64_t stepCount)
+	{
+		m_time = time;
+		m_stepCount = stepCount;
+	}
+
+private:
+	void reorder();
+
+	ParticleStore m_particles;
+	std::unique_ptr<ForceSolver> m_solver;
+	float m_timeStep;
+	ThreadPool &m_pool;
+	Profiler *m_profiler = nullptr;
+	std::unique_ptr<StepPipeline> m_pipeline;
+	std::unique_ptr<BlockTimestepIntegrator> m_blockTimesteps;
+	MortonReorder m_reorder;
+	uint64_t m_reorderInterval = 0;
+	uint64_t m_layoutVersion = 0;
+	glm::dvec2 m_viewOrigin{ 0.0, 0.0 };
+	double m_time = 0.0;
+	uint64_t m_stepCount = 0;
+};
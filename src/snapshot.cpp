@@ -0,0 +1,362 @@
+#include "snapshot.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	constexpr char MAGIC[8] = { 'N', 'B', 'O', 'D', 'Y', 'S', 'N', 'P' };
+	constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+	constexpr size_t FIELD_COUNT = static_cast<size_t>(SnapshotField::Count);
+
+	size_t alignUp(const size_t value)
+	{
+		return (value + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+	}
+
+	// The whole file mapped copy-on-write: the store may integrate in place while
+	// the file itself is never modified.
+	class MappedFile
+	{
+	public:
+		explicit MappedFile(const std::string &path)
+		{
+#ifdef _WIN32
+			m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (m_file == INVALID_HANDLE_VALUE)
+			{
+				throw std::runtime_error("could not open snapshot: " + path);
+			}
+
+			LARGE_INTEGER size;
+			GetFileSizeEx(m_file, &size);
+			m_size = static_cast<size_t>(size.QuadPart);
+			if (m_size < sizeof(SnapshotHeader))
+			{
+				CloseHandle(m_file);
+				throw std::runtime_error("snapshot is truncated: " + path);
+			}
+
+			m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+			m_data = m_mapping ? MapViewOfFile(m_mapping, FILE_MAP_COPY, 0, 0, 0) : nullptr;
+			if (!m_data)
+			{
+				if (m_mapping)
+				{
+					CloseHandle(m_mapping);
+				}
+				CloseHandle(m_file);
+				throw std::runtime_error("could not map snapshot: " + path);
+			}
+#else
+			const int fd = open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+			{
+				throw std::runtime_error("could not open snapshot: " + path);
+			}
+
+			struct stat info;
+			if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SnapshotHeader))
+			{
+				close(fd);
+				throw std::runtime_error("snapshot is truncated: " + path);
+			}
+			m_size = static_cast<size_t>(info.st_size);
+
+			// The mapping stays valid after the descriptor is closed
+			m_data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if (m_data == MAP_FAILED)
+			{
+				throw std::runtime_error("could not map snapshot: " + path);
+			}
+#endif
+		}
+
+		~MappedFile()
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(m_data);
+			CloseHandle(m_mapping);
+			CloseHandle(m_file);
+#else
+			munmap(m_data, m_size);
+#endif
+		}
+
+		MappedFile(const MappedFile &) = delete;
+		MappedFile &operator=(const MappedFile &) = delete;
+
+		uint8_t *data() const
+		{
+			return static_cast<uint8_t *>(m_data);
+		}
+
+		size_t size() const
+		{
+			return m_size;
+		}
+
+	private:
+		void *m_data = nullptr;
+		size_t m_size = 0;
+#ifdef _WIN32
+		HANDLE m_file = INVALID_HANDLE_VALUE;
+		HANDLE m_mapping = nullptr;
+#endif
+	};
+
+	struct FieldView
+	{
+		const void *data;
+		uint32_t elementSize;
+	};
+
+	std::vector<FieldView> fieldsOf(const ParticleStore &particles)
+	{
+		// In SnapshotField order
+		return {
+			{ particles.x.data(), sizeof(float) },
+			{ particles.y.data(), sizeof(float) },
+			{ particles.z.data(), sizeof(float) },
+			{ particles.vx.data(), sizeof(float) },
+			{ particles.vy.data(), sizeof(float) },
+			{ particles.vz.data(), sizeof(float) },
+			{ particles.mass.data(), sizeof(float) },
+			{ particles.color.data(), sizeof(uint32_t) },
+			{ particles.id.data(), sizeof(uint32_t) },
+			{ particles.xd.data(), sizeof(double) },
+			{ particles.yd.data(), sizeof(double) },
+			{ particles.zd.data(), sizeof(double) },
+			{ particles.vxd.data(), sizeof(double) },
+			{ particles.vyd.data(), sizeof(double) },
+			{ particles.vzd.data(), sizeof(double) }
+		};
+	}
+
+	template <typename T>
+	void assignView(AlignedBuffer<T> &array, const MappedFile &file, const SnapshotSection &section, const std::shared_ptr<MappedFile> &owner)
+	{
+		array = AlignedBuffer<T>::view(reinterpret_cast<T *>(file.data() + section.offset), section.bytes / sizeof(T), owner);
+	}
+}
+
+uint64_t snapshotChecksum(const void *data, const size_t bytes)
+{
+	constexpr uint64_t PRIME1 = 0x9e3779b185ebca87ull;
+	constexpr uint64_t PRIME2 = 0xc2b2ae3d27d4eb4full;
+
+	auto rotate = [](const uint64_t value, const int bits)
+	{
+		return (value << bits) | (value >> (64 - bits));
+	};
+	auto round = [&](const uint64_t lane, const uint64_t word)
+	{
+		return rotate(lane + word * PRIME2, 31) * PRIME1;
+	};
+
+	const auto *bytesIn = static_cast<const uint8_t *>(data);
+	uint64_t lanes[4] = { PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1 };
+
+	// Four independent lanes keep the multiplier busy
+	size_t offset = 0;
+	for (; offset + 32 <= bytes; offset += 32)
+	{
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			uint64_t word;
+			std::memcpy(&word, bytesIn + offset + 8 * lane, sizeof(word));
+			lanes[lane] = round(lanes[lane], word);
+		}
+	}
+
+	uint64_t hash = rotate(lanes[0], 1) + rotate(lanes[1], 7) + rotate(lanes[2], 12) + rotate(lanes[3], 18);
+	for (; offset < bytes; ++offset)
+	{
+		hash = round(hash, bytesIn[offset]);
+	}
+
+	hash ^= bytes;
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	return hash;
+}
+
+void saveSnapshot(const std::string &path, const ParticleStore &particles, const SnapshotState &state)
+{
+	SnapshotHeader header = {};
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = SNAPSHOT_VERSION;
+	header.headerSize = sizeof(SnapshotHeader);
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.sectionCount = particles.doublePrecision() ? FIELD_COUNT : FLOAT_SECTION_COUNT;
+	header.bodyCount = particles.size();
+	header.paddedCount = particles.paddedSize();
+	header.time = state.time;
+	header.stepCount = state.stepCount;
+	for (size_t axis = 0; axis < 3; ++axis)
+	{
+		header.origin[axis] = particles.origin()[axis];
+	}
+
+	const auto fields = fieldsOf(particles);
+	size_t offset = alignUp(sizeof(SnapshotHeader));
+	for (size_t i = 0; i < header.sectionCount; ++i)
+	{
+		auto &section = header.sections[i];
+		section.field = static_cast<uint32_t>(i);
+		section.elementSize = fields[i].elementSize;
+		section.offset = offset;
+		section.bytes = particles.paddedSize() * fields[i].elementSize;
+		section.checksum = snapshotChecksum(fields[i].data, section.bytes);
+		offset = alignUp(offset + section.bytes);
+	}
+	header.headerChecksum = snapshotChecksum(&header, offsetof(SnapshotHeader, headerChecksum));
+
+	const auto temporary = path + ".tmp";
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		const std::vector<char> zeros(SNAPSHOT_ALIGNMENT, 0);
+
+		auto pad = [&](const size_t written)
+		{
+			file.write(zeros.data(), alignUp(written) - written);
+		};
+
+		file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		pad(sizeof(header));
+		for (size_t i = 0; i < header.sectionCount; ++i)
+		{
+			const auto &section = header.sections[i];
+			file.write(static_cast<const char *>(fields[i].data), section.bytes);
+			pad(section.bytes);
+		}
+
+		if (!file.flush())
+		{
+			std::remove(temporary.c_str());
+			throw std::runtime_error("could not write snapshot: " + temporary);
+		}
+	}
+
+	if (!replaceFile(temporary, path))
+	{
+		std::remove(temporary.c_str());
+		throw std::runtime_error("could not replace snapshot: " + path);
+	}
+}
+
+bool replaceFile(const std::string &source, const std::string &target)
+{
+#ifdef _WIN32
+	// rename() refuses to overwrite an existing file on Windows
+	return MoveFileExA(source.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return std::rename(source.c_str(), target.c_str()) == 0;
+#endif
+}
+
+ParticleStore loadSnapshot(const std::string &path, SnapshotState *state, const SnapshotVerify verify)
+{
+	auto file = std::make_shared<MappedFile>(path);
+
+	SnapshotHeader header;
+	std::memcpy(&header, file->data(), sizeof(header));
+
+	auto fail = [&](const char *reason)
+	{
+		return std::runtime_error(std::string(reason) + ": " + path);
+	};
+
+	if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+	{
+		throw fail("not a snapshot");
+	}
+	if (header.version != SNAPSHOT_VERSION || header.headerSize != sizeof(SnapshotHeader))
+	{
+		throw fail("unsupported snapshot version");
+	}
+	if (header.byteOrder != BYTE_ORDER_MARK)
+	{
+		throw fail("snapshot has a different byte order");
+	}
+	if (header.headerChecksum != snapshotChecksum(&header, offsetof(SnapshotHeader, headerChecksum)))
+	{
+		throw fail("snapshot header is corrupt");
+	}
+	if ((header.sectionCount != FIELD_COUNT && header.sectionCount != FLOAT_SECTION_COUNT) || header.paddedCount != ParticleStore::paddedCount(header.bodyCount))
+	{
+		throw fail("snapshot layout does not match this build");
+	}
+
+	ParticleStore particles;
+	const auto fields = fieldsOf(particles);
+	for (size_t i = 0; i < header.sectionCount; ++i)
+	{
+		const auto &section = header.sections[i];
+		if (section.field != i
+			|| section.elementSize != fields[i].elementSize
+			|| section.bytes != header.paddedCount * section.elementSize
+			|| section.offset % SNAPSHOT_ALIGNMENT != 0
+			|| section.offset > file->size() || section.bytes > file->size() - section.offset)
+		{
+			throw fail("snapshot is truncated or has a malformed section");
+		}
+		if (verify == SnapshotVerify::Full && section.checksum != snapshotChecksum(file->data() + section.offset, section.bytes))
+		{
+			throw fail("snapshot section checksum mismatch");
+		}
+	}
+
+	const auto *sections = header.sections;
+	assignView(particles.x, *file, sections[static_cast<size_t>(SnapshotField::X)], file);
+	assignView(particles.y, *file, sections[static_cast<size_t>(SnapshotField::Y)], file);
+	assignView(particles.z, *file, sections[static_cast<size_t>(SnapshotField::Z)], file);
+	assignView(particles.vx, *file, sections[static_cast<size_t>(SnapshotField::VX)], file);
+	assignView(particles.vy, *file, sections[static_cast<size_t>(SnapshotField::VY)], file);
+	assignView(particles.vz, *file, sections[static_cast<size_t>(SnapshotField::VZ)], file);
+	assignView(particles.mass, *file, sections[static_cast<size_t>(SnapshotField::Mass)], file);
+	assignView(particles.color, *file, sections[static_cast<size_t>(SnapshotField::Color)], file);
+	assignView(particles.id, *file, sections[static_cast<size_t>(SnapshotField::Id)], file);
+	if (header.sectionCount == FIELD_COUNT)
+	{
+		assignView(particles.xd, *file, sections[static_cast<size_t>(SnapshotField::PreciseX)], file);
+		assignView(particles.yd, *file, sections[static_cast<size_t>(SnapshotField::PreciseY)], file);
+		assignView(particles.zd, *file, sections[static_cast<size_t>(SnapshotField::PreciseZ)], file);
+		assignView(particles.vxd, *file, sections[static_cast<size_t>(SnapshotField::PreciseVX)], file);
+		assignView(particles.vyd, *file, sections[static_cast<size_t>(SnapshotField::PreciseVY)], file);
+		assignView(particles.vzd, *file, sections[static_cast<size_t>(SnapshotField::PreciseVZ)], file);
+	}
+
+	// Accelerations are scratch space of the solvers
+	const auto padded = static_cast<size_t>(header.paddedCount);
+	particles.ax.resize(padded);
+	particles.ay.resize(padded);
+	particles.az.resize(padded);
+	particles.adopt(static_cast<size_t>(header.bodyCount), { header.origin[0], header.origin[1], header.origin[2] });
+
+	if (state)
+	{
+		state->time = header.time;
+		state->stepCount = header.stepCount;
+	}
+	return particles;
+}
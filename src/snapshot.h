@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "particle_store.h"
+
+// Binary snapshot of a particle store, used both for initial conditions and as a
+// restart checkpoint. Layout (little endian):
+//
+//   SnapshotHeader, padded to SNAPSHOT_ALIGNMENT
+//   one section per field: paddedCount elements, SoA, each at an aligned offset
+//
+// Sections have the in-memory layout of the ParticleStore arrays, so loading maps
+// the file copy-on-write and hands the sections to the store without copying or
+// parsing anything. Accelerations are not stored; they are derived state. The
+// double-precision sections are present only when the store has them
+// (sectionCount is then SnapshotField::Count, otherwise FLOAT_SECTION_COUNT).
+constexpr uint32_t SNAPSHOT_VERSION = 3;
+constexpr size_t SNAPSHOT_ALIGNMENT = 4096;
+
+enum class SnapshotField : uint32_t
+{
+	X,
+	Y,
+	Z,
+	VX,
+	VY,
+	VZ,
+	Mass,
+	Color,
+	Id,
+	PreciseX,
+	PreciseY,
+	PreciseZ,
+	PreciseVX,
+	PreciseVY,
+	PreciseVZ,
+	Count
+};
+
+constexpr uint32_t FLOAT_SECTION_COUNT = static_cast<uint32_t>(SnapshotField::PreciseX);
+
+struct SnapshotSection
+{
+	uint32_t field;
+	uint32_t elementSize;
+	uint64_t offset;
+	uint64_t bytes;
+	uint64_t checksum;
+};
+
+struct SnapshotHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t byteOrder;
+	uint32_t sectionCount;
+	uint64_t bodyCount;
+	uint64_t paddedCount;
+	double time;
+	uint64_t stepCount;
+	double origin[3];	// of the float positions, see ParticleStore::origin()
+	SnapshotSection sections[static_cast<size_t>(SnapshotField::Count)];
+	uint64_t headerChecksum;	// over every byte above
+};
+
+struct SnapshotState
+{
+	double time = 0.0;
+	uint64_t stepCount = 0;
+};
+
+enum class SnapshotVerify
+{
+	Header,		// only the header checksum; sections stay unread until used
+	Full		// every section, touches the whole file once
+};
+
+// Writes to a temporary file next to path and renames it, so an interrupted
+// checkpoint never replaces the previous one. Throws std::runtime_error.
+void saveSnapshot(const std::string &path, const ParticleStore &particles, const SnapshotState &state = {});
+
+// Atomically moves source over target, replacing target if it exists. Returns
+// false on failure and leaves source in place.
+bool replaceFile(const std::string &source, const std::string &target);
+
+// Maps path and returns a store viewing its sections. Throws std::runtime_error
+// when the file is unreadable, of another version, truncated or corrupt.
+ParticleStore loadSnapshot(const std::string &path, SnapshotState *state = nullptr, SnapshotVerify verify = SnapshotVerify::Header);
+
+// 64-bit checksum of the snapshot sections; four interleaved lanes over 8-byte words
+uint64_t snapshotChecksum(const void *data, size_t bytes);
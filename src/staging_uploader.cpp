@@ -0,0 +1,127 @@
+#include "staging_uploader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+StagingUploader::StagingUploader(
+	vk::Device device,
+	DeviceAllocator &allocator,
+	vk::Queue transferQueue,
+	const uint32_t transferFamily,
+	const uint32_t graphicsFamily)
+	: m_device(device),
+	  m_allocator(&allocator),
+	  m_transferQueue(transferQueue),
+	  m_transferFamily(transferFamily),
+	  m_graphicsFamily(graphicsFamily)
+{
+	vk::CommandPoolCreateInfo poolInfo(vk::CommandPoolCreateFlagBits::eTransient, m_transferFamily);
+	m_commandPool = m_device.createCommandPoolUnique(poolInfo);
+
+	vk::BufferCreateInfo bufferInfo(vk::BufferCreateFlags(), ARENA_SIZE, vk::BufferUsageFlagBits::eTransferSrc);
+	m_arenaBuffer = m_device.createBufferUnique(bufferInfo);
+	m_arena = LinearArena(m_allocator->bindBuffer(
+		m_arenaBuffer.get(),
+		vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+	));
+}
+
+StagingUploader &StagingUploader::operator=(StagingUploader &&other)
+{
+	// In-flight copies still reference our staging buffers
+	waitIdle();
+
+	m_pending = std::move(other.m_pending);
+	m_arenaBuffer = std::move(other.m_arenaBuffer);
+	m_arena = std::move(other.m_arena);
+	m_commandPool = std::move(other.m_commandPool);
+	m_device = other.m_device;
+	m_allocator = other.m_allocator;
+	m_transferQueue = other.m_transferQueue;
+	m_transferFamily = other.m_transferFamily;
+	m_graphicsFamily = other.m_graphicsFamily;
+	return *this;
+}
+
+StagingUploader::~StagingUploader()
+{
+	waitIdle();
+}
+
+std::vector<uint32_t> StagingUploader::sharingFamilies() const
+{
+	if (dedicated())
+	{
+		return { m_graphicsFamily, m_transferFamily };
+	}
+
+	return { m_graphicsFamily };
+}
+
+void StagingUploader::upload(vk::Buffer dst, const vk::DeviceSize dstOffset, const void *data, const vk::DeviceSize size, vk::Semaphore signal)
+{
+	collect();
+
+	PendingUpload pending;
+
+	vk::Buffer source = m_arenaBuffer.get();
+	vk::DeviceSize sourceOffset = 0;
+	if (auto offset = m_arena.allocate(size, 16))
+	{
+		sourceOffset = *offset;
+		std::memcpy(static_cast<char *>(m_arena.allocation().mapped()) + sourceOffset, data, size);
+	}
+	else
+	{
+		vk::BufferCreateInfo bufferInfo(vk::BufferCreateFlags(), size, vk::BufferUsageFlagBits::eTransferSrc);
+		pending.staging = m_device.createBufferUnique(bufferInfo);
+		pending.stagingMemory = m_allocator->bindBuffer(
+			pending.staging.get(),
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+		);
+		std::memcpy(pending.stagingMemory.mapped(), data, size);
+		source = pending.staging.get();
+	}
+
+	vk::CommandBufferAllocateInfo commandInfo(m_commandPool.get(), vk::CommandBufferLevel::ePrimary, 1);
+	pending.commandBuffer = std::move(m_device.allocateCommandBuffersUnique(commandInfo)[0]);
+
+	auto commandBuffer = pending.commandBuffer.get();
+	commandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+	vk::BufferCopy region(sourceOffset, dstOffset, size);
+	commandBuffer.copyBuffer(source, dst, 1, &region);
+	commandBuffer.end();
+
+	pending.done = m_device.createFenceUnique(vk::FenceCreateInfo());
+
+	vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &commandBuffer, signal ? 1 : 0, &signal);
+	m_transferQueue.submit(vk::ArrayProxy(submitInfo), pending.done.get());
+
+	m_pending.push_back(std::move(pending));
+}
+
+void StagingUploader::collect()
+{
+	auto finished = std::remove_if(m_pending.begin(), m_pending.end(), [this](const PendingUpload &pending)
+	{
+		return m_device.getFenceStatus(pending.done.get()) == vk::Result::eSuccess;
+	});
+	m_pending.erase(finished, m_pending.end());
+
+	if (m_pending.empty())
+	{
+		m_arena.reset();
+	}
+}
+
+void StagingUploader::waitIdle()
+{
+	for (const auto &pending : m_pending)
+	{
+		m_device.waitForFences(1, &pending.done.get(), VK_TRUE, std::numeric_limits<uint64_t>::max());
+	}
+	m_pending.clear();
+	m_arena.reset();
+}
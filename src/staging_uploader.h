@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "vulkan_memory.h"
+
+// Copies host data into device-local buffers. Data is staged in a linear arena
+// that is rewound whenever no copy is in flight; uploads that do not fit get a
+// short-lived staging buffer of their own. Copies are submitted on the transfer
+// queue given at construction, ideally a transfer-only family so they overlap
+// with graphics work; the consumer orders itself after a copy by waiting on the
+// semaphore passed to upload(). Destination buffers must be usable from both
+// families, see sharingFamilies().
+class StagingUploader
+{
+public:
+	static constexpr vk::DeviceSize ARENA_SIZE = 16ull << 20;
+
+	StagingUploader() = default;
+
+	StagingUploader(
+		vk::Device device,
+		DeviceAllocator &allocator,
+		vk::Queue transferQueue,
+		uint32_t transferFamily,
+		uint32_t graphicsFamily
+	);
+
+	StagingUploader(StagingUploader &&) = default;
+	StagingUploader &operator=(StagingUploader &&other);
+
+	~StagingUploader();
+
+	// True when copies run on their own queue family
+	bool dedicated() const
+	{
+		return m_transferFamily != m_graphicsFamily;
+	}
+
+	// Queue families a destination buffer has to be shared between (one entry when not dedicated)
+	std::vector<uint32_t> sharingFamilies() const;
+
+	// Records and submits a copy of size bytes into dst at dstOffset. signal, if
+	// given, is signalled once the copy completed.
+	void upload(vk::Buffer dst, vk::DeviceSize dstOffset, const void *data, vk::DeviceSize size, vk::Semaphore signal = vk::Semaphore());
+
+	// Releases staging memory of copies that have completed
+	void collect();
+
+	// Blocks until every submitted copy completed
+	void waitIdle();
+
+private:
+	struct PendingUpload
+	{
+		// Only set when the data did not fit into the arena
+		DeviceAllocation stagingMemory;
+		vk::UniqueBuffer staging;
+		vk::UniqueCommandBuffer commandBuffer;
+		vk::UniqueFence done;
+	};
+
+	vk::Device m_device;
+	DeviceAllocator *m_allocator = nullptr;
+	vk::Queue m_transferQueue;
+	uint32_t m_transferFamily = 0;
+	uint32_t m_graphicsFamily = 0;
+	vk::UniqueCommandPool m_commandPool;
+	LinearArena m_arena;
+	vk::UniqueBuffer m_arenaBuffer;
+	std::vector<PendingUpload> m_pending;
+};
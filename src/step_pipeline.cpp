@@ -0,0 +1,561 @@
+#include "step_pipeline.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+
+#include "aligned_buffer.h"
+#include "direct_sum_kernels.h"
+#include "particle_store.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+namespace
+{
+	constexpr size_t INTEGRATION_GRAIN = 16384;
+	// Targets per force task; a multiple of LANE_PADDING so every lane block is whole
+	constexpr size_t FORCE_BLOCK = 64;
+
+	// Force laws return |a| / (m r) for a source at squared distance r2
+	struct PlummerSoftening
+	{
+		explicit PlummerSoftening(const float softening)
+			: softening2(softening * softening)
+		{
+		}
+
+		float operator()(const float r2) const
+		{
+			const auto invR = 1.0f / std::sqrt(r2 + softening2);
+			return invR * invR * invR;
+		}
+
+		float softening2;
+	};
+
+	// Monaghan & Lattanzio cubic spline with the support h = 2.8 eps of GADGET-2,
+	// which matches the potential depth of Plummer softening eps. Written with
+	// selects rather than branches so the target loop still vectorizes.
+	struct SplineSoftening
+	{
+		explicit SplineSoftening(const float softening)
+			: invH(1.0f / (2.8f * softening)), invH3(invH * invH * invH)
+		{
+		}
+
+		float operator()(const float r2) const
+		{
+			const auto r = std::sqrt(r2);
+			const auto u = r * invH;
+			const auto u2 = u * u;
+			const auto inner = invH3 * (32.0f / 3.0f + u2 * (32.0f * u - 38.4f));
+			const auto outer = invH3 * (64.0f / 3.0f - 48.0f * u + 38.4f * u2 - 32.0f / 3.0f * u2 * u - 1.0f / 15.0f / (u2 * u));
+			const auto newtonian = 1.0f / (r2 * r);
+			return u < 0.5f ? inner : (u < 1.0f ? outer : newtonian);
+		}
+
+		float invH;
+		float invH3;
+	};
+
+	// Vectorizes over LANE_PADDING targets at a time like the hand-written
+	// kernels; begin must be a multiple of LANE_PADDING
+	template <int Dimensions, class Law>
+	void directSum(const DirectSumArgs &args, const Law &law, const size_t begin, const size_t end)
+	{
+		constexpr size_t LANES = ParticleStore::LANE_PADDING;
+
+		for (auto i = begin; i < end; i += LANES)
+		{
+			float xi[LANES], yi[LANES], zi[LANES];
+			float ax[LANES] = {}, ay[LANES] = {}, az[LANES] = {};
+			for (size_t lane = 0; lane < LANES; ++lane)
+			{
+				xi[lane] = args.x[i + lane];
+				yi[lane] = args.y[i + lane];
+				zi[lane] = args.z[i + lane];
+			}
+
+			for (size_t j = 0; j < args.sourceCount; ++j)
+			{
+				const auto xj = args.x[j], yj = args.y[j], zj = args.z[j], mj = args.mass[j];
+				for (size_t lane = 0; lane < LANES; ++lane)
+				{
+					const auto dx = xj - xi[lane];
+					const auto dy = yj - yi[lane];
+					const auto dz = Dimensions == 3 ? zj - zi[lane] : 0.0f;
+					const auto s = mj * law(dx * dx + dy * dy + dz * dz);
+					ax[lane] += dx * s;
+					ay[lane] += dy * s;
+					az[lane] += dz * s;
+				}
+			}
+
+			const auto G = args.gravitationalConstant;
+			const auto lanes = std::min(LANES, end - i);
+			for (size_t lane = 0; lane < lanes; ++lane)
+			{
+				args.ax[i + lane] = G * ax[lane];
+				args.ay[i + lane] = G * ay[lane];
+				args.az[i + lane] = G * az[lane];
+			}
+		}
+	}
+
+	template <int Dimensions, class Law>
+	void computeDirect(ParticleStore &particles, const GravityParams &params, ThreadPool &pool)
+	{
+		const DirectSumArgs args{
+			particles.x.data(), particles.y.data(), particles.z.data(), particles.mass.data(),
+			particles.paddedSize(),
+			params.softening * params.softening,
+			params.gravitationalConstant,
+			particles.ax.data(), particles.ay.data(), particles.az.data()
+		};
+		const Law law(params.softening);
+		const auto count = particles.size();
+
+		pool.parallelFor(0, (count + FORCE_BLOCK - 1) / FORCE_BLOCK, 1, [&](const size_t first, const size_t last)
+		{
+			directSum<Dimensions>(args, law, first * FORCE_BLOCK, std::min(last * FORCE_BLOCK, count));
+		});
+	}
+
+	// Positions and velocities at the store's precision. Writes through a
+	// double-precision state also refresh the float copies the kernels read.
+	template <bool Precise>
+	struct BodyState
+	{
+		using Real = typename std::conditional<Precise, double, float>::type;
+
+		// The arrays of one axis; loops take it by value so the pointers stay in registers
+		struct Axis
+		{
+			void setPosition(const size_t i, const Real value) const
+			{
+				x[i] = value;
+				if constexpr (Precise)
+				{
+					xf[i] = static_cast<float>(value - origin);
+				}
+			}
+
+			void setVelocity(const size_t i, const Real value) const
+			{
+				v[i] = value;
+				if constexpr (Precise)
+				{
+					vf[i] = static_cast<float>(value);
+				}
+			}
+
+			Real *x;
+			Real *v;
+			float *xf;
+			float *vf;
+			const float *a;
+			double origin;
+		};
+
+		explicit BodyState(ParticleStore &particles)
+		{
+			float *floatPositions[3] = { particles.x.data(), particles.y.data(), particles.z.data() };
+			float *floatVelocities[3] = { particles.vx.data(), particles.vy.data(), particles.vz.data() };
+			const float *accelerations[3] = { particles.ax.data(), particles.ay.data(), particles.az.data() };
+			Real *positions[3];
+			Real *velocities[3];
+			if constexpr (Precise)
+			{
+				positions[0] = particles.xd.data(), positions[1] = particles.yd.data(), positions[2] = particles.zd.data();
+				velocities[0] = particles.vxd.data(), velocities[1] = particles.vyd.data(), velocities[2] = particles.vzd.data();
+			}
+			else
+			{
+				std::copy(floatPositions, floatPositions + 3, positions);
+				std::copy(floatVelocities, floatVelocities + 3, velocities);
+			}
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				axes[axis] = Axis{
+					positions[axis], velocities[axis],
+					floatPositions[axis], floatVelocities[axis],
+					accelerations[axis],
+					particles.origin()[axis]
+				};
+			}
+			// Float padding bodies never move, double ones are skipped to keep them at the origin
+			count = Precise ? particles.size() : particles.paddedSize();
+		}
+
+		Axis axes[3];
+		size_t count;
+	};
+
+	// Runs body(axisIndex, axis, first, last) for every moving axis over chunks of the store
+	template <int Dimensions, bool Precise, class Body>
+	void forEachAxis(const BodyState<Precise> &state, ThreadPool &pool, const Body &body)
+	{
+		pool.parallelFor(0, state.count, INTEGRATION_GRAIN, [&](const size_t first, const size_t last)
+		{
+			for (int axis = 0; axis < Dimensions; ++axis)
+			{
+				body(axis, state.axes[axis], first, last);
+			}
+		});
+	}
+
+	template <int Dimensions, bool Precise>
+	void kick(const BodyState<Precise> &state, const double dt, ThreadPool &pool)
+	{
+		using Real = typename BodyState<Precise>::Real;
+		const auto step = static_cast<Real>(dt);
+		forEachAxis<Dimensions>(state, pool, [step](int, const typename BodyState<Precise>::Axis axis, const size_t first, const size_t last)
+		{
+			for (auto i = first; i < last; ++i)
+			{
+				axis.setVelocity(i, axis.v[i] + axis.a[i] * step);
+			}
+		});
+	}
+
+	template <int Dimensions, bool Precise>
+	void drift(const BodyState<Precise> &state, const double dt, ThreadPool &pool)
+	{
+		using Real = typename BodyState<Precise>::Real;
+		const auto step = static_cast<Real>(dt);
+		forEachAxis<Dimensions>(state, pool, [step](int, const typename BodyState<Precise>::Axis axis, const size_t first, const size_t last)
+		{
+			for (auto i = first; i < last; ++i)
+			{
+				axis.setPosition(i, axis.x[i] + axis.v[i] * step);
+			}
+		});
+	}
+
+	// A kick followed by a drift in one sweep over memory
+	template <int Dimensions, bool Precise>
+	void kickDrift(const BodyState<Precise> &state, const double kickDt, const double driftDt, ThreadPool &pool)
+	{
+		using Real = typename BodyState<Precise>::Real;
+		const auto kickStep = static_cast<Real>(kickDt);
+		const auto driftStep = static_cast<Real>(driftDt);
+		forEachAxis<Dimensions>(state, pool, [=](int, const typename BodyState<Precise>::Axis axis, const size_t first, const size_t last)
+		{
+			for (auto i = first; i < last; ++i)
+			{
+				const Real velocity = axis.v[i] + axis.a[i] * kickStep;
+				axis.setVelocity(i, velocity);
+				axis.setPosition(i, axis.x[i] + velocity * driftStep);
+			}
+		});
+	}
+
+	// Integrators drive a pipeline through ensureForces(), forces(),
+	// invalidateForces() and profiler(); they may keep scratch state
+	struct Leapfrog
+	{
+		template <int Dimensions, bool Precise, class Pipeline>
+		void step(Pipeline &pipeline, ParticleStore &particles, ForceSolver &solver, const float dt, ThreadPool &pool)
+		{
+			const BodyState<Precise> state(particles);
+			pipeline.ensureForces(particles, solver, pool);
+			{
+				ScopedTimer timer(pipeline.profiler(), "kick+drift");
+				kick<Dimensions>(state, 0.5 * dt, pool);
+				drift<Dimensions>(state, dt, pool);
+			}
+			pipeline.forces(particles, solver, pool);
+			{
+				ScopedTimer timer(pipeline.profiler(), "kick");
+				kick<Dimensions>(state, 0.5 * dt, pool);
+			}
+		}
+	};
+
+	// x += v dt + a dt^2 / 2 written as a fused half kick and drift: one pass
+	// less than Leapfrog for the same trajectory up to rounding
+	struct VelocityVerlet
+	{
+		template <int Dimensions, bool Precise, class Pipeline>
+		void step(Pipeline &pipeline, ParticleStore &particles, ForceSolver &solver, const float dt, ThreadPool &pool)
+		{
+			const BodyState<Precise> state(particles);
+			pipeline.ensureForces(particles, solver, pool);
+			{
+				ScopedTimer timer(pipeline.profiler(), "kick+drift");
+				kickDrift<Dimensions>(state, 0.5 * dt, dt, pool);
+			}
+			pipeline.forces(particles, solver, pool);
+			{
+				ScopedTimer timer(pipeline.profiler(), "kick");
+				kick<Dimensions>(state, 0.5 * dt, pool);
+			}
+		}
+	};
+
+	// Yoshida (1990) triple jump: leapfrog substeps of w1, w0, w1 times dt with
+	// the adjacent half kicks merged; three force evaluations per step
+	struct Yoshida4
+	{
+		template <int Dimensions, bool Precise, class Pipeline>
+		void step(Pipeline &pipeline, ParticleStore &particles, ForceSolver &solver, const float dt, ThreadPool &pool)
+		{
+			const double w1 = 1.0 / (2.0 - std::cbrt(2.0));
+			const double w0 = 1.0 - 2.0 * w1;
+			const double drifts[3] = { w1 * dt, w0 * dt, w1 * dt };
+			const double kicks[3] = { 0.5 * w1 * dt, 0.5 * (w1 + w0) * dt, 0.5 * (w0 + w1) * dt };
+
+			const BodyState<Precise> state(particles);
+			pipeline.ensureForces(particles, solver, pool);
+			for (int substep = 0; substep < 3; ++substep)
+			{
+				{
+					ScopedTimer timer(pipeline.profiler(), "kick+drift");
+					kickDrift<Dimensions>(state, kicks[substep], drifts[substep], pool);
+				}
+				pipeline.forces(particles, solver, pool);
+			}
+			{
+				ScopedTimer timer(pipeline.profiler(), "kick");
+				kick<Dimensions>(state, 0.5 * w1 * dt, pool);
+			}
+		}
+	};
+
+	// Classical fourth-order Runge-Kutta on (x, v). Stages overwrite the store so
+	// the solver sees them; the start state and the weighted sums of the stage
+	// derivatives are kept in double scratch arrays.
+	struct Rk4
+	{
+		template <int Dimensions, bool Precise, class Pipeline>
+		void step(Pipeline &pipeline, ParticleStore &particles, ForceSolver &solver, const float dt, ThreadPool &pool)
+		{
+			const BodyState<Precise> state(particles);
+			for (int axis = 0; axis < Dimensions; ++axis)
+			{
+				m_startX[axis].resize(state.count);
+				m_startV[axis].resize(state.count);
+				m_sumX[axis].resize(state.count);
+				m_sumV[axis].resize(state.count);
+			}
+
+			pipeline.ensureForces(particles, solver, pool);
+			{
+				ScopedTimer timer(pipeline.profiler(), "rk4 stage");
+				forEachAxis<Dimensions>(state, pool, [this](const int index, const typename BodyState<Precise>::Axis axis, const size_t first, const size_t last)
+				{
+					std::copy(axis.x + first, axis.x + last, m_startX[index].data() + first);
+					std::copy(axis.v + first, axis.v + last, m_startV[index].data() + first);
+					std::fill(m_sumX[index].data() + first, m_sumX[index].data() + last, 0.0);
+					std::fill(m_sumV[index].data() + first, m_sumV[index].data() + last, 0.0);
+				});
+			}
+
+			// Stage k adds its derivative with weight b[k] and moves to start + c[k] dt * derivative
+			const double b[4] = { 1.0, 2.0, 2.0, 1.0 };
+			const double c[3] = { 0.5 * dt, 0.5 * dt, dt };
+			for (int stage = 0; stage < 3; ++stage)
+			{
+				{
+					ScopedTimer timer(pipeline.profiler(), "rk4 stage");
+					advance<Dimensions>(state, b[stage], c[stage], pool);
+				}
+				pipeline.forces(particles, solver, pool);
+			}
+
+			{
+				ScopedTimer timer(pipeline.profiler(), "rk4 stage");
+				const double weight = dt / 6.0;
+				forEachAxis<Dimensions>(state, pool, [this, weight](const int index, const typename BodyState<Precise>::Axis axis, const size_t first, const size_t last)
+				{
+					const auto *startX = m_startX[index].data();
+					const auto *startV = m_startV[index].data();
+					const auto *sumX = m_sumX[index].data();
+					const auto *sumV = m_sumV[index].data();
+					for (auto i = first; i < last; ++i)
+					{
+						axis.setPosition(i, startX[i] + weight * (sumX[i] + axis.v[i]));
+					}
+					for (auto i = first; i < last; ++i)
+					{
+						axis.setVelocity(i, startV[i] + weight * (sumV[i] + axis.a[i]));
+					}
+				});
+			}
+			// The end state was never evaluated
+			pipeline.invalidateForces();
+		}
+
+	private:
+		template <int Dimensions, bool Precise>
+		void advance(const BodyState<Precise> &state, const double weight, const double offset, ThreadPool &pool)
+		{
+			forEachAxis<Dimensions>(state, pool, [this, weight, offset](const int index, const typename BodyState<Precise>::Axis axis, const size_t first, const size_t last)
+			{
+				const auto *startX = m_startX[index].data();
+				const auto *startV = m_startV[index].data();
+				auto *sumX = m_sumX[index].data();
+				auto *sumV = m_sumV[index].data();
+				// Positions first, they need the velocities of this stage. Two
+				// loops also keep the streams few enough for the vectorizer's
+				// runtime alias checks.
+				for (auto i = first; i < last; ++i)
+				{
+					const double v = axis.v[i];
+					sumX[i] += weight * v;
+					axis.setPosition(i, startX[i] + offset * v);
+				}
+				for (auto i = first; i < last; ++i)
+				{
+					const double a = axis.a[i];
+					sumV[i] += weight * a;
+					axis.setVelocity(i, startV[i] + offset * a);
+				}
+			});
+		}
+
+		AlignedBuffer<double> m_startX[3], m_startV[3];
+		AlignedBuffer<double> m_sumX[3], m_sumV[3];
+	};
+
+	template <int Dimensions, class Integrator, class Law>
+	class SpecializedPipeline : public StepPipeline
+	{
+	public:
+		using StepPipeline::StepPipeline;
+
+		void step(ParticleStore &particles, ForceSolver &solver, const float dt, ThreadPool &pool) override
+		{
+			if (particles.doublePrecision())
+			{
+				m_integrator.template step<Dimensions, true>(*this, particles, solver, dt, pool);
+			}
+			else
+			{
+				m_integrator.template step<Dimensions, false>(*this, particles, solver, dt, pool);
+			}
+		}
+
+		void forces(ParticleStore &particles, ForceSolver &solver, ThreadPool &pool)
+		{
+			ScopedTimer timer(m_profiler, "forces");
+			if constexpr (Dimensions == 3 && std::is_same<Law, PlummerSoftening>::value)
+			{
+				solver.computeAccelerations(particles, pool);
+			}
+			else
+			{
+				computeDirect<Dimensions, Law>(particles, solver.params(), pool);
+			}
+			m_accelerationsValid = true;
+		}
+
+		void ensureForces(ParticleStore &particles, ForceSolver &solver, ThreadPool &pool)
+		{
+			if (!m_accelerationsValid)
+			{
+				forces(particles, solver, pool);
+			}
+		}
+
+		void invalidateForces()
+		{
+			m_accelerationsValid = false;
+		}
+
+		Profiler *profiler() const
+		{
+			return m_profiler;
+		}
+
+	private:
+		Integrator m_integrator;
+	};
+
+	template <int Dimensions, class Integrator>
+	std::unique_ptr<StepPipeline> createWithLaw(const StepConfig &config)
+	{
+		switch (config.forceLaw)
+		{
+		case ForceLaw::Plummer:
+			return std::make_unique<SpecializedPipeline<Dimensions, Integrator, PlummerSoftening>>(config);
+		case ForceLaw::Spline:
+			return std::make_unique<SpecializedPipeline<Dimensions, Integrator, SplineSoftening>>(config);
+		}
+		throw std::invalid_argument("unknown force law");
+	}
+
+	template <int Dimensions>
+	std::unique_ptr<StepPipeline> createWithDimensions(const StepConfig &config)
+	{
+		switch (config.integrator)
+		{
+		case IntegratorKind::Leapfrog:
+			return createWithLaw<Dimensions, Leapfrog>(config);
+		case IntegratorKind::VelocityVerlet:
+			return createWithLaw<Dimensions, VelocityVerlet>(config);
+		case IntegratorKind::Yoshida4:
+			return createWithLaw<Dimensions, Yoshida4>(config);
+		case IntegratorKind::Rk4:
+			return createWithLaw<Dimensions, Rk4>(config);
+		}
+		throw std::invalid_argument("unknown integrator");
+	}
+}
+
+std::unique_ptr<StepPipeline> createStepPipeline(const StepConfig &config)
+{
+	switch (config.dimensions)
+	{
+	case 2:
+		return createWithDimensions<2>(config);
+	case 3:
+		return createWithDimensions<3>(config);
+	default:
+		throw std::invalid_argument("dimensions must be 2 or 3");
+	}
+}
+
+void computeSpecializedAccelerations(const StepConfig &config, ParticleStore &particles, const GravityParams &params, ThreadPool &pool)
+{
+	const auto spline = config.forceLaw == ForceLaw::Spline;
+	switch (config.dimensions)
+	{
+	case 2:
+		return spline ? computeDirect<2, SplineSoftening>(particles, params, pool) : computeDirect<2, PlummerSoftening>(particles, params, pool);
+	case 3:
+		return spline ? computeDirect<3, SplineSoftening>(particles, params, pool) : computeDirect<3, PlummerSoftening>(particles, params, pool);
+	default:
+		throw std::invalid_argument("dimensions must be 2 or 3");
+	}
+}
+
+const char *integratorName(const IntegratorKind kind)
+{
+	switch (kind)
+	{
+	case IntegratorKind::Leapfrog:
+		return "leapfrog";
+	case IntegratorKind::VelocityVerlet:
+		return "verlet";
+	case IntegratorKind::Yoshida4:
+		return "yoshida4";
+	case IntegratorKind::Rk4:
+		return "rk4";
+	}
+	return "unknown";
+}
+
+const char *forceLawName(const ForceLaw law)
+{
+	switch (law)
+	{
+	case ForceLaw::Plummer:
+		return "plummer";
+	case ForceLaw::Spline:
+		return "spline";
+	}
+	return "unknown";
+}
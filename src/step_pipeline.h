@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "force_solver.h"
+
+class ParticleStore;
+class Profiler;
+class ThreadPool;
+
+enum class IntegratorKind
+{
+	Leapfrog,			// kick-drift-kick, one force evaluation per step
+	VelocityVerlet,		// the same scheme with the first kick fused into the drift sweep
+	Yoshida4,			// fourth-order symplectic composition of three leapfrog substeps
+	Rk4					// classical Runge-Kutta, four force evaluations, not symplectic
+};
+
+enum class ForceLaw
+{
+	Plummer,			// 1 / (r^2 + eps^2)^(3/2)
+	Spline				// cubic spline kernel of support 2.8 eps, exactly Newtonian beyond it
+};
+
+struct StepConfig
+{
+	// 2 moves bodies in the xy plane only, as drawn by simple.vert; z and vz are left alone
+	uint32_t dimensions = 3;
+	IntegratorKind integrator = IntegratorKind::Leapfrog;
+	ForceLaw forceLaw = ForceLaw::Plummer;
+};
+
+// One time step of a store. Every combination of StepConfig is a separate
+// instantiation whose integration loops and force kernel are inlined and free
+// of runtime switches; createStepPipeline() is the only place that dispatches.
+//
+// 3D Plummer forces come from the solver passed to step(), so every backend
+// and its hand-written SIMD kernels keep working. The other combinations sum
+// directly with their own kernel, vectorized over targets by the compiler.
+class StepPipeline
+{
+public:
+	explicit StepPipeline(const StepConfig &config)
+		: m_config(config)
+	{
+	}
+
+	virtual ~StepPipeline() = default;
+
+	virtual void step(ParticleStore &particles, ForceSolver &solver, float dt, ThreadPool &pool) = 0;
+
+	const StepConfig &config() const
+	{
+		return m_config;
+	}
+
+	// Times the phases of step() when set; may be null
+	void setProfiler(Profiler *profiler)
+	{
+		m_profiler = profiler;
+	}
+
+protected:
+	StepConfig m_config;
+	Profiler *m_profiler = nullptr;
+	// Accelerations in the store belong to its current positions
+	bool m_accelerationsValid = false;
+};
+
+// Throws std::invalid_argument for dimensions other than 2 and 3
+std::unique_ptr<StepPipeline> createStepPipeline(const StepConfig &config);
+
+// Direct summation with the dimensionality and force law of config, the kernel
+// the pipelines use where the solver does not apply
+void computeSpecializedAccelerations(const StepConfig &config, ParticleStore &particles, const GravityParams &params, ThreadPool &pool);
+
+const char *integratorName(IntegratorKind kind);
+const char *forceLawName(ForceLaw law);
@@ -0,0 +1,24 @@
+#include "streaming_buffer.h"
+
+#include <algorithm>
+
+StreamingRingBuffer::StreamingRingBuffer(
+	vk::Device device,
+	DeviceAllocator &allocator,
+	const vk::DeviceSize regionSize,
+	const uint32_t regionCount,
+	const vk::BufferUsageFlags usage)
+	: m_regionSize(regionSize)
+{
+	// Keeping regions atom-aligned leaves room for flushing non-coherent memory
+	auto limits = allocator.physicalDevice().getProperties().limits;
+	auto alignment = std::max<vk::DeviceSize>(limits.nonCoherentAtomSize, 64);
+	m_regionStride = (regionSize + alignment - 1) / alignment * alignment;
+
+	vk::BufferCreateInfo bufferInfo(vk::BufferCreateFlags(), m_regionStride * regionCount, usage);
+	m_buffer = device.createBufferUnique(bufferInfo);
+	m_memory = allocator.bindBuffer(
+		m_buffer.get(),
+		vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+	);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+#include <vulkan/vulkan.hpp>
+
+#include "vulkan_memory.h"
+
+// One persistently mapped host-visible buffer split into equally sized regions,
+// one per frame in flight. A frame only writes its own region after its fence
+// signalled, so streaming never waits on the other frames.
+class StreamingRingBuffer
+{
+public:
+	StreamingRingBuffer() = default;
+
+	StreamingRingBuffer(
+		vk::Device device,
+		DeviceAllocator &allocator,
+		vk::DeviceSize regionSize,
+		uint32_t regionCount,
+		vk::BufferUsageFlags usage
+	);
+
+	vk::Buffer buffer() const
+	{
+		return m_buffer.get();
+	}
+
+	vk::DeviceSize regionSize() const
+	{
+		return m_regionSize;
+	}
+
+	vk::DeviceSize offset(const uint32_t region) const
+	{
+		return region * m_regionStride;
+	}
+
+	void *region(const uint32_t region) const
+	{
+		return static_cast<char *>(m_memory.mapped()) + offset(region);
+	}
+
+private:
+	vk::UniqueBuffer m_buffer;
+	DeviceAllocation m_memory;
+	vk::DeviceSize m_regionSize = 0;
+	vk::DeviceSize m_regionStride = 0;
+};
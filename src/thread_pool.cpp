@@ -0,0 +1,246 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace
+{
+	constexpr size_t NOT_A_WORKER = static_cast<size_t>(-1);
+	constexpr int SPINS_BEFORE_SLEEP = 64;
+
+	thread_local const ThreadPool *tl_pool = nullptr;
+	thread_local size_t tl_workerIndex = NOT_A_WORKER;
+}
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	auto workerCount = threadCount - 1;
+	for (size_t i = 0; i < workerCount + 1; ++i)
+	{
+		m_queues.push_back(std::make_unique<WorkQueue>());
+	}
+
+	m_workers.reserve(workerCount);
+	for (size_t i = 0; i < workerCount; ++i)
+	{
+		m_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+
+	for (auto &worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+size_t ThreadPool::currentThreadIndex() const
+{
+	return (tl_pool == this && tl_workerIndex != NOT_A_WORKER) ? tl_workerIndex + 1 : 0;
+}
+
+void ThreadPool::workerLoop(const size_t index)
+{
+	tl_pool = this;
+	tl_workerIndex = index;
+
+	int idleSpins = 0;
+	while (!m_stop)
+	{
+		if (tryRunOne())
+		{
+			idleSpins = 0;
+			continue;
+		}
+
+		if (++idleSpins < SPINS_BEFORE_SLEEP)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		++m_sleeping;
+		m_wake.wait(lock, [this] { return m_stop || m_queued > 0; });
+		--m_sleeping;
+		idleSpins = 0;
+	}
+}
+
+void ThreadPool::push(const Task &task)
+{
+	auto own = (tl_pool == this && tl_workerIndex != NOT_A_WORKER) ? tl_workerIndex : m_workers.size();
+	{
+		std::lock_guard<std::mutex> lock(m_queues[own]->mutex);
+		m_queues[own]->tasks.push_back(task);
+	}
+
+	++m_queued;
+	if (m_sleeping > 0)
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_wake.notify_one();
+	}
+}
+
+bool ThreadPool::tryPop(Task &task)
+{
+	const auto queueCount = m_queues.size();
+	const auto own = (tl_pool == this && tl_workerIndex != NOT_A_WORKER) ? tl_workerIndex : queueCount - 1;
+
+	// Newest work from our own queue keeps the cache warm
+	{
+		auto &queue = *m_queues[own];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tasks.empty())
+		{
+			task = queue.tasks.back();
+			queue.tasks.pop_back();
+			--m_queued;
+			return true;
+		}
+	}
+
+	// Otherwise steal the oldest, i.e. largest, chunk from someone else
+	for (size_t offset = 1; offset < queueCount; ++offset)
+	{
+		auto &queue = *m_queues[(own + offset) % queueCount];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tasks.empty())
+		{
+			task = queue.tasks.front();
+			queue.tasks.pop_front();
+			--m_queued;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool ThreadPool::tryRunOne()
+{
+	Task task;
+	if (!tryPop(task))
+	{
+		return false;
+	}
+
+	task.execute(*this, task);
+	return true;
+}
+
+void ThreadPool::helpUntil(const std::atomic<size_t> &pending)
+{
+	while (pending > 0)
+	{
+		if (!tryRunOne())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void ThreadPool::runFor(void (*invoke)(const void *, size_t, size_t), const void *body, const size_t begin, const size_t end, const size_t grain)
+{
+	ForContext context;
+	context.invoke = invoke;
+	context.body = body;
+	context.grain = std::max<size_t>(grain, 1);
+	context.pending = 1;
+
+	executeFor(*this, Task{&ThreadPool::executeFor, &context, begin, end});
+	helpUntil(context.pending);
+
+	if (context.error)
+	{
+		std::rethrow_exception(context.error);
+	}
+}
+
+void ThreadPool::executeFor(ThreadPool &pool, const Task &task)
+{
+	auto &context = *static_cast<ForContext *>(task.context);
+	auto begin = task.begin;
+	auto end = task.end;
+
+	while (end - begin > context.grain)
+	{
+		auto mid = begin + (end - begin) / 2;
+		++context.pending;
+		pool.push(Task{&ThreadPool::executeFor, &context, mid, end});
+		end = mid;
+	}
+
+	try
+	{
+		context.invoke(context.body, begin, end);
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(context.errorMutex);
+		if (!context.error)
+		{
+			context.error = std::current_exception();
+		}
+	}
+
+	--context.pending;
+}
+
+void ThreadPool::executeGroupTask(ThreadPool &, const Task &task)
+{
+	std::unique_ptr<GroupTask> groupTask(static_cast<GroupTask *>(task.context));
+	auto *group = groupTask->group;
+
+	try
+	{
+		groupTask->function();
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(group->m_errorMutex);
+		if (!group->m_error)
+		{
+			group->m_error = std::current_exception();
+		}
+	}
+
+	--group->m_pending;
+}
+
+void ThreadPool::TaskGroup::run(std::function<void()> task)
+{
+	if (m_pool.m_workers.empty())
+	{
+		task();
+		return;
+	}
+
+	++m_pending;
+	auto *groupTask = new GroupTask{this, std::move(task)};
+	m_pool.push(Task{&ThreadPool::executeGroupTask, groupTask, 0, 0});
+}
+
+void ThreadPool::TaskGroup::wait()
+{
+	m_pool.helpUntil(m_pending);
+
+	if (m_error)
+	{
+		auto error = m_error;
+		m_error = nullptr;
+		std::rethrow_exception(error);
+	}
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing scheduler. Each worker owns a deque: it pushes and pops at
+// the back, while idle workers steal the oldest (largest) chunk from the
+// front. Threads that are not workers submit through a shared injection
+// deque and help execute tasks while they wait, so nested parallelism from
+// inside tasks never deadlocks.
+class ThreadPool
+{
+public:
+	// threadCount includes the calling thread; 0 picks the hardware concurrency.
+	explicit ThreadPool(size_t threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	size_t concurrency() const
+	{
+		return m_workers.size() + 1;
+	}
+
+	// Index in [0, concurrency()) of the calling thread; non-worker threads report 0.
+	size_t currentThreadIndex() const;
+
+	// Calls body(chunkBegin, chunkEnd) over [begin, end). Ranges are split lazily
+	// in halves down to `grain`, so idle threads steal big pieces first.
+	template <typename Body>
+	void parallelFor(size_t begin, size_t end, size_t grain, const Body &body);
+
+	class TaskGroup
+	{
+	public:
+		explicit TaskGroup(ThreadPool &pool)
+			: m_pool(pool)
+		{
+		}
+
+		~TaskGroup()
+		{
+			m_pool.helpUntil(m_pending);
+		}
+
+		void run(std::function<void()> task);
+
+		// Helps executing queued work until every task of this group finished; rethrows the first failure.
+		void wait();
+
+	private:
+		friend class ThreadPool;
+
+		ThreadPool &m_pool;
+		std::atomic<size_t> m_pending{0};
+		std::mutex m_errorMutex;
+		std::exception_ptr m_error;
+	};
+
+private:
+	struct Task
+	{
+		void (*execute)(ThreadPool &pool, const Task &task);
+		void *context;
+		size_t begin;
+		size_t end;
+	};
+
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	struct GroupTask
+	{
+		TaskGroup *group;
+		std::function<void()> function;
+	};
+
+	struct ForContext
+	{
+		void (*invoke)(const void *body, size_t begin, size_t end);
+		const void *body;
+		size_t grain;
+		std::atomic<size_t> pending{0};
+		std::mutex errorMutex;
+		std::exception_ptr error;
+	};
+
+	void workerLoop(size_t index);
+	void push(const Task &task);
+	bool tryPop(Task &task);
+	bool tryRunOne();
+	void helpUntil(const std::atomic<size_t> &pending);
+
+	void runFor(void (*invoke)(const void *, size_t, size_t), const void *body, size_t begin, size_t end, size_t grain);
+	static void executeFor(ThreadPool &pool, const Task &task);
+	static void executeGroupTask(ThreadPool &pool, const Task &task);
+
+	std::vector<std::thread> m_workers;
+	// One queue per worker plus the shared injection queue at the end
+	std::vector<std::unique_ptr<WorkQueue>> m_queues;
+	std::atomic<size_t> m_queued{0};
+	std::atomic<size_t> m_sleeping{0};
+	std::atomic<bool> m_stop{false};
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wake;
+};
+
+template <typename Body>
+void ThreadPool::parallelFor(const size_t begin, const size_t end, const size_t grain, const Body &body)
+{
+	if (begin >= end)
+	{
+		return;
+	}
+
+	if (m_workers.empty() || end - begin <= grain)
+	{
+		body(begin, end);
+		return;
+	}
+
+	runFor(
+		[](const void *erased, const size_t chunkBegin, const size_t chunkEnd)
+		{
+			(*static_cast<const Body *>(erased))(chunkBegin, chunkEnd);
+		},
+		&body, begin, end, grain
+	);
+}
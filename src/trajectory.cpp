@@ -0,0 +1,525 @@
+#include "trajectory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "particle_store.h"
+
+namespace
+{
+	constexpr char MAGIC[8] = { 'N', 'B', 'O', 'D', 'Y', 'T', 'R', 'J' };
+	constexpr size_t FIELD_COUNT = 6;
+	// Frames are small compared to this, so the file sees few large sequential writes
+	constexpr size_t WRITE_BUFFER_SIZE = 8 << 20;
+	constexpr size_t MAX_RUN = 128;
+
+	std::vector<float> TrajectoryFrame::*const FIELDS[FIELD_COUNT] = {
+		&TrajectoryFrame::x, &TrajectoryFrame::y, &TrajectoryFrame::z,
+		&TrajectoryFrame::vx, &TrajectoryFrame::vy, &TrajectoryFrame::vz
+	};
+
+	// Control byte c < 128 is followed by c + 1 literal bytes, c >= 128 stands
+	// for c - 127 zero bytes. Single zeros stay in the literal run.
+	class ZeroRunEncoder
+	{
+	public:
+		explicit ZeroRunEncoder(uint8_t *out)
+			: m_begin(out), m_out(out)
+		{
+		}
+
+		void push(const uint8_t value)
+		{
+			if (value == 0)
+			{
+				++m_zeros;
+				return;
+			}
+
+			if (m_zeros == 1)
+			{
+				literal(0);
+				m_zeros = 0;
+			}
+			else if (m_zeros > 1)
+			{
+				flushZeros();
+			}
+			literal(value);
+		}
+
+		size_t finish()
+		{
+			flushZeros();
+			return static_cast<size_t>(m_out - m_begin);
+		}
+
+	private:
+		void literal(const uint8_t value)
+		{
+			if (!m_control || *m_control == MAX_RUN - 1)
+			{
+				m_control = m_out++;
+				*m_control = 0;
+			}
+			else
+			{
+				++*m_control;
+			}
+			*m_out++ = value;
+		}
+
+		// Closes the current literal run
+		void flushZeros()
+		{
+			while (m_zeros > 0)
+			{
+				const auto run = std::min(m_zeros, MAX_RUN);
+				*m_out++ = static_cast<uint8_t>(127 + run);
+				m_zeros -= run;
+			}
+			m_control = nullptr;
+		}
+
+		uint8_t *m_begin;
+		uint8_t *m_out;
+		uint8_t *m_control = nullptr;
+		size_t m_zeros = 0;
+	};
+
+	uint32_t bitsOf(const float *values, const size_t i)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, values + i, sizeof(bits));
+		return bits;
+	}
+
+	void writeAll(std::FILE *file, const void *data, const size_t size)
+	{
+		if (size > 0 && std::fwrite(data, 1, size, file) != size)
+		{
+			throw std::runtime_error("could not write trajectory");
+		}
+	}
+
+	bool readAll(std::FILE *file, void *data, const size_t size)
+	{
+		return std::fread(data, 1, size, file) == size;
+	}
+}
+
+size_t xorDeltaBound(const size_t count)
+{
+	const auto bytes = count * sizeof(float);
+	return bytes + bytes / MAX_RUN + 2;
+}
+
+size_t encodeXorDelta(const float *values, const float *previous, const size_t count, uint8_t *dst)
+{
+	ZeroRunEncoder encoder(dst);
+
+	// Byte planes from the most significant one: sign and exponent bytes of
+	// bodies that barely moved XOR to zero and form long runs
+	for (int plane = 3; plane >= 0; --plane)
+	{
+		const auto shift = 8 * plane;
+		for (size_t i = 0; i < count; ++i)
+		{
+			auto bits = bitsOf(values, i);
+			if (previous)
+			{
+				bits ^= bitsOf(previous, i);
+			}
+			encoder.push(static_cast<uint8_t>(bits >> shift));
+		}
+	}
+
+	return encoder.finish();
+}
+
+size_t decodeXorDelta(const uint8_t *src, const size_t size, const float *previous, const size_t count, float *values)
+{
+	std::vector<uint32_t> bits(count, 0);
+
+	const auto total = count * sizeof(float);
+	size_t in = 0;
+	size_t out = 0;
+	auto emit = [&](const uint8_t value)
+	{
+		const auto plane = 3 - static_cast<int>(out / count);
+		bits[out % count] |= static_cast<uint32_t>(value) << (8 * plane);
+		++out;
+	};
+
+	while (out < total)
+	{
+		if (in >= size)
+		{
+			throw std::runtime_error("truncated trajectory field");
+		}
+
+		const auto control = src[in++];
+		const size_t run = control < MAX_RUN ? control + 1 : control - 127;
+		if (out + run > total || (control < MAX_RUN && in + run > size))
+		{
+			throw std::runtime_error("malformed trajectory field");
+		}
+
+		if (control < MAX_RUN)
+		{
+			for (size_t i = 0; i < run; ++i)
+			{
+				emit(src[in++]);
+			}
+		}
+		else
+		{
+			out += run;
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		auto value = bits[i];
+		if (previous)
+		{
+			value ^= bitsOf(previous, i);
+		}
+		std::memcpy(values + i, &value, sizeof(value));
+	}
+	return in;
+}
+
+TrajectoryWriter::TrajectoryWriter(const std::string &path, const size_t bodyCount, const TrajectoryCompression compression, const uint64_t interval)
+	: m_bodyCount(bodyCount), m_compression(compression), m_interval(std::max<uint64_t>(interval, 1))
+{
+	m_file = std::fopen(path.c_str(), "wb");
+	if (!m_file)
+	{
+		throw std::runtime_error("could not open trajectory output: " + path);
+	}
+	std::setvbuf(m_file, nullptr, _IOFBF, WRITE_BUFFER_SIZE);
+
+	TrajectoryHeader header = {};
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.compression = static_cast<uint32_t>(compression);
+	header.bodyCount = bodyCount;
+	writeAll(m_file, &header, sizeof(header));
+
+	m_thread = std::thread(&TrajectoryWriter::run, this);
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+	try
+	{
+		close();
+	}
+	catch (...)
+	{
+		// Errors surface through close() for callers that care
+	}
+}
+
+void TrajectoryWriter::capture(const ParticleStore &particles, const uint64_t step, const double time)
+{
+	if (step % m_interval != 0)
+	{
+		return;
+	}
+	if (particles.size() != m_bodyCount)
+	{
+		throw std::invalid_argument("trajectory body count changed");
+	}
+
+	auto &slot = m_slots[m_nextSlot];
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (slot.queued)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			m_queuedChanged.wait(lock, [&] { return !slot.queued || m_error; });
+			m_stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+	}
+	checkError();
+
+	// The slot is not queued, so the I/O thread does not touch it
+	auto &frame = slot.frame;
+	frame.step = step;
+	frame.time = time;
+	for (size_t field = 0; field < FIELD_COUNT; ++field)
+	{
+		(frame.*FIELDS[field]).resize(m_bodyCount);
+	}
+
+	// Frames list bodies by id, so a body keeps its place (and the XOR delta its
+	// small residuals) when the store is reordered. Float positions of a
+	// mixed-precision store are relative to its origin, so those come from the
+	// double arrays.
+	const auto *ids = particles.id.data();
+	for (size_t i = 0; i < m_bodyCount; ++i)
+	{
+		if (ids[i] >= m_bodyCount)
+		{
+			throw std::invalid_argument("body id out of range");
+		}
+	}
+	auto scatter = [&](std::vector<float> &values, auto &&value)
+	{
+		for (size_t i = 0; i < m_bodyCount; ++i)
+		{
+			values[ids[i]] = value(i);
+		}
+	};
+	if (particles.doublePrecision())
+	{
+		scatter(frame.x, [&](const size_t i) { return static_cast<float>(particles.xd[i]); });
+		scatter(frame.y, [&](const size_t i) { return static_cast<float>(particles.yd[i]); });
+		scatter(frame.z, [&](const size_t i) { return static_cast<float>(particles.zd[i]); });
+	}
+	else
+	{
+		scatter(frame.x, [&](const size_t i) { return particles.x[i]; });
+		scatter(frame.y, [&](const size_t i) { return particles.y[i]; });
+		scatter(frame.z, [&](const size_t i) { return particles.z[i]; });
+	}
+	scatter(frame.vx, [&](const size_t i) { return particles.vx[i]; });
+	scatter(frame.vy, [&](const size_t i) { return particles.vy[i]; });
+	scatter(frame.vz, [&](const size_t i) { return particles.vz[i]; });
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		slot.queued = true;
+	}
+	m_queuedChanged.notify_all();
+	m_nextSlot ^= 1;
+}
+
+void TrajectoryWriter::close()
+{
+	if (m_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_closing = true;
+		}
+		m_queuedChanged.notify_all();
+		m_thread.join();
+	}
+
+	if (m_file)
+	{
+		const auto failed = std::fclose(m_file) != 0;
+		m_file = nullptr;
+		if (failed && !m_error)
+		{
+			m_error = std::make_exception_ptr(std::runtime_error("could not write trajectory"));
+		}
+	}
+	checkError();
+}
+
+uint64_t TrajectoryWriter::framesWritten() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_framesWritten;
+}
+
+uint64_t TrajectoryWriter::bytesWritten() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_bytesWritten;
+}
+
+double TrajectoryWriter::stallSeconds() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stallSeconds;
+}
+
+void TrajectoryWriter::checkError()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_error)
+	{
+		std::rethrow_exception(m_error);
+	}
+}
+
+void TrajectoryWriter::run()
+{
+	for (;;)
+	{
+		auto &slot = m_slots[m_writeSlot];
+		bool failed;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_queuedChanged.wait(lock, [&] { return slot.queued || m_closing; });
+			if (!slot.queued)
+			{
+				return;
+			}
+			failed = static_cast<bool>(m_error);
+		}
+
+		// After a failure frames are only released, so capture() never waits forever
+		if (!failed)
+		{
+			try
+			{
+				writeFrame(slot.frame);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_error = std::current_exception();
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			slot.queued = false;
+		}
+		m_queuedChanged.notify_all();
+		m_writeSlot ^= 1;
+	}
+}
+
+void TrajectoryWriter::writeFrame(const TrajectoryFrame &frame)
+{
+	const bool keyframe = m_framesSinceKeyframe >= KEYFRAME_INTERVAL;
+	m_framesSinceKeyframe = keyframe ? 1 : m_framesSinceKeyframe + 1;
+
+	const auto rawBytes = m_bodyCount * sizeof(float);
+	const auto fieldBound = m_compression == TrajectoryCompression::XorDelta ? xorDeltaBound(m_bodyCount) : rawBytes;
+	m_payload.resize(FIELD_COUNT * (sizeof(uint64_t) + fieldBound));
+
+	size_t size = 0;
+	for (size_t field = 0; field < FIELD_COUNT; ++field)
+	{
+		const auto &values = frame.*FIELDS[field];
+		auto *dst = m_payload.data() + size + sizeof(uint64_t);
+
+		uint64_t fieldBytes = rawBytes;
+		if (m_compression == TrajectoryCompression::XorDelta)
+		{
+			const auto *previous = keyframe ? nullptr : m_previous[field].data();
+			fieldBytes = encodeXorDelta(values.data(), previous, m_bodyCount, dst);
+			m_previous[field] = values;
+		}
+		else
+		{
+			std::memcpy(dst, values.data(), rawBytes);
+		}
+
+		std::memcpy(m_payload.data() + size, &fieldBytes, sizeof(fieldBytes));
+		size += sizeof(uint64_t) + fieldBytes;
+	}
+
+	TrajectoryFrameHeader header = {};
+	header.step = frame.step;
+	header.time = frame.time;
+	header.payloadBytes = size;
+	header.keyframe = keyframe ? 1 : 0;
+
+	writeAll(m_file, &header, sizeof(header));
+	writeAll(m_file, m_payload.data(), size);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	++m_framesWritten;
+	m_bytesWritten += sizeof(header) + size;
+}
+
+TrajectoryReader::TrajectoryReader(const std::string &path)
+{
+	m_file = std::fopen(path.c_str(), "rb");
+	if (!m_file)
+	{
+		throw std::runtime_error("could not open trajectory: " + path);
+	}
+	std::setvbuf(m_file, nullptr, _IOFBF, WRITE_BUFFER_SIZE);
+
+	TrajectoryHeader header;
+	if (!readAll(m_file, &header, sizeof(header)) || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+	{
+		std::fclose(m_file);
+		throw std::runtime_error("not a trajectory: " + path);
+	}
+	if (header.version != TrajectoryWriter::VERSION || header.compression > static_cast<uint32_t>(TrajectoryCompression::XorDelta))
+	{
+		std::fclose(m_file);
+		throw std::runtime_error("unsupported trajectory version: " + path);
+	}
+
+	m_bodyCount = static_cast<size_t>(header.bodyCount);
+	m_compression = static_cast<TrajectoryCompression>(header.compression);
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+	std::fclose(m_file);
+}
+
+bool TrajectoryReader::next(TrajectoryFrame &frame)
+{
+	TrajectoryFrameHeader header;
+	if (!readAll(m_file, &header, sizeof(header)))
+	{
+		return false;
+	}
+
+	m_payload.resize(header.payloadBytes);
+	if (!readAll(m_file, m_payload.data(), m_payload.size()))
+	{
+		throw std::runtime_error("truncated trajectory frame");
+	}
+
+	frame.step = header.step;
+	frame.time = header.time;
+
+	const auto rawBytes = m_bodyCount * sizeof(float);
+	size_t offset = 0;
+	for (size_t field = 0; field < FIELD_COUNT; ++field)
+	{
+		uint64_t fieldBytes;
+		if (offset + sizeof(fieldBytes) > m_payload.size())
+		{
+			throw std::runtime_error("truncated trajectory frame");
+		}
+		std::memcpy(&fieldBytes, m_payload.data() + offset, sizeof(fieldBytes));
+		offset += sizeof(fieldBytes);
+		if (fieldBytes > m_payload.size() - offset)
+		{
+			throw std::runtime_error("truncated trajectory frame");
+		}
+
+		auto &values = frame.*FIELDS[field];
+		values.resize(m_bodyCount);
+		if (m_compression == TrajectoryCompression::XorDelta)
+		{
+			if (!header.keyframe && m_previous[field].size() != m_bodyCount)
+			{
+				throw std::runtime_error("trajectory delta frame without a keyframe");
+			}
+			const auto *previous = header.keyframe ? nullptr : m_previous[field].data();
+			decodeXorDelta(m_payload.data() + offset, fieldBytes, previous, m_bodyCount, values.data());
+			m_previous[field] = values;
+		}
+		else
+		{
+			if (fieldBytes != rawBytes)
+			{
+				throw std::runtime_error("malformed trajectory frame");
+			}
+			std::memcpy(values.data(), m_payload.data() + offset, rawBytes);
+		}
+		offset += fieldBytes;
+	}
+
+	return true;
+}
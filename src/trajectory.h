@@ -0,0 +1,147 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ParticleStore;
+
+enum class TrajectoryCompression : uint32_t
+{
+	None,
+	// Bits XORed with the previous frame, split into byte planes and zero-run
+	// encoded: slowly moving bodies leave the sign/exponent planes almost empty
+	XorDelta
+};
+
+// Positions and velocities of every body at one captured step, indexed by
+// ParticleStore::id
+struct TrajectoryFrame
+{
+	uint64_t step = 0;
+	double time = 0.0;
+	std::vector<float> x, y, z, vx, vy, vz;
+};
+
+// File layout: a TrajectoryHeader, then per frame a TrajectoryFrameHeader and
+// its payload (the six fields in order, each raw or encoded). Every
+// KEYFRAME_INTERVAL-th frame is encoded against zeros, so a damaged file can be
+// read again from the next keyframe.
+struct TrajectoryHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t compression;
+	uint64_t bodyCount;
+};
+
+struct TrajectoryFrameHeader
+{
+	uint64_t step;
+	double time;
+	uint64_t payloadBytes;
+	uint32_t keyframe;
+	uint32_t reserved;
+};
+
+// Streams trajectory frames to disk from a background thread. capture() only
+// copies the fields into one of two frame buffers and hands it over; encoding
+// and writing happen on the I/O thread while the simulation keeps stepping.
+// capture() waits only when both buffers are still queued, i.e. when the disk
+// cannot keep up with the capture rate on average. I/O errors are rethrown by
+// the next capture() or by close().
+class TrajectoryWriter
+{
+public:
+	static constexpr uint32_t VERSION = 1;
+	static constexpr uint32_t KEYFRAME_INTERVAL = 64;
+
+	TrajectoryWriter(const std::string &path, size_t bodyCount, TrajectoryCompression compression, uint64_t interval);
+	~TrajectoryWriter();
+
+	TrajectoryWriter(const TrajectoryWriter &) = delete;
+	TrajectoryWriter &operator=(const TrajectoryWriter &) = delete;
+
+	// Captures the store when step is a multiple of the interval
+	void capture(const ParticleStore &particles, uint64_t step, double time);
+
+	// Writes every queued frame and closes the file
+	void close();
+
+	uint64_t framesWritten() const;
+	uint64_t bytesWritten() const;
+	// Time capture() spent waiting for a free buffer
+	double stallSeconds() const;
+
+private:
+	struct Slot
+	{
+		TrajectoryFrame frame;
+		bool queued = false;
+	};
+
+	void run();
+	void writeFrame(const TrajectoryFrame &frame);
+	void checkError();
+
+	std::FILE *m_file = nullptr;
+	size_t m_bodyCount;
+	TrajectoryCompression m_compression;
+	uint64_t m_interval;
+
+	Slot m_slots[2];
+	size_t m_nextSlot = 0;			// capture side
+	size_t m_writeSlot = 0;			// I/O side
+
+	// Owned by the I/O thread
+	std::vector<float> m_previous[6];
+	std::vector<uint8_t> m_payload;
+	uint64_t m_framesSinceKeyframe = KEYFRAME_INTERVAL;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_queuedChanged;
+	bool m_closing = false;
+	std::exception_ptr m_error;
+	uint64_t m_framesWritten = 0;
+	uint64_t m_bytesWritten = 0;
+	double m_stallSeconds = 0.0;
+	std::thread m_thread;
+};
+
+// Sequential reader for analysis tools
+class TrajectoryReader
+{
+public:
+	explicit TrajectoryReader(const std::string &path);
+	~TrajectoryReader();
+
+	TrajectoryReader(const TrajectoryReader &) = delete;
+	TrajectoryReader &operator=(const TrajectoryReader &) = delete;
+
+	size_t bodyCount() const
+	{
+		return m_bodyCount;
+	}
+
+	// False at the end of the file; throws std::runtime_error on corrupt frames
+	bool next(TrajectoryFrame &frame);
+
+private:
+	std::FILE *m_file = nullptr;
+	size_t m_bodyCount = 0;
+	TrajectoryCompression m_compression = TrajectoryCompression::None;
+	std::vector<float> m_previous[6];
+	std::vector<uint8_t> m_payload;
+};
+
+// Exposed for tools; dst receives at most xorDeltaBound(count) bytes
+size_t xorDeltaBound(size_t count);
+size_t encodeXorDelta(const float *values, const float *previous, size_t count, uint8_t *dst);
+// Returns the number of bytes consumed; throws std::runtime_error on malformed input
+size_t decodeXorDelta(const uint8_t *src, size_t size, const float *previous, size_t count, float *values);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Single-producer single-consumer triple buffer. The producer fills back() and
+// publish()es it; the consumer picks up the newest published value with
+// update() and reads front(). Neither side ever waits for the other: a value
+// published while the consumer still reads the previous one simply replaces
+// any value that was not picked up yet.
+template <typename T>
+class TripleBuffer
+{
+public:
+	// Producer side
+	T &back()
+	{
+		return m_slots[m_back];
+	}
+
+	void publish()
+	{
+		const auto previous = m_shared.exchange(static_cast<uint8_t>(m_back | FRESH), std::memory_order_acq_rel);
+		m_back = previous & INDEX_MASK;
+	}
+
+	// Consumer side; returns true when front() changed
+	bool update()
+	{
+		if (!(m_shared.load(std::memory_order_relaxed) & FRESH))
+		{
+			return false;
+		}
+
+		const auto previous = m_shared.exchange(m_front, std::memory_order_acq_rel);
+		m_front = previous & INDEX_MASK;
+		return true;
+	}
+
+	const T &front() const
+	{
+		return m_slots[m_front];
+	}
+
+private:
+	static constexpr uint8_t INDEX_MASK = 0x3;
+	static constexpr uint8_t FRESH = 0x4;
+
+	std::array<T, 3> m_slots;
+	// Index of the slot in the middle, plus FRESH while the consumer has not seen it
+	alignas(64) std::atomic<uint8_t> m_shared{1};
+	alignas(64) uint8_t m_back = 0;
+	alignas(64) uint8_t m_front = 2;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <vulkan/vulkan.hpp>
+
+#include <glm/glm.hpp>
+
+// Only positions are streamed every frame (binding 0); the packed RGBA8 body
+// colors never change and live in device-local memory (binding 1).
+struct Vertex
+{
+	glm::vec2 pos;
+
+	static std::array<vk::VertexInputBindingDescription, 2> getBindingDescription()
+	{
+		return {
+			vk::VertexInputBindingDescription(0, sizeof(Vertex)),
+			vk::VertexInputBindingDescription(1, sizeof(uint32_t))
+		};
+	}
+
+	static std::array<vk::VertexInputAttributeDescription, 2> getAttributeDescription()
+	{
+		return {
+			vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32Sfloat, offsetof(Vertex, pos)),
+			vk::VertexInputAttributeDescription(1, 1, vk::Format::eR8G8B8A8Unorm, 0)
+		};
+	}
+};
+
+// One instance of the point-sprite mode: the position is quantized to 16-bit
+// unorm inside the frame's bounding box (SpriteParams), 4 bytes per body. The
+// quad itself is expanded from gl_VertexIndex in simple.vert.
+struct SpriteInstance
+{
+	uint16_t x;
+	uint16_t y;
+
+	static std::array<vk::VertexInputBindingDescription, 2> getBindingDescription()
+	{
+		return {
+			vk::VertexInputBindingDescription(0, sizeof(SpriteInstance), vk::VertexInputRate::eInstance),
+			vk::VertexInputBindingDescription(1, sizeof(uint32_t), vk::VertexInputRate::eInstance)
+		};
+	}
+
+	static std::array<vk::VertexInputAttributeDescription, 2> getAttributeDescription()
+	{
+		return {
+			vk::VertexInputAttributeDescription(0, 0, vk::Format::eR16G16Unorm, 0),
+			vk::VertexInputAttributeDescription(1, 1, vk::Format::eR8G8B8A8Unorm, 0)
+		};
+	}
+};
+
+// Push constants of the sprite mode; position = boundsMin + unorm * boundsExtent
+struct SpriteParams
+{
+	glm::vec2 boundsMin;
+	glm::vec2 boundsExtent;
+	glm::vec2 halfSize;
+};
+
+// Vertex input used when bodies are integrated on the GPU: binding 0 is the
+// compute storage buffer itself (xyz position + mass per body), binding 1 the
+// packed RGBA8 body colors.
+struct ComputeVertex
+{
+	static std::array<vk::VertexInputBindingDescription, 2> getBindingDescription(vk::VertexInputRate inputRate = vk::VertexInputRate::eVertex)
+	{
+		return {
+			vk::VertexInputBindingDescription(0, 4 * sizeof(float), inputRate),
+			vk::VertexInputBindingDescription(1, sizeof(uint32_t), inputRate)
+		};
+	}
+
+	static std::array<vk::VertexInputAttributeDescription, 2> getAttributeDescription()
+	{
+		return {
+			vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32Sfloat, 0),
+			vk::VertexInputAttributeDescription(1, 1, vk::Format::eR8G8B8A8Unorm, 0)
+		};
+	}
+};
@@ -0,0 +1,262 @@
+#include "vulkan_memory.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+namespace
+{
+
+vk::DeviceSize alignUp(const vk::DeviceSize value, const vk::DeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+uint32_t findMemoryType(vk::PhysicalDevice physicalDevice, const uint32_t typeFilter, vk::MemoryPropertyFlags propertyFlags)
+{
+	auto memProperties = physicalDevice.getMemoryProperties();
+
+	for (auto i = 0u; i < memProperties.memoryTypeCount; ++i)
+	{
+		if ((typeFilter & (1 << i)) && ((memProperties.memoryTypes[i].propertyFlags & propertyFlags) == propertyFlags))
+		{
+			return i;
+		}
+	}
+
+	throw std::runtime_error("could not find compatible memory");
+}
+
+DeviceAllocation::DeviceAllocation(DeviceAllocation &&other) noexcept
+{
+	*this = std::move(other);
+}
+
+DeviceAllocation &DeviceAllocation::operator=(DeviceAllocation &&other) noexcept
+{
+	if (this != &other)
+	{
+		reset();
+		m_allocator = other.m_allocator;
+		m_memory = other.m_memory;
+		m_offset = other.m_offset;
+		m_size = other.m_size;
+		m_mapped = other.m_mapped;
+		m_memoryType = other.m_memoryType;
+		m_block = other.m_block;
+		other.m_allocator = nullptr;
+	}
+	return *this;
+}
+
+DeviceAllocation::~DeviceAllocation()
+{
+	reset();
+}
+
+void DeviceAllocation::reset()
+{
+	if (m_allocator)
+	{
+		m_allocator->release(m_memoryType, m_block, m_offset, m_size);
+		m_allocator = nullptr;
+	}
+}
+
+DeviceAllocator::DeviceAllocator(vk::Device device, vk::PhysicalDevice physicalDevice, const vk::DeviceSize blockSize)
+	: m_device(device),
+	  m_physicalDevice(physicalDevice),
+	  m_memoryProperties(physicalDevice.getMemoryProperties()),
+	  m_blockSize(blockSize)
+{
+}
+
+DeviceAllocation DeviceAllocator::allocate(const vk::MemoryRequirements &requirements, vk::MemoryPropertyFlags propertyFlags)
+{
+	const auto memoryType = findMemoryType(m_physicalDevice, requirements.memoryTypeBits, propertyFlags);
+	const auto alignment = std::max<vk::DeviceSize>(requirements.alignment, 1);
+
+	// Small heaps (e.g. the 256 MiB host-visible device-local window) would be exhausted by a few full blocks
+	const auto &heap = m_memoryProperties.memoryHeaps[m_memoryProperties.memoryTypes[memoryType].heapIndex];
+	const auto blockSize = std::min(m_blockSize, std::max<vk::DeviceSize>(heap.size / 8, 1));
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto &blocks = m_blocks[memoryType];
+	std::optional<vk::DeviceSize> offset;
+	uint32_t blockIndex = 0;
+	for (; blockIndex < blocks.size(); ++blockIndex)
+	{
+		if (blocks[blockIndex] && !blocks[blockIndex]->dedicated)
+		{
+			offset = takeRange(*blocks[blockIndex], requirements.size, alignment);
+			if (offset)
+			{
+				break;
+			}
+		}
+	}
+
+	if (!offset)
+	{
+		const bool dedicated = requirements.size > blockSize;
+		blockIndex = createBlock(memoryType, dedicated ? requirements.size : blockSize, dedicated);
+		offset = takeRange(*blocks[blockIndex], requirements.size, alignment);
+	}
+
+	auto &block = *blocks[blockIndex];
+	block.used += requirements.size;
+	++block.allocationCount;
+
+	DeviceAllocation allocation;
+	allocation.m_allocator = this;
+	allocation.m_memory = block.memory.get();
+	allocation.m_offset = *offset;
+	allocation.m_size = requirements.size;
+	allocation.m_mapped = block.mapped ? static_cast<char *>(block.mapped) + *offset : nullptr;
+	allocation.m_memoryType = memoryType;
+	allocation.m_block = blockIndex;
+	return allocation;
+}
+
+DeviceAllocation DeviceAllocator::bindBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags propertyFlags)
+{
+	auto allocation = allocate(m_device.getBufferMemoryRequirements(buffer), propertyFlags);
+	m_device.bindBufferMemory(buffer, allocation.memory(), allocation.offset());
+	return allocation;
+}
+
+DeviceMemoryStats DeviceAllocator::stats() const
+{
+	DeviceMemoryStats total;
+	for (uint32_t memoryType = 0; memoryType < m_memoryProperties.memoryTypeCount; ++memoryType)
+	{
+		auto typeStats = stats(memoryType);
+		total.blockCount += typeStats.blockCount;
+		total.allocationCount += typeStats.allocationCount;
+		total.reservedBytes += typeStats.reservedBytes;
+		total.usedBytes += typeStats.usedBytes;
+	}
+	return total;
+}
+
+DeviceMemoryStats DeviceAllocator::stats(const uint32_t memoryType) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	DeviceMemoryStats typeStats;
+	for (const auto &block : m_blocks[memoryType])
+	{
+		if (block)
+		{
+			++typeStats.blockCount;
+			typeStats.allocationCount += block->allocationCount;
+			typeStats.reservedBytes += block->size;
+			typeStats.usedBytes += block->used;
+		}
+	}
+	return typeStats;
+}
+
+std::optional<vk::DeviceSize> DeviceAllocator::takeRange(Block &block, const vk::DeviceSize size, const vk::DeviceSize alignment)
+{
+	for (auto range = block.freeRanges.begin(); range != block.freeRanges.end(); ++range)
+	{
+		const auto rangeBegin = range->first;
+		const auto rangeEnd = range->first + range->second;
+		const auto offset = alignUp(rangeBegin, alignment);
+		if (offset + size > rangeEnd)
+		{
+			continue;
+		}
+
+		// Alignment padding in front stays free and is merged back once the neighbour is released
+		block.freeRanges.erase(range);
+		if (offset > rangeBegin)
+		{
+			block.freeRanges.emplace(rangeBegin, offset - rangeBegin);
+		}
+		if (offset + size < rangeEnd)
+		{
+			block.freeRanges.emplace(offset + size, rangeEnd - offset - size);
+		}
+		return offset;
+	}
+
+	return std::nullopt;
+}
+
+uint32_t DeviceAllocator::createBlock(const uint32_t memoryType, const vk::DeviceSize size, const bool dedicated)
+{
+	auto block = std::make_unique<Block>();
+	block->memory = m_device.allocateMemoryUnique(vk::MemoryAllocateInfo(size, memoryType));
+	block->size = size;
+	block->dedicated = dedicated;
+	block->freeRanges.emplace(0, size);
+
+	if (m_memoryProperties.memoryTypes[memoryType].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+	{
+		block->mapped = m_device.mapMemory(block->memory.get(), 0, VK_WHOLE_SIZE);
+	}
+
+	auto &blocks = m_blocks[memoryType];
+	auto slot = std::find(blocks.begin(), blocks.end(), nullptr);
+	if (slot != blocks.end())
+	{
+		*slot = std::move(block);
+		return static_cast<uint32_t>(slot - blocks.begin());
+	}
+
+	blocks.push_back(std::move(block));
+	return static_cast<uint32_t>(blocks.size() - 1);
+}
+
+void DeviceAllocator::release(const uint32_t memoryType, const uint32_t blockIndex, const vk::DeviceSize offset, const vk::DeviceSize size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto &block = *m_blocks[memoryType][blockIndex];
+	block.used -= size;
+	--block.allocationCount;
+
+	auto inserted = block.freeRanges.emplace(offset, size).first;
+
+	auto next = std::next(inserted);
+	if (next != block.freeRanges.end() && inserted->first + inserted->second == next->first)
+	{
+		inserted->second += next->second;
+		block.freeRanges.erase(next);
+	}
+
+	if (inserted != block.freeRanges.begin())
+	{
+		auto previous = std::prev(inserted);
+		if (previous->first + previous->second == inserted->first)
+		{
+			previous->second += inserted->second;
+			block.freeRanges.erase(inserted);
+		}
+	}
+
+	// Dedicated blocks are never reused; shared blocks stay around to absorb the next resize
+	if (block.dedicated && block.allocationCount == 0)
+	{
+		m_blocks[memoryType][blockIndex].reset();
+	}
+}
+
+std::optional<vk::DeviceSize> LinearArena::allocate(const vk::DeviceSize size, const vk::DeviceSize alignment)
+{
+	// Aligning the absolute offset keeps buffers bound inside the arena valid
+	const auto base = m_allocation.offset();
+	const auto offset = alignUp(base + m_head, std::max<vk::DeviceSize>(alignment, 1)) - base;
+	if (offset + size > capacity())
+	{
+		return std::nullopt;
+	}
+
+	m_head = offset + size;
+	return offset;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+uint32_t findMemoryType(vk::PhysicalDevice physicalDevice, uint32_t typeFilter, vk::MemoryPropertyFlags propertyFlags);
+
+class DeviceAllocator;
+
+// A sub-range of a device memory block. Returns itself to the allocator when
+// destroyed, so it follows the same ownership rules as vk::Unique* handles.
+class DeviceAllocation
+{
+public:
+	DeviceAllocation() = default;
+	DeviceAllocation(DeviceAllocation &&other) noexcept;
+	DeviceAllocation &operator=(DeviceAllocation &&other) noexcept;
+	~DeviceAllocation();
+
+	DeviceAllocation(const DeviceAllocation &) = delete;
+	DeviceAllocation &operator=(const DeviceAllocation &) = delete;
+
+	explicit operator bool() const
+	{
+		return m_allocator != nullptr;
+	}
+
+	vk::DeviceMemory memory() const
+	{
+		return m_memory;
+	}
+
+	vk::DeviceSize offset() const
+	{
+		return m_offset;
+	}
+
+	vk::DeviceSize size() const
+	{
+		return m_size;
+	}
+
+	// Persistently mapped address of offset(), or nullptr for memory that is not host-visible
+	void *mapped() const
+	{
+		return m_mapped;
+	}
+
+	void reset();
+
+private:
+	friend class DeviceAllocator;
+
+	DeviceAllocator *m_allocator = nullptr;
+	vk::DeviceMemory m_memory;
+	vk::DeviceSize m_offset = 0;
+	vk::DeviceSize m_size = 0;
+	void *m_mapped = nullptr;
+	uint32_t m_memoryType = 0;
+	uint32_t m_block = 0;
+};
+
+struct DeviceMemoryStats
+{
+	uint32_t blockCount = 0;
+	uint32_t allocationCount = 0;
+	vk::DeviceSize reservedBytes = 0;
+	vk::DeviceSize usedBytes = 0;
+};
+
+// Sub-allocates buffers from large vkAllocateMemory blocks, one block list per
+// memory type. Free space inside a block is kept as an offset-sorted free list
+// (first fit, neighbours coalesced on free). Host-visible blocks are mapped once
+// for their whole lifetime. Requests larger than a block get a dedicated block.
+class DeviceAllocator
+{
+public:
+	static constexpr vk::DeviceSize DEFAULT_BLOCK_SIZE = 64ull << 20;
+
+	DeviceAllocator() = default;
+	DeviceAllocator(vk::Device device, vk::PhysicalDevice physicalDevice, vk::DeviceSize blockSize = DEFAULT_BLOCK_SIZE);
+
+	DeviceAllocator(const DeviceAllocator &) = delete;
+	DeviceAllocator &operator=(const DeviceAllocator &) = delete;
+
+	DeviceAllocation allocate(const vk::MemoryRequirements &requirements, vk::MemoryPropertyFlags propertyFlags);
+
+	// Allocates memory fitting buffer and binds it
+	DeviceAllocation bindBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags propertyFlags);
+
+	DeviceMemoryStats stats() const;
+	DeviceMemoryStats stats(uint32_t memoryType) const;
+
+	vk::PhysicalDevice physicalDevice() const
+	{
+		return m_physicalDevice;
+	}
+
+private:
+	friend class DeviceAllocation;
+
+	struct Block
+	{
+		vk::UniqueDeviceMemory memory;
+		vk::DeviceSize size = 0;
+		vk::DeviceSize used = 0;
+		uint32_t allocationCount = 0;
+		void *mapped = nullptr;
+		bool dedicated = false;
+		std::map<vk::DeviceSize, vk::DeviceSize> freeRanges; // offset -> size
+	};
+
+	static std::optional<vk::DeviceSize> takeRange(Block &block, vk::DeviceSize size, vk::DeviceSize alignment);
+	uint32_t createBlock(uint32_t memoryType, vk::DeviceSize size, bool dedicated);
+	void release(uint32_t memoryType, uint32_t blockIndex, vk::DeviceSize offset, vk::DeviceSize size);
+
+	vk::Device m_device;
+	vk::PhysicalDevice m_physicalDevice;
+	vk::PhysicalDeviceMemoryProperties m_memoryProperties;
+	vk::DeviceSize m_blockSize = DEFAULT_BLOCK_SIZE;
+	mutable std::mutex m_mutex;
+	// Released blocks leave an empty slot so block indices held by allocations stay valid
+	std::array<std::vector<std::unique_ptr<Block>>, VK_MAX_MEMORY_TYPES> m_blocks;
+};
+
+// Bump allocator over one allocation, for data that lives at most a frame or
+// until a known point: allocate() hands out aligned offsets, reset() frees all.
+class LinearArena
+{
+public:
+	LinearArena() = default;
+
+	explicit LinearArena(DeviceAllocation allocation)
+		: m_allocation(std::move(allocation))
+	{
+	}
+
+	// Offset relative to allocation().offset(), or nothing when the arena is full
+	std::optional<vk::DeviceSize> allocate(vk::DeviceSize size, vk::DeviceSize alignment);
+
+	void reset()
+	{
+		m_head = 0;
+	}
+
+	const DeviceAllocation &allocation() const
+	{
+		return m_allocation;
+	}
+
+	vk::DeviceSize capacity() const
+	{
+		return m_allocation.size();
+	}
+
+	vk::DeviceSize used() const
+	{
+		return m_head;
+	}
+
+private:
+	DeviceAllocation m_allocation;
+	vk::DeviceSize m_head = 0;
+};
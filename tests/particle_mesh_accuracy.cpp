@@ -0,0 +1,104 @@
+// Pair forces of the particle-mesh solvers against Newtonian gravity. A unit
+// mass sits on a mesh node or at a random offset inside a cell, and a massless
+// probe sits along each of the six mesh axis directions, where an unbalanced
+// CIC deconvolution shows up as ringing. Separations stay below an eighth of
+// the box, where the periodic images change the force by under one percent.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+#include "particle_mesh.h"
+#include "particle_store.h"
+#include "thread_pool.h"
+
+namespace
+{
+	// Worst relative error of the radial force over all placements at this separation
+	double worstAxisError(ParticleMeshSolver &solver, ThreadPool &pool, const float cells)
+	{
+		const auto cell = solver.mesh().boxSize / static_cast<float>(solver.mesh().meshSize);
+		const auto r = cells * cell;
+
+		std::mt19937 rng(7);
+		std::uniform_real_distribution<float> offset(-0.5f * cell, 0.5f * cell);
+
+		double worst = 0.0;
+		for (int placement = 0; placement < 4; ++placement)
+		{
+			float source[3] = { 0.0f, 0.0f, 0.0f };
+			if (placement > 0)
+			{
+				source[0] = offset(rng);
+				source[1] = offset(rng);
+				source[2] = offset(rng);
+			}
+
+			for (int direction = 0; direction < 6; ++direction)
+			{
+				const auto axis = direction / 2;
+				const auto sign = direction % 2 == 0 ? 1.0f : -1.0f;
+
+				ParticleStore particles(2);
+				particles.x[0] = source[0];
+				particles.y[0] = source[1];
+				particles.z[0] = source[2];
+				particles.mass[0] = 1.0f;
+				float probe[3] = { source[0], source[1], source[2] };
+				probe[axis] += sign * r;
+				particles.x[1] = probe[0];
+				particles.y[1] = probe[1];
+				particles.z[1] = probe[2];
+				particles.mass[1] = 0.0f;
+
+				solver.computeAccelerations(particles, pool);
+
+				const float acceleration[3] = { particles.ax[1], particles.ay[1], particles.az[1] };
+				const auto radial = -sign * acceleration[axis];
+				worst = std::max(worst, std::fabs(radial * r * r - 1.0));
+			}
+		}
+		return worst;
+	}
+
+	bool check(const char *label, const float splitScale, const float nearest, const double tolerance)
+	{
+		GravityParams gravity;
+		gravity.softening = 1e-4f;
+
+		ParticleMeshParams mesh;
+		mesh.boxSize = 4.0f;
+		mesh.meshSize = 64;
+		mesh.splitScale = splitScale;
+
+		ThreadPool pool(2);
+		ParticleMeshSolver solver(gravity, mesh);
+
+		auto passed = true;
+		for (const auto cells : { 0.5f, 1.0f, 2.0f, 3.0f, 4.0f, 4.8f, 5.6f, 6.4f, 7.2f, 8.0f })
+		{
+			if (cells < nearest)
+			{
+				continue;
+			}
+
+			const auto error = worstAxisError(solver, pool, cells);
+			std::printf("%-7s %4.1f cells: worst relative error %.4f\n", label, cells, error);
+			if (!(error <= tolerance))
+			{
+				std::fprintf(stderr, "%s: error %.4f at %.1f cells exceeds %.4f\n", label, error, cells, tolerance);
+				passed = false;
+			}
+		}
+		return passed;
+	}
+}
+
+int main()
+{
+	// The mesh alone does not resolve the nearest few cells
+	auto passed = check("pm", 0.0f, 4.0f, 0.08);
+	passed = check("treepm", 1.25f, 0.5f, 0.04) && passed;
+	return passed ? 0 : 1;
+}